@@ -0,0 +1,483 @@
+// UDP proxy that makes loopback behave like a bad network. Clients talk to the proxy, it
+// talks to the server from one socket per client, and every datagram in either direction
+// goes through a link with delay, jitter, loss (uniform or Gilbert-Elliott bursts),
+// duplication, reordering and a bandwidth cap with a drop-tail queue.
+//
+// netem_proxy [--listen port] [--server host:port] [--seed n] [--script file] [--<condition> value]...
+//
+// Conditions apply to both directions, prefix them with up. (client to server) or down.
+// to set one side only:
+//   delay=ms jitter=ms loss=% ge=p%,r%,bad_loss% dup=% reorder=% rate=kbit/s queue=ms
+// ge switches to the bad state with probability p and back with r on every packet, the
+// good state loses loss% and the bad one bad_loss%. rate=0 is unlimited.
+// A script changes them over time, one "<seconds> key=value..." per line, # comments, e.g.
+//   0  delay=30 jitter=5
+//   10 loss=2
+//   20 ge=5,30,60 up.rate=256
+//   40 loss=0 ge=0,0,0 up.rate=0
+// The same seed and script give the same drops and delays for the same traffic.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include "socket_tools.h"
+
+struct Conditions
+{
+  double delayMs = 0.0;
+  double jitterMs = 0.0;
+  double lossPercent = 0.0;
+  double geToBadPercent = 0.0; // Gilbert-Elliott, per packet
+  double geToGoodPercent = 0.0;
+  double geBadLossPercent = 0.0;
+  double duplicatePercent = 0.0;
+  double reorderPercent = 0.0;
+  double rateKbps = 0.0;
+  double queueMs = 200.0; // longest wait for the bandwidth cap before a packet is dropped
+};
+
+struct LinkStats
+{
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+  uint64_t lost = 0;
+  uint64_t burstLost = 0; // of lost, in the Gilbert-Elliott bad state
+  uint64_t queueDropped = 0;
+  uint64_t duplicated = 0;
+  uint64_t reordered = 0;
+  uint64_t delivered = 0;
+  uint64_t delayUsSum = 0;
+};
+
+struct Datagram
+{
+  uint64_t arrivedAt = 0; // us
+  uint64_t deliverAt = 0;
+  uint64_t order = 0; // ties keep arrival order
+  size_t client = 0;
+  uint64_t clientId = 0; // the slot may have gone to someone else by the time this is due
+  std::vector<uint8_t> data;
+};
+
+struct LaterFirst
+{
+  bool operator()(const Datagram &a, const Datagram &b) const
+  {
+    return a.deliverAt != b.deliverAt ? a.deliverAt > b.deliverAt : a.order > b.order;
+  }
+};
+
+// One direction.
+struct Link
+{
+  const char *name;
+  Conditions cond;
+  bool geBad = false;
+  uint64_t lineFreeAt = 0; // when the bandwidth cap has sent everything queued so far
+  uint64_t lastDeliverAt = 0; // in order delivery unless a packet is picked for reordering
+  std::priority_queue<Datagram, std::vector<Datagram>, LaterFirst> inFlight;
+  LinkStats stats;
+};
+
+struct Client
+{
+  sockaddr_in address;
+  int sfd = -1; // to the server, -1 once gone quiet and the slot is free
+  uint64_t id = 0;
+  uint64_t lastSeen = 0;
+};
+
+struct ScriptStep
+{
+  double atSeconds = 0.0;
+  std::vector<std::string> settings;
+};
+
+constexpr uint64_t client_timeout_us = 30000000;
+
+static std::mt19937_64 rng;
+static uint64_t nextOrder = 0;
+
+static uint64_t time_usec()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static bool chance(double percent)
+{
+  return percent > 0.0 && std::uniform_real_distribution<double>(0.0, 100.0)(rng) < percent;
+}
+
+static bool set_condition(Conditions &c, const std::string &key, const char *value)
+{
+  double v = atof(value);
+  if (key == "delay")
+    c.delayMs = v;
+  else if (key == "jitter")
+    c.jitterMs = v;
+  else if (key == "loss")
+    c.lossPercent = v;
+  else if (key == "ge")
+  {
+    if (sscanf(value, "%lf,%lf,%lf", &c.geToBadPercent, &c.geToGoodPercent, &c.geBadLossPercent) != 3)
+      return false;
+  }
+  else if (key == "dup")
+    c.duplicatePercent = v;
+  else if (key == "reorder")
+    c.reorderPercent = v;
+  else if (key == "rate")
+    c.rateKbps = v;
+  else if (key == "queue")
+    c.queueMs = v;
+  else
+    return false;
+  return true;
+}
+
+// "delay=30", "up.loss=5", or the key and value of a command line option
+static bool apply_setting(Link links[2], const std::string &key, const char *value)
+{
+  if (key.compare(0, 3, "up.") == 0)
+    return set_condition(links[0].cond, key.substr(3), value);
+  if (key.compare(0, 5, "down.") == 0)
+    return set_condition(links[1].cond, key.substr(5), value);
+  return set_condition(links[0].cond, key, value) && set_condition(links[1].cond, key, value);
+}
+
+static bool apply_setting(Link links[2], const std::string &setting)
+{
+  size_t eq = setting.find('=');
+  if (eq == std::string::npos)
+    return false;
+  return apply_setting(links, setting.substr(0, eq), setting.c_str() + eq + 1);
+}
+
+static bool load_script(const char *path, std::vector<ScriptStep> &steps)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    printf("Cannot open %s\n", path);
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), f))
+  {
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    char *token = strtok(line, " \t\r\n");
+    if (!token)
+      continue;
+    ScriptStep step;
+    step.atSeconds = atof(token);
+    while ((token = strtok(nullptr, " \t\r\n")))
+      step.settings.push_back(token);
+    steps.push_back(step);
+  }
+  fclose(f);
+  std::stable_sort(steps.begin(), steps.end(), [](const ScriptStep &a, const ScriptStep &b) { return a.atSeconds < b.atSeconds; });
+  return true;
+}
+
+static void print_conditions(const Link &link)
+{
+  const Conditions &c = link.cond;
+  printf("  %-4s delay %.0f+-%.0f ms, loss %.1f%%, ge %.1f/%.1f/%.0f%%, dup %.1f%%, reorder %.1f%%, rate %.0f kbit/s\n",
+         link.name, c.delayMs, c.jitterMs, c.lossPercent, c.geToBadPercent, c.geToGoodPercent, c.geBadLossPercent,
+         c.duplicatePercent, c.reorderPercent, c.rateKbps);
+}
+
+static void schedule(Link &link, const Client *clients, size_t client, const uint8_t *data, size_t size, uint64_t now,
+                     bool duplicate)
+{
+  const Conditions &c = link.cond;
+  // bandwidth cap: wait for the line, drop what would wait too long
+  uint64_t sendAt = now;
+  if (c.rateKbps > 0.0)
+  {
+    uint64_t start = std::max(now, link.lineFreeAt);
+    if (start - now > uint64_t(c.queueMs * 1000.0))
+    {
+      link.stats.queueDropped++;
+      return;
+    }
+    link.lineFreeAt = start + uint64_t(size * 8 * 1000.0 / c.rateKbps);
+    sendAt = link.lineFreeAt;
+  }
+  double delayMs = c.delayMs;
+  if (c.jitterMs > 0.0)
+    delayMs += std::uniform_real_distribution<double>(-c.jitterMs, c.jitterMs)(rng);
+  uint64_t deliverAt = sendAt + uint64_t(std::max(delayMs, 0.0) * 1000.0);
+  if (!duplicate && chance(c.reorderPercent))
+  {
+    // overtakes whatever is in flight
+    deliverAt = sendAt;
+    link.stats.reordered++;
+  }
+  else
+  {
+    deliverAt = std::max(deliverAt, link.lastDeliverAt);
+    link.lastDeliverAt = deliverAt;
+  }
+  Datagram d;
+  d.arrivedAt = now;
+  d.deliverAt = deliverAt;
+  d.order = nextOrder++;
+  d.client = client;
+  d.clientId = clients[client].id;
+  d.data.assign(data, data + size);
+  link.inFlight.push(std::move(d));
+}
+
+static void on_datagram(Link &link, const Client *clients, size_t client, const uint8_t *data, size_t size, uint64_t now)
+{
+  const Conditions &c = link.cond;
+  link.stats.packets++;
+  link.stats.bytes += size;
+  // the state moves on every packet, so bursts are measured in packets like the loss
+  if (link.geBad ? chance(c.geToGoodPercent) : chance(c.geToBadPercent))
+    link.geBad = !link.geBad;
+  if (link.geBad && chance(c.geBadLossPercent))
+  {
+    link.stats.lost++;
+    link.stats.burstLost++;
+    return;
+  }
+  if (!link.geBad && chance(c.lossPercent))
+  {
+    link.stats.lost++;
+    return;
+  }
+  schedule(link, clients, client, data, size, now, false);
+  if (chance(c.duplicatePercent))
+  {
+    link.stats.duplicated++;
+    schedule(link, clients, client, data, size, now, true);
+  }
+}
+
+static void print_stats(Link links[2], size_t clients, double seconds)
+{
+  printf("[%7.1f s] %zu clients\n", seconds, clients);
+  for (int i = 0; i < 2; ++i)
+  {
+    LinkStats &s = links[i].stats;
+    printf("  %-4s %6llu in, %6llu out, lost %llu (%llu in bursts), queue drops %llu, dup %llu, reordered %llu, "
+           "avg delay %.1f ms\n", links[i].name,
+           (unsigned long long)s.packets, (unsigned long long)s.delivered, (unsigned long long)s.lost,
+           (unsigned long long)s.burstLost, (unsigned long long)s.queueDropped, (unsigned long long)s.duplicated,
+           (unsigned long long)s.reordered, s.delivered ? s.delayUsSum * 1e-3 / s.delivered : 0.0);
+    s = LinkStats();
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  const char *listenPort = "10132";
+  std::string serverHost = "localhost";
+  std::string serverPort = "10131";
+  uint64_t seed = 1;
+  std::vector<ScriptStep> script;
+  Link links[2];
+  links[0].name = "up";
+  links[1].name = "down";
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--listen") && i + 1 < argc)
+      listenPort = argv[++i];
+    else if (!strcmp(argv[i], "--server") && i + 1 < argc)
+    {
+      std::string server = argv[++i];
+      size_t colon = server.rfind(':');
+      serverHost = server.substr(0, colon);
+      if (colon != std::string::npos)
+        serverPort = server.substr(colon + 1);
+    }
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      seed = strtoull(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--script") && i + 1 < argc)
+    {
+      if (!load_script(argv[++i], script))
+        return 1;
+    }
+    else if (!strncmp(argv[i], "--", 2) && i + 1 < argc && apply_setting(links, argv[i] + 2, argv[i + 1]))
+      ++i;
+    else
+    {
+      printf("Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  rng.seed(seed);
+  setvbuf(stdout, nullptr, _IOLBF, 0); // progress shows up when piped to a file too
+
+  int listenSfd = create_dgram_socket(nullptr, listenPort, nullptr);
+  if (listenSfd == -1)
+  {
+    printf("Cannot listen on %s\n", listenPort);
+    return 1;
+  }
+
+  // once, every client's socket sends to the same place
+  addrinfo hints;
+  memset(&hints, 0, sizeof(addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *serverAddr = nullptr;
+  if (getaddrinfo(serverHost.c_str(), serverPort.c_str(), &hints, &serverAddr) != 0)
+  {
+    printf("Cannot resolve %s:%s\n", serverHost.c_str(), serverPort.c_str());
+    return 1;
+  }
+  sockaddr_in serverAddress;
+  memcpy(&serverAddress, serverAddr->ai_addr, sizeof(sockaddr_in));
+  freeaddrinfo(serverAddr);
+  printf("proxying :%s -> %s:%s\n", listenPort, serverHost.c_str(), serverPort.c_str());
+
+  std::vector<Client> clients;
+  size_t liveClients = 0;
+  uint64_t nextClientId = 1;
+  size_t scriptStep = 0;
+  uint64_t start = time_usec();
+  uint64_t nextStats = start + 1000000;
+  static uint8_t buffer[65536];
+
+  while (true)
+  {
+    uint64_t now = time_usec();
+    while (scriptStep < script.size() && now - start >= uint64_t(script[scriptStep].atSeconds * 1e6))
+    {
+      for (const std::string &setting : script[scriptStep].settings)
+        if (!apply_setting(links, setting))
+          printf("Bad setting %s\n", setting.c_str());
+      printf("[%7.1f s] conditions now\n", (now - start) * 1e-6);
+      print_conditions(links[0]);
+      print_conditions(links[1]);
+      scriptStep++;
+    }
+
+    // sleep until the next packet is due, or something arrives
+    uint64_t wakeAt = now + 10000;
+    for (const Link &link : links)
+      if (!link.inFlight.empty())
+        wakeAt = std::min(wakeAt, link.inFlight.top().deliverAt);
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(listenSfd, &readSet);
+    int maxFd = listenSfd;
+    for (const Client &c : clients)
+    {
+      if (c.sfd == -1)
+        continue;
+      FD_SET(c.sfd, &readSet);
+      maxFd = std::max(maxFd, c.sfd);
+    }
+    uint64_t waitUs = wakeAt > now ? wakeAt - now : 0;
+    timeval timeout = { time_t(waitUs / 1000000), suseconds_t(waitUs % 1000000) };
+    select(maxFd + 1, &readSet, NULL, NULL, &timeout);
+    now = time_usec();
+
+    if (FD_ISSET(listenSfd, &readSet))
+    {
+      while (true)
+      {
+        sockaddr_in from;
+        socklen_t fromLen = sizeof(sockaddr_in);
+        ssize_t numBytes = recvfrom(listenSfd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+        if (numBytes <= 0)
+          break;
+        size_t index = 0;
+        while (index < clients.size() && (clients[index].sfd == -1 ||
+                                          clients[index].address.sin_addr.s_addr != from.sin_addr.s_addr ||
+                                          clients[index].address.sin_port != from.sin_port))
+          index++;
+        if (index == clients.size())
+        {
+          Client client;
+          client.address = from;
+          client.id = nextClientId++;
+          client.sfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+          if (client.sfd == -1)
+          {
+            printf("Cannot create a socket to %s:%s\n", serverHost.c_str(), serverPort.c_str());
+            continue;
+          }
+          fcntl(client.sfd, F_SETFL, O_NONBLOCK);
+          // into the first free slot, what is still in flight for its last owner is told apart by id
+          index = 0;
+          while (index < clients.size() && clients[index].sfd != -1)
+            index++;
+          if (index == clients.size())
+            clients.push_back(client);
+          else
+            clients[index] = client;
+          liveClients++;
+          printf("client %x:%u\n", ntohl(from.sin_addr.s_addr), ntohs(from.sin_port));
+        }
+        clients[index].lastSeen = now;
+        on_datagram(links[0], clients.data(), index, buffer, size_t(numBytes), now);
+      }
+    }
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+      if (clients[i].sfd == -1 || !FD_ISSET(clients[i].sfd, &readSet))
+        continue;
+      ssize_t numBytes;
+      while ((numBytes = recvfrom(clients[i].sfd, buffer, sizeof(buffer), 0, nullptr, nullptr)) > 0)
+        on_datagram(links[1], clients.data(), i, buffer, size_t(numBytes), now);
+    }
+
+    for (int dir = 0; dir < 2; ++dir)
+    {
+      Link &link = links[dir];
+      while (!link.inFlight.empty() && link.inFlight.top().deliverAt <= now)
+      {
+        const Datagram &d = link.inFlight.top();
+        // dropped on the floor if its client went quiet meanwhile
+        if (clients[d.client].sfd != -1 && clients[d.client].id == d.clientId)
+        {
+          const Client &c = clients[d.client];
+          if (dir == 0)
+            sendto(c.sfd, d.data.data(), d.data.size(), 0, (const sockaddr*)&serverAddress, sizeof(sockaddr_in));
+          else
+            sendto(listenSfd, d.data.data(), d.data.size(), 0, (const sockaddr*)&c.address, sizeof(sockaddr_in));
+          link.stats.delivered++;
+          link.stats.delayUsSum += now - d.arrivedAt;
+        }
+        link.inFlight.pop();
+      }
+    }
+
+    if (now >= nextStats)
+    {
+      // forget clients gone quiet, their slots are reused by the next new ones
+      for (Client &c : clients)
+        if (c.sfd != -1 && now - c.lastSeen > client_timeout_us)
+        {
+          close(c.sfd);
+          c.sfd = -1;
+          liveClients--;
+          printf("client %x:%u timed out\n", ntohl(c.address.sin_addr.s_addr), ntohs(c.address.sin_port));
+        }
+      print_stats(links, liveClients, (now - start) * 1e-6);
+      nextStats += 1000000;
+    }
+  }
+  return 0;
+}
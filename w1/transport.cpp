@@ -0,0 +1,887 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "socket_tools.h"
+#include "transport.h"
+
+enum PacketKind : uint8_t
+{
+  E_PACKET_CONNECT = 0x71,
+  E_PACKET_ACCEPT,
+  E_PACKET_DATA,
+  E_PACKET_DISCONNECT
+};
+
+enum ConnectionState : uint8_t
+{
+  E_CONNECTION_FREE = 0,
+  E_CONNECTION_CONNECTING,
+  E_CONNECTION_CONNECTED
+};
+
+// kind | connection id | seq | ack | ack bits
+constexpr size_t header_size = sizeof(uint8_t) + 3 * sizeof(uint16_t) + sizeof(uint32_t);
+// channel | message seq | size
+constexpr size_t message_header_size = sizeof(uint8_t) + 2 * sizeof(uint16_t);
+constexpr size_t max_datagram_size = header_size + message_header_size + transport_max_payload;
+
+constexpr size_t sent_window = 1024;
+constexpr size_t reliable_window = 256;
+constexpr size_t max_reliable_per_packet = 16;
+constexpr size_t sweep_per_service = 64;
+constexpr int socket_buffer_size = 4 * 1024 * 1024;
+
+constexpr uint64_t ack_delay_us = 5000;
+constexpr uint64_t connect_resend_us = 250000;
+constexpr uint64_t connect_timeout_us = 5000000;
+constexpr uint64_t keepalive_us = 1000000;
+constexpr uint64_t timeout_us = 10000000;
+constexpr uint64_t initial_rto_us = 100000;
+constexpr uint64_t min_rto_us = 20000;
+constexpr uint64_t max_rto_us = 1000000;
+
+struct OutgoingMessage
+{
+  uint8_t channel = 0;
+  bool acked = false;
+  uint16_t seq = 0;
+  uint64_t lastSendTime = 0;
+  TransportPacket *packet = nullptr;
+};
+
+struct SentPacket
+{
+  bool valid = false;
+  bool acked = false;
+  uint16_t seq = 0;
+  uint8_t numReliable = 0;
+  uint64_t sendTime = 0;
+  uint16_t reliableSeqs[max_reliable_per_packet];
+};
+
+struct ConnectionImpl : TransportConnection
+{
+  ConnectionState state = E_CONNECTION_FREE;
+  sockaddr_in address;
+  uint16_t remoteId = 0;
+  uint32_t nonce = 0;
+
+  // send side
+  uint16_t localSeq = 0;
+  uint16_t nextReliableSeq = 0;
+  uint16_t nextUnreliableSeq = 0;
+  std::deque<OutgoingMessage> reliableQueue; // unacked, ordered by seq
+  std::vector<OutgoingMessage> unreliableQueue;
+  std::vector<SentPacket> sent;
+  uint64_t srtt = 0;
+  uint64_t rttVar = 0;
+  uint64_t rto = initial_rto_us;
+
+  // receive side
+  bool receivedAny = false;
+  bool receivedUnreliable = false;
+  bool needsAck = false;
+  uint16_t remoteSeq = 0;
+  uint32_t ackBits = 0;
+  uint16_t expectedReliableSeq = 0;
+  uint16_t lastUnreliableSeq = 0;
+  uint64_t ackTime = 0;
+  std::vector<TransportPacket*> reorder;
+
+  uint64_t createTime = 0;
+  uint64_t lastSendTime = 0;
+  uint64_t lastReceiveTime = 0;
+
+  // ids can still sit in these lists after the slot is freed, so the flags survive a reset
+  bool inDirtyList = false;
+  bool inPendingList = false;
+  bool inAckList = false;
+};
+
+struct ConnectKey
+{
+  uint32_t host;
+  uint16_t port;
+  uint32_t nonce;
+
+  bool operator==(const ConnectKey &rhs) const { return host == rhs.host && port == rhs.port && nonce == rhs.nonce; }
+};
+
+struct ConnectKeyHash
+{
+  size_t operator()(const ConnectKey &k) const
+  {
+    uint64_t h = (uint64_t(k.host) << 32 | uint64_t(k.port) << 16) ^ (uint64_t(k.nonce) * 0x9e3779b97f4a7c15ull);
+    return size_t(h ^ (h >> 29));
+  }
+};
+
+struct TransportHost
+{
+  int sfd = -1;
+  bool isServer = false;
+  std::vector<ConnectionImpl> connections;
+  std::vector<uint16_t> freeIds;
+  std::unordered_map<ConnectKey, uint16_t, ConnectKeyHash> connectMap;
+  std::vector<uint16_t> dirty;
+  std::vector<uint16_t> pending; // connections with unacked reliable messages
+  std::vector<uint16_t> delayedAcks;
+  std::deque<TransportEvent> events;
+  size_t sweepCursor = 0;
+  size_t connectedCount = 0;
+  std::mt19937 rng{std::random_device{}()};
+};
+
+static uint64_t time_usec()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool seq_greater(uint16_t a, uint16_t b)
+{
+  return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+}
+
+template<typename T>
+static void write(uint8_t *&ptr, T val)
+{
+  memcpy(ptr, &val, sizeof(T)); ptr += sizeof(T);
+}
+
+template<typename T>
+static T read(const uint8_t *&ptr)
+{
+  T val;
+  memcpy(&val, ptr, sizeof(T)); ptr += sizeof(T);
+  return val;
+}
+
+static bool same_address(const sockaddr_in &a, const sockaddr_in &b)
+{
+  return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+static bool resolve_address(const char *address, const char *port, sockaddr_in &out)
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(address, port, &hints, &result) != 0 || !result)
+    return false;
+  memcpy(&out, result->ai_addr, sizeof(sockaddr_in));
+  freeaddrinfo(result);
+  return true;
+}
+
+TransportPacket *transport_packet_create(const void *data, size_t size)
+{
+  TransportPacket *packet = new TransportPacket;
+  packet->data = new uint8_t[size > 0 ? size : 1];
+  packet->dataLength = size;
+  if (data)
+    memcpy(packet->data, data, size);
+  return packet;
+}
+
+void transport_packet_destroy(TransportPacket *packet)
+{
+  if (!packet)
+    return;
+  delete[] packet->data;
+  delete packet;
+}
+
+static void reset_connection(TransportHost *host, ConnectionImpl &conn, uint16_t id)
+{
+  for (OutgoingMessage &msg : conn.reliableQueue)
+    transport_packet_destroy(msg.packet);
+  for (OutgoingMessage &msg : conn.unreliableQueue)
+    transport_packet_destroy(msg.packet);
+  for (TransportPacket *&packet : conn.reorder)
+  {
+    transport_packet_destroy(packet);
+    packet = nullptr;
+  }
+  bool inDirtyList = conn.inDirtyList;
+  bool inPendingList = conn.inPendingList;
+  bool inAckList = conn.inAckList;
+  std::vector<SentPacket> sent = std::move(conn.sent);
+  std::vector<TransportPacket*> reorder = std::move(conn.reorder);
+
+  conn = ConnectionImpl();
+  conn.host = host;
+  conn.id = id;
+  conn.inDirtyList = inDirtyList;
+  conn.inPendingList = inPendingList;
+  conn.inAckList = inAckList;
+  conn.sent = std::move(sent);
+  conn.sent.assign(sent_window, SentPacket());
+  conn.reorder = std::move(reorder);
+  conn.reorder.assign(reliable_window, nullptr);
+}
+
+static void mark_dirty(TransportHost *host, ConnectionImpl &conn)
+{
+  if (conn.inDirtyList)
+    return;
+  conn.inDirtyList = true;
+  host->dirty.push_back(conn.id);
+}
+
+static void mark_pending(TransportHost *host, ConnectionImpl &conn)
+{
+  if (conn.inPendingList)
+    return;
+  conn.inPendingList = true;
+  host->pending.push_back(conn.id);
+}
+
+// Acks ride on the next data packet, an ack-only packet goes out only if nothing was sent for ack_delay_us
+static void schedule_ack(TransportHost *host, ConnectionImpl &conn, uint64_t now)
+{
+  if (conn.needsAck)
+    return;
+  conn.needsAck = true;
+  conn.ackTime = now + ack_delay_us;
+  if (conn.inAckList)
+    return;
+  conn.inAckList = true;
+  host->delayedAcks.push_back(conn.id);
+}
+
+static void send_datagram(TransportHost *host, ConnectionImpl &conn, const uint8_t *data, size_t size)
+{
+  sendto(host->sfd, data, size, 0, (const sockaddr*)&conn.address, sizeof(sockaddr_in));
+  conn.lastSendTime = time_usec();
+  conn.stats.packetsSent++;
+  conn.stats.bytesSent += size;
+}
+
+static void send_control(TransportHost *host, ConnectionImpl &conn, PacketKind kind)
+{
+  uint8_t buf[16];
+  uint8_t *ptr = buf;
+  write<uint8_t>(ptr, kind);
+  switch (kind)
+  {
+  case E_PACKET_CONNECT:
+    write<uint16_t>(ptr, conn.id);
+    write<uint32_t>(ptr, conn.nonce);
+    break;
+  case E_PACKET_ACCEPT:
+    write<uint16_t>(ptr, conn.remoteId);
+    write<uint16_t>(ptr, conn.id);
+    write<uint32_t>(ptr, conn.nonce);
+    break;
+  case E_PACKET_DISCONNECT:
+    write<uint16_t>(ptr, conn.remoteId);
+    break;
+  default:
+    return;
+  }
+  send_datagram(host, conn, buf, ptr - buf);
+}
+
+static void push_event(TransportHost *host, TransportEventType type, ConnectionImpl &conn,
+                       uint8_t channel = 0, TransportPacket *packet = nullptr)
+{
+  TransportEvent event;
+  event.type = type;
+  event.connection = &conn;
+  event.channel = channel;
+  event.packet = packet;
+  host->events.push_back(event);
+}
+
+static void free_connection(TransportHost *host, ConnectionImpl &conn)
+{
+  if (conn.state == E_CONNECTION_CONNECTED)
+    host->connectedCount--;
+  if (host->isServer)
+    host->connectMap.erase(ConnectKey{conn.address.sin_addr.s_addr, conn.address.sin_port, conn.nonce});
+  uint16_t id = conn.id;
+  void *userData = conn.data; // stays readable in the disconnect event
+  reset_connection(host, conn, id);
+  conn.data = userData;
+  host->freeIds.push_back(id);
+}
+
+static void set_socket_buffers(int sfd)
+{
+  setsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(int));
+  setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &socket_buffer_size, sizeof(int));
+}
+
+TransportHost *transport_host_create(const char *port, size_t max_connections)
+{
+  if (max_connections == 0 || max_connections > 0xffff)
+    return nullptr;
+  TransportHost *host = new TransportHost;
+  host->isServer = port != nullptr;
+  if (host->isServer)
+  {
+    host->sfd = create_dgram_socket(nullptr, port, nullptr);
+    if (host->sfd == -1)
+    {
+      delete host;
+      return nullptr;
+    }
+    set_socket_buffers(host->sfd);
+  }
+  host->connections.resize(max_connections);
+  host->freeIds.reserve(max_connections);
+  for (size_t i = 0; i < max_connections; ++i)
+  {
+    reset_connection(host, host->connections[i], uint16_t(i));
+    host->freeIds.push_back(uint16_t(max_connections - 1 - i));
+  }
+  return host;
+}
+
+void transport_host_destroy(TransportHost *host)
+{
+  if (!host)
+    return;
+  for (ConnectionImpl &conn : host->connections)
+    if (conn.state == E_CONNECTION_CONNECTED)
+      send_control(host, conn, E_PACKET_DISCONNECT);
+  for (ConnectionImpl &conn : host->connections)
+    reset_connection(host, conn, conn.id);
+  for (TransportEvent &event : host->events)
+    transport_packet_destroy(event.packet);
+  if (host->sfd != -1)
+    close(host->sfd);
+  delete host;
+}
+
+TransportConnection *transport_connect(TransportHost *host, const char *address, const char *port)
+{
+  if (host->isServer || host->freeIds.empty())
+    return nullptr;
+  sockaddr_in remote;
+  if (host->sfd == -1)
+  {
+    addrinfo resAddrInfo;
+    host->sfd = create_dgram_socket(address, port, &resAddrInfo);
+    if (host->sfd == -1)
+      return nullptr;
+    set_socket_buffers(host->sfd);
+    memcpy(&remote, resAddrInfo.ai_addr, sizeof(sockaddr_in));
+  }
+  else if (!resolve_address(address, port, remote))
+    return nullptr;
+
+  uint16_t id = host->freeIds.back();
+  host->freeIds.pop_back();
+  ConnectionImpl &conn = host->connections[id];
+  reset_connection(host, conn, id);
+  conn.state = E_CONNECTION_CONNECTING;
+  conn.address = remote;
+  conn.nonce = host->rng();
+  conn.createTime = time_usec();
+  conn.lastReceiveTime = conn.createTime;
+  send_control(host, conn, E_PACKET_CONNECT);
+  return &conn;
+}
+
+void transport_disconnect(TransportConnection *connection)
+{
+  ConnectionImpl &conn = *static_cast<ConnectionImpl*>(connection);
+  if (conn.state == E_CONNECTION_FREE)
+    return;
+  if (conn.state == E_CONNECTION_CONNECTED)
+    send_control(conn.host, conn, E_PACKET_DISCONNECT);
+  free_connection(conn.host, conn);
+}
+
+int transport_send(TransportConnection *connection, uint8_t channel, TransportPacket *packet)
+{
+  ConnectionImpl &conn = *static_cast<ConnectionImpl*>(connection);
+  if (conn.state != E_CONNECTION_CONNECTED || channel >= E_TRANSPORT_CHANNEL_COUNT ||
+      packet->dataLength > transport_max_payload)
+    return -1;
+  OutgoingMessage msg;
+  msg.channel = channel;
+  msg.packet = packet;
+  if (channel == E_TRANSPORT_CHANNEL_RELIABLE)
+  {
+    msg.seq = conn.nextReliableSeq++;
+    conn.reliableQueue.push_back(msg);
+    mark_pending(conn.host, conn);
+  }
+  else
+  {
+    if (channel == E_TRANSPORT_CHANNEL_UNRELIABLE)
+      msg.seq = conn.nextUnreliableSeq++;
+    conn.unreliableQueue.push_back(msg);
+  }
+  mark_dirty(conn.host, conn);
+  return 0;
+}
+
+static void on_packet_acked(ConnectionImpl &conn, uint16_t seq, uint64_t now)
+{
+  SentPacket &sent = conn.sent[seq % sent_window];
+  if (!sent.valid || sent.seq != seq || sent.acked)
+    return;
+  sent.acked = true;
+
+  uint64_t sample = now - sent.sendTime;
+  if (conn.srtt == 0)
+  {
+    conn.srtt = sample;
+    conn.rttVar = sample / 2;
+  }
+  else
+  {
+    uint64_t err = sample > conn.srtt ? sample - conn.srtt : conn.srtt - sample;
+    conn.rttVar = (3 * conn.rttVar + err) / 4;
+    conn.srtt = (7 * conn.srtt + sample) / 8;
+  }
+  uint64_t rto = conn.srtt + 4 * conn.rttVar;
+  conn.rto = rto < min_rto_us ? min_rto_us : rto > max_rto_us ? max_rto_us : rto;
+  conn.stats.rtt = conn.srtt * 0.001f;
+  conn.stats.rttVariance = conn.rttVar * 0.001f;
+
+  if (conn.reliableQueue.empty())
+    return;
+  uint16_t frontSeq = conn.reliableQueue.front().seq;
+  for (uint8_t i = 0; i < sent.numReliable; ++i)
+  {
+    uint16_t idx = sent.reliableSeqs[i] - frontSeq;
+    if (idx < conn.reliableQueue.size())
+      conn.reliableQueue[idx].acked = true;
+  }
+  while (!conn.reliableQueue.empty() && conn.reliableQueue.front().acked)
+  {
+    transport_packet_destroy(conn.reliableQueue.front().packet);
+    conn.reliableQueue.pop_front();
+  }
+}
+
+// Returns false if the packet is a duplicate or too old to be acked.
+static bool on_packet_received(ConnectionImpl &conn, uint16_t seq)
+{
+  if (!conn.receivedAny)
+  {
+    conn.receivedAny = true;
+    conn.remoteSeq = seq;
+    conn.ackBits = 0;
+    return true;
+  }
+  if (seq_greater(seq, conn.remoteSeq))
+  {
+    uint16_t diff = seq - conn.remoteSeq;
+    conn.ackBits = diff > 32 ? 0 : uint32_t((uint64_t(conn.ackBits) << diff) | (1ull << (diff - 1)));
+    conn.remoteSeq = seq;
+    return true;
+  }
+  uint16_t diff = conn.remoteSeq - seq;
+  if (diff == 0 || diff > 32)
+    return false;
+  uint32_t bit = 1u << (diff - 1);
+  if (conn.ackBits & bit)
+    return false;
+  conn.ackBits |= bit;
+  return true;
+}
+
+static void deliver_reliable(TransportHost *host, ConnectionImpl &conn, uint16_t seq, const uint8_t *data, uint16_t size)
+{
+  if (seq == conn.expectedReliableSeq)
+  {
+    push_event(host, E_TRANSPORT_EVENT_RECEIVE, conn, E_TRANSPORT_CHANNEL_RELIABLE, transport_packet_create(data, size));
+    conn.expectedReliableSeq++;
+    TransportPacket *&next = conn.reorder[conn.expectedReliableSeq % reliable_window];
+    while (next)
+    {
+      push_event(host, E_TRANSPORT_EVENT_RECEIVE, conn, E_TRANSPORT_CHANNEL_RELIABLE, next);
+      next = nullptr;
+      conn.expectedReliableSeq++;
+      next = conn.reorder[conn.expectedReliableSeq % reliable_window];
+    }
+  }
+  else if (seq_greater(seq, conn.expectedReliableSeq) && uint16_t(seq - conn.expectedReliableSeq) < reliable_window)
+  {
+    TransportPacket *&slot = conn.reorder[seq % reliable_window];
+    if (!slot)
+      slot = transport_packet_create(data, size);
+  }
+}
+
+static void handle_data(TransportHost *host, ConnectionImpl &conn, const uint8_t *ptr, const uint8_t *end, uint64_t now)
+{
+  uint16_t seq = read<uint16_t>(ptr);
+  uint16_t ack = read<uint16_t>(ptr);
+  uint32_t ackBits = read<uint32_t>(ptr);
+
+  conn.lastReceiveTime = now;
+  on_packet_acked(conn, ack, now);
+  for (uint32_t i = 0; i < 32; ++i)
+    if (ackBits & (1u << i))
+      on_packet_acked(conn, uint16_t(ack - 1 - i), now);
+
+  if (!on_packet_received(conn, seq))
+    return;
+  // ack-only packets are acked by whatever we send next, answering them would ping-pong forever
+  if (ptr < end)
+    schedule_ack(host, conn, now);
+
+  while (end - ptr >= ptrdiff_t(sizeof(uint8_t) + sizeof(uint16_t)))
+  {
+    uint8_t channel = read<uint8_t>(ptr);
+    uint16_t msgSeq = 0;
+    if (channel != E_TRANSPORT_CHANNEL_UNSEQUENCED)
+    {
+      if (end - ptr < ptrdiff_t(2 * sizeof(uint16_t)))
+        return;
+      msgSeq = read<uint16_t>(ptr);
+    }
+    uint16_t size = read<uint16_t>(ptr);
+    if (channel >= E_TRANSPORT_CHANNEL_COUNT || end - ptr < size)
+      return;
+
+    switch (channel)
+    {
+    case E_TRANSPORT_CHANNEL_RELIABLE:
+      deliver_reliable(host, conn, msgSeq, ptr, size);
+      break;
+    case E_TRANSPORT_CHANNEL_UNRELIABLE:
+      if (!conn.receivedUnreliable || seq_greater(msgSeq, conn.lastUnreliableSeq))
+      {
+        conn.receivedUnreliable = true;
+        conn.lastUnreliableSeq = msgSeq;
+        push_event(host, E_TRANSPORT_EVENT_RECEIVE, conn, channel, transport_packet_create(ptr, size));
+      }
+      break;
+    case E_TRANSPORT_CHANNEL_UNSEQUENCED:
+      push_event(host, E_TRANSPORT_EVENT_RECEIVE, conn, channel, transport_packet_create(ptr, size));
+      break;
+    }
+    ptr += size;
+  }
+}
+
+static void handle_datagram(TransportHost *host, const uint8_t *data, size_t size, const sockaddr_in &from, uint64_t now)
+{
+  const uint8_t *ptr = data;
+  const uint8_t *end = data + size;
+  if (size < sizeof(uint8_t) + sizeof(uint16_t))
+    return;
+  uint8_t kind = read<uint8_t>(ptr);
+  switch (kind)
+  {
+  case E_PACKET_CONNECT:
+  {
+    if (!host->isServer || size < sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t))
+      return;
+    uint16_t remoteId = read<uint16_t>(ptr);
+    uint32_t nonce = read<uint32_t>(ptr);
+    ConnectKey key{from.sin_addr.s_addr, from.sin_port, nonce};
+    auto it = host->connectMap.find(key);
+    if (it != host->connectMap.end())
+    {
+      // our accept got lost
+      send_control(host, host->connections[it->second], E_PACKET_ACCEPT);
+      return;
+    }
+    if (host->freeIds.empty())
+      return;
+    uint16_t id = host->freeIds.back();
+    host->freeIds.pop_back();
+    ConnectionImpl &conn = host->connections[id];
+    reset_connection(host, conn, id);
+    conn.state = E_CONNECTION_CONNECTED;
+    conn.address = from;
+    conn.remoteId = remoteId;
+    conn.nonce = nonce;
+    conn.createTime = now;
+    conn.lastReceiveTime = now;
+    host->connectMap[key] = id;
+    host->connectedCount++;
+    send_control(host, conn, E_PACKET_ACCEPT);
+    push_event(host, E_TRANSPORT_EVENT_CONNECT, conn);
+    break;
+  }
+  case E_PACKET_ACCEPT:
+  {
+    if (host->isServer || size < sizeof(uint8_t) + 2 * sizeof(uint16_t) + sizeof(uint32_t))
+      return;
+    uint16_t localId = read<uint16_t>(ptr);
+    uint16_t remoteId = read<uint16_t>(ptr);
+    uint32_t nonce = read<uint32_t>(ptr);
+    if (localId >= host->connections.size())
+      return;
+    ConnectionImpl &conn = host->connections[localId];
+    if (conn.state != E_CONNECTION_CONNECTING || conn.nonce != nonce || !same_address(conn.address, from))
+      return;
+    conn.state = E_CONNECTION_CONNECTED;
+    conn.remoteId = remoteId;
+    conn.lastReceiveTime = now;
+    host->connectedCount++;
+    push_event(host, E_TRANSPORT_EVENT_CONNECT, conn);
+    break;
+  }
+  case E_PACKET_DATA:
+  case E_PACKET_DISCONNECT:
+  {
+    uint16_t id = read<uint16_t>(ptr);
+    if (id >= host->connections.size())
+      return;
+    ConnectionImpl &conn = host->connections[id];
+    if (conn.state != E_CONNECTION_CONNECTED || !same_address(conn.address, from))
+      return;
+    conn.stats.packetsReceived++;
+    conn.stats.bytesReceived += size;
+    if (kind == E_PACKET_DISCONNECT)
+    {
+      push_event(host, E_TRANSPORT_EVENT_DISCONNECT, conn);
+      free_connection(host, conn);
+    }
+    else if (size >= header_size)
+      handle_data(host, conn, ptr, end, now);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+static void receive_datagrams(TransportHost *host)
+{
+  static uint8_t buffer[2048];
+  while (true)
+  {
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(sockaddr_in);
+    ssize_t numBytes = recvfrom(host->sfd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+    if (numBytes <= 0)
+      return;
+    handle_datagram(host, buffer, size_t(numBytes), from, time_usec());
+  }
+}
+
+static void update_timers(TransportHost *host, uint64_t now)
+{
+  // resends only look at connections with something in flight
+  for (size_t i = 0; i < host->pending.size();)
+  {
+    ConnectionImpl &conn = host->connections[host->pending[i]];
+    if (conn.state != E_CONNECTION_CONNECTED || conn.reliableQueue.empty())
+    {
+      conn.inPendingList = false;
+      host->pending[i] = host->pending.back();
+      host->pending.pop_back();
+      continue;
+    }
+    size_t window = std::min(conn.reliableQueue.size(), reliable_window);
+    for (size_t j = 0; j < window; ++j)
+    {
+      const OutgoingMessage &msg = conn.reliableQueue[j];
+      if (!msg.acked && now - msg.lastSendTime >= conn.rto)
+      {
+        mark_dirty(host, conn);
+        break;
+      }
+    }
+    ++i;
+  }
+
+  for (size_t i = 0; i < host->delayedAcks.size();)
+  {
+    ConnectionImpl &conn = host->connections[host->delayedAcks[i]];
+    bool done = conn.state != E_CONNECTION_CONNECTED || !conn.needsAck;
+    if (!done && now >= conn.ackTime)
+    {
+      mark_dirty(host, conn);
+      done = true;
+    }
+    if (done)
+    {
+      conn.inAckList = false;
+      host->delayedAcks[i] = host->delayedAcks.back();
+      host->delayedAcks.pop_back();
+      continue;
+    }
+    ++i;
+  }
+
+  // timeouts and keepalives are checked on a slice of the table per call
+  size_t count = std::min(sweep_per_service, host->connections.size());
+  for (size_t i = 0; i < count; ++i)
+  {
+    ConnectionImpl &conn = host->connections[host->sweepCursor];
+    host->sweepCursor = (host->sweepCursor + 1) % host->connections.size();
+    if (conn.state == E_CONNECTION_CONNECTING)
+    {
+      if (now - conn.createTime > connect_timeout_us)
+      {
+        push_event(host, E_TRANSPORT_EVENT_DISCONNECT, conn);
+        free_connection(host, conn);
+      }
+      else if (now - conn.lastSendTime > connect_resend_us)
+        send_control(host, conn, E_PACKET_CONNECT);
+    }
+    else if (conn.state == E_CONNECTION_CONNECTED)
+    {
+      if (now - conn.lastReceiveTime > timeout_us)
+      {
+        push_event(host, E_TRANSPORT_EVENT_DISCONNECT, conn);
+        free_connection(host, conn);
+      }
+      else if (now - conn.lastSendTime > keepalive_us)
+      {
+        conn.needsAck = true;
+        conn.ackTime = now;
+        mark_dirty(host, conn);
+      }
+    }
+  }
+}
+
+static void flush_connection(TransportHost *host, ConnectionImpl &conn, uint64_t now)
+{
+  uint8_t buf[max_datagram_size];
+  size_t unreliableCursor = 0;
+  size_t reliableCursor = 0;
+  size_t reliableWindow = std::min(conn.reliableQueue.size(), reliable_window);
+  while (true)
+  {
+    uint8_t *ptr = buf;
+    uint8_t *end = buf + max_datagram_size;
+    uint16_t seq = conn.localSeq;
+    write<uint8_t>(ptr, E_PACKET_DATA);
+    write<uint16_t>(ptr, conn.remoteId);
+    write<uint16_t>(ptr, seq);
+    write<uint16_t>(ptr, conn.remoteSeq);
+    write<uint32_t>(ptr, conn.receivedAny ? conn.ackBits : 0u);
+
+    SentPacket &sent = conn.sent[seq % sent_window];
+    uint8_t numReliable = 0;
+    size_t numMessages = 0;
+
+    for (; reliableCursor < reliableWindow && numReliable < max_reliable_per_packet; ++reliableCursor)
+    {
+      OutgoingMessage &msg = conn.reliableQueue[reliableCursor];
+      if (msg.acked || (msg.lastSendTime != 0 && now - msg.lastSendTime < conn.rto))
+        continue;
+      if (size_t(end - ptr) < message_header_size + msg.packet->dataLength)
+        break;
+      write<uint8_t>(ptr, msg.channel);
+      write<uint16_t>(ptr, msg.seq);
+      write<uint16_t>(ptr, uint16_t(msg.packet->dataLength));
+      memcpy(ptr, msg.packet->data, msg.packet->dataLength); ptr += msg.packet->dataLength;
+      msg.lastSendTime = now;
+      sent.reliableSeqs[numReliable++] = msg.seq;
+      numMessages++;
+    }
+    for (; unreliableCursor < conn.unreliableQueue.size(); ++unreliableCursor)
+    {
+      OutgoingMessage &msg = conn.unreliableQueue[unreliableCursor];
+      bool sequenced = msg.channel == E_TRANSPORT_CHANNEL_UNRELIABLE;
+      size_t msgSize = message_header_size - (sequenced ? 0 : sizeof(uint16_t)) + msg.packet->dataLength;
+      if (size_t(end - ptr) < msgSize)
+        break;
+      write<uint8_t>(ptr, msg.channel);
+      if (sequenced)
+        write<uint16_t>(ptr, msg.seq);
+      write<uint16_t>(ptr, uint16_t(msg.packet->dataLength));
+      memcpy(ptr, msg.packet->data, msg.packet->dataLength); ptr += msg.packet->dataLength;
+      numMessages++;
+    }
+
+    if (numMessages == 0 && !(conn.needsAck && now >= conn.ackTime))
+      break;
+
+    if (sent.valid && !sent.acked)
+      conn.stats.packetsLost++;
+    sent.valid = true;
+    sent.acked = false;
+    sent.seq = seq;
+    sent.sendTime = now;
+    sent.numReliable = numReliable;
+    conn.localSeq++;
+    conn.needsAck = false;
+    send_datagram(host, conn, buf, ptr - buf);
+
+    if (numMessages == 0)
+      break;
+  }
+  for (OutgoingMessage &msg : conn.unreliableQueue)
+    transport_packet_destroy(msg.packet);
+  conn.unreliableQueue.clear();
+}
+
+void transport_host_flush(TransportHost *host)
+{
+  if (host->sfd == -1)
+    return;
+  uint64_t now = time_usec();
+  for (uint16_t id : host->dirty)
+  {
+    ConnectionImpl &conn = host->connections[id];
+    conn.inDirtyList = false;
+    if (conn.state == E_CONNECTION_CONNECTED)
+      flush_connection(host, conn, now);
+  }
+  host->dirty.clear();
+}
+
+static bool pop_event(TransportHost *host, TransportEvent *event)
+{
+  if (host->events.empty())
+    return false;
+  *event = host->events.front();
+  host->events.pop_front();
+  return true;
+}
+
+int transport_host_service(TransportHost *host, TransportEvent *event, uint32_t timeout_ms)
+{
+  if (pop_event(host, event))
+    return 1;
+  if (host->sfd == -1)
+    return 0;
+
+  uint64_t deadline = time_usec() + uint64_t(timeout_ms) * 1000;
+  while (true)
+  {
+    receive_datagrams(host);
+    uint64_t now = time_usec();
+    update_timers(host, now);
+    transport_host_flush(host);
+    if (pop_event(host, event))
+      return 1;
+
+    now = time_usec();
+    if (now >= deadline)
+      return 0;
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(host->sfd, &readSet);
+    uint64_t waitUs = deadline - now;
+    timeval timeout = { time_t(waitUs / 1000000), suseconds_t(waitUs % 1000000) };
+    if (select(host->sfd + 1, &readSet, NULL, NULL, &timeout) <= 0)
+      return 0;
+  }
+}
+
+size_t transport_host_connection_count(const TransportHost *host)
+{
+  return host->connectedCount;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Minimal connection-oriented transport over the raw datagram socket from socket_tools.
+// Every datagram carries a 16-bit sequence number plus ack + 32-bit ack bitfield of the
+// packets received from the other side, so acks are redundant and a single lost ack costs nothing.
+// Shape of the API mirrors ENet: create packet, send it to a connection on a channel,
+// service the host and get connect/disconnect/receive events back.
+
+enum TransportChannel : uint8_t
+{
+  E_TRANSPORT_CHANNEL_RELIABLE = 0, // ordered, resent until acked
+  E_TRANSPORT_CHANNEL_UNRELIABLE,   // sequenced, stale messages are dropped
+  E_TRANSPORT_CHANNEL_UNSEQUENCED,  // fire and forget
+  E_TRANSPORT_CHANNEL_COUNT
+};
+
+enum TransportEventType : uint8_t
+{
+  E_TRANSPORT_EVENT_NONE = 0,
+  E_TRANSPORT_EVENT_CONNECT,
+  E_TRANSPORT_EVENT_DISCONNECT,
+  E_TRANSPORT_EVENT_RECEIVE
+};
+
+constexpr size_t transport_max_payload = 1200;
+
+struct TransportPacket
+{
+  uint8_t *data = nullptr;
+  size_t dataLength = 0;
+};
+
+struct TransportHost;
+
+struct TransportConnectionStats
+{
+  float rtt = 0.f;         // smoothed, ms
+  float rttVariance = 0.f; // ms
+  uint32_t packetsSent = 0;
+  uint32_t packetsReceived = 0;
+  uint32_t packetsLost = 0;
+  uint32_t bytesSent = 0;
+  uint32_t bytesReceived = 0;
+};
+
+struct TransportConnection
+{
+  TransportHost *host = nullptr;
+  uint16_t id = 0;
+  void *data = nullptr; // user data, like ENetPeer::data
+  TransportConnectionStats stats;
+};
+
+struct TransportEvent
+{
+  TransportEventType type = E_TRANSPORT_EVENT_NONE;
+  TransportConnection *connection = nullptr;
+  uint8_t channel = 0;
+  TransportPacket *packet = nullptr; // owned by the receiver, destroy with transport_packet_destroy
+};
+
+TransportPacket *transport_packet_create(const void *data, size_t size);
+void transport_packet_destroy(TransportPacket *packet);
+
+// port == nullptr creates a client host, its socket is created by the first transport_connect
+TransportHost *transport_host_create(const char *port, size_t max_connections);
+void transport_host_destroy(TransportHost *host);
+
+TransportConnection *transport_connect(TransportHost *host, const char *address, const char *port);
+void transport_disconnect(TransportConnection *connection);
+
+// Takes ownership of the packet. Returns -1 if the packet does not fit in a datagram
+// or the connection is not established yet.
+int transport_send(TransportConnection *connection, uint8_t channel, TransportPacket *packet);
+
+// Returns 1 and fills the event if there is one, 0 otherwise. Waits up to timeout_ms for traffic.
+int transport_host_service(TransportHost *host, TransportEvent *event, uint32_t timeout_ms);
+void transport_host_flush(TransportHost *host);
+
+size_t transport_host_connection_count(const TransportHost *host);
@@ -0,0 +1,205 @@
+// Echo benchmark: N connections on loopback, every round each client connection sends a small
+// unsequenced packet with a timestamp and the server echoes it back. Reports round trip latency
+// and process CPU time per packet (sent + received on both ends) for our transport and for ENet.
+#include <enet/enet.h>
+#include <time.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include "transport.h"
+
+constexpr size_t payload_size = 32;
+
+struct BenchResult
+{
+  std::vector<uint64_t> rtts; // ns
+  uint64_t cpuNs = 0;
+  uint64_t packets = 0;
+  uint64_t lost = 0;
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+  timespec ts;
+  clock_gettime(clk, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static void print_result(const char *name, BenchResult &res)
+{
+  if (res.rtts.empty())
+  {
+    printf("%-10s no packets came back\n", name);
+    return;
+  }
+  std::sort(res.rtts.begin(), res.rtts.end());
+  auto pct = [&](double p) { return res.rtts[std::min(res.rtts.size() - 1, size_t(p * res.rtts.size()))] * 0.001; };
+  printf("%-10s rtt us p50 %8.1f p99 %8.1f max %8.1f | cpu/packet %6.0f ns | lost %llu\n", name,
+         pct(0.5), pct(0.99), res.rtts.back() * 0.001,
+         double(res.cpuNs) / double(std::max<uint64_t>(res.packets, 1)),
+         (unsigned long long)res.lost);
+}
+
+static BenchResult bench_transport(size_t num_connections, size_t rounds)
+{
+  BenchResult res;
+  TransportHost *server = transport_host_create("10990", num_connections);
+  TransportHost *client = transport_host_create(nullptr, num_connections);
+  if (!server || !client)
+  {
+    printf("Cannot create transport hosts\n");
+    return res;
+  }
+  std::vector<TransportConnection*> conns;
+  for (size_t i = 0; i < num_connections; ++i)
+    conns.push_back(transport_connect(client, "localhost", "10990"));
+
+  TransportEvent event;
+  uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + 10000000000ull;
+  while (transport_host_connection_count(client) < num_connections && clock_ns(CLOCK_MONOTONIC) < deadline)
+  {
+    while (transport_host_service(server, &event, 0) > 0) {}
+    while (transport_host_service(client, &event, 1) > 0) {}
+  }
+
+  uint64_t cpuStart = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  for (size_t r = 0; r < rounds; ++r)
+  {
+    uint8_t payload[payload_size] = {};
+    for (TransportConnection *conn : conns)
+    {
+      uint64_t now = clock_ns(CLOCK_MONOTONIC);
+      memcpy(payload, &now, sizeof(uint64_t));
+      transport_send(conn, E_TRANSPORT_CHANNEL_UNSEQUENCED, transport_packet_create(payload, payload_size));
+    }
+    transport_host_flush(client);
+    res.packets += num_connections;
+
+    size_t received = 0;
+    uint64_t roundDeadline = clock_ns(CLOCK_MONOTONIC) + 50000000ull;
+    while (received < num_connections && clock_ns(CLOCK_MONOTONIC) < roundDeadline)
+    {
+      while (transport_host_service(server, &event, 0) > 0)
+        if (event.type == E_TRANSPORT_EVENT_RECEIVE)
+        {
+          res.packets++;
+          transport_send(event.connection, E_TRANSPORT_CHANNEL_UNSEQUENCED, event.packet);
+          res.packets++;
+        }
+      while (transport_host_service(client, &event, 0) > 0)
+        if (event.type == E_TRANSPORT_EVENT_RECEIVE)
+        {
+          uint64_t sentAt;
+          memcpy(&sentAt, event.packet->data, sizeof(uint64_t));
+          res.rtts.push_back(clock_ns(CLOCK_MONOTONIC) - sentAt);
+          res.packets++;
+          received++;
+          transport_packet_destroy(event.packet);
+        }
+    }
+    res.lost += num_connections - received;
+  }
+  res.cpuNs = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+  transport_host_destroy(client);
+  transport_host_destroy(server);
+  return res;
+}
+
+static BenchResult bench_enet(size_t num_connections, size_t rounds)
+{
+  BenchResult res;
+  ENetAddress address;
+  address.host = ENET_HOST_ANY;
+  address.port = 10991;
+  ENetHost *server = enet_host_create(&address, num_connections, 2, 0, 0);
+  ENetHost *client = enet_host_create(nullptr, num_connections, 2, 0, 0);
+  if (!server || !client)
+  {
+    printf("Cannot create ENet hosts\n");
+    return res;
+  }
+  enet_address_set_host(&address, "localhost");
+  std::vector<ENetPeer*> peers;
+  for (size_t i = 0; i < num_connections; ++i)
+    peers.push_back(enet_host_connect(client, &address, 2, 0));
+
+  ENetEvent event;
+  size_t connected = 0;
+  uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + 10000000000ull;
+  while (connected < num_connections && clock_ns(CLOCK_MONOTONIC) < deadline)
+  {
+    while (enet_host_service(server, &event, 0) > 0) {}
+    while (enet_host_service(client, &event, 1) > 0)
+      if (event.type == ENET_EVENT_TYPE_CONNECT)
+        connected++;
+  }
+
+  uint64_t cpuStart = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  for (size_t r = 0; r < rounds; ++r)
+  {
+    uint8_t payload[payload_size] = {};
+    for (ENetPeer *peer : peers)
+    {
+      uint64_t now = clock_ns(CLOCK_MONOTONIC);
+      memcpy(payload, &now, sizeof(uint64_t));
+      enet_peer_send(peer, 1, enet_packet_create(payload, payload_size, ENET_PACKET_FLAG_UNSEQUENCED));
+    }
+    enet_host_flush(client);
+    res.packets += num_connections;
+
+    size_t received = 0;
+    uint64_t roundDeadline = clock_ns(CLOCK_MONOTONIC) + 50000000ull;
+    while (received < num_connections && clock_ns(CLOCK_MONOTONIC) < roundDeadline)
+    {
+      while (enet_host_service(server, &event, 0) > 0)
+        if (event.type == ENET_EVENT_TYPE_RECEIVE)
+        {
+          res.packets++;
+          enet_peer_send(event.peer, 1, enet_packet_create(event.packet->data, event.packet->dataLength,
+                                                           ENET_PACKET_FLAG_UNSEQUENCED));
+          enet_packet_destroy(event.packet);
+          res.packets++;
+        }
+      while (enet_host_service(client, &event, 0) > 0)
+        if (event.type == ENET_EVENT_TYPE_RECEIVE)
+        {
+          uint64_t sentAt;
+          memcpy(&sentAt, event.packet->data, sizeof(uint64_t));
+          res.rtts.push_back(clock_ns(CLOCK_MONOTONIC) - sentAt);
+          res.packets++;
+          received++;
+          enet_packet_destroy(event.packet);
+        }
+    }
+    res.lost += num_connections - received;
+  }
+  res.cpuNs = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+  enet_host_destroy(client);
+  enet_host_destroy(server);
+  return res;
+}
+
+int main(int argc, const char **argv)
+{
+  size_t numConnections = argc > 1 ? atoi(argv[1]) : 1000;
+  size_t rounds = argc > 2 ? atoi(argv[2]) : 100;
+  printf("%zu connections, %zu rounds, %zu byte payload\n", numConnections, rounds, payload_size);
+
+  BenchResult transportRes = bench_transport(numConnections, rounds);
+  print_result("transport", transportRes);
+
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  BenchResult enetRes = bench_enet(numConnections, rounds);
+  print_result("enet", enetRes);
+
+  atexit(enet_deinitialize);
+  return 0;
+}
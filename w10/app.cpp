@@ -15,11 +15,20 @@
 #include <GLFW/glfw3native.h>
 
 #include <functional>
+#include <thread>
 #include "app.h"
+#include "timeUtils.h"
 
 // global state
 static GLFWwindow *window = nullptr;
 
+// headless: no window, Noop renderer, frames paced by app_poll_events
+static bool headless = false;
+static uint64_t frameInterval = 0; // us, 0 - as fast as possible
+static uint64_t nextFrameTime = 0;
+static uint32_t frameLimit = 0; // 0 - run until killed
+static uint32_t frameCount = 0;
+
 static mouse_cb_t mcb = mouse_cb_t();// do nothing by default
 
 static void glfw_errorCallback(int error, const char *description)
@@ -78,18 +87,62 @@ bool app_init(int width, int height)
   return true;
 }
 
+bool app_init_headless(int width, int height, float fps, uint32_t max_frames)
+{
+  headless = true;
+  frameInterval = fps > 0.f ? uint64_t(1e6f / fps) : 0;
+  nextFrameTime = get_time_us();
+  frameLimit = max_frames;
+  frameCount = 0;
+
+  bgfx::renderFrame();
+  bgfx::Init init;
+  init.type = bgfx::RendererType::Noop;
+  init.resolution.width = (uint32_t)width;
+  init.resolution.height = (uint32_t)height;
+  init.resolution.reset = BGFX_RESET_NONE;
+  if (!bgfx::init(init))
+    return false;
+  bgfx::setViewClear(0, BGFX_CLEAR_COLOR|BGFX_CLEAR_DEPTH, 0x303030ff, 1.0f, 0);
+  bgfx::setViewRect(0, 0, 0, bgfx::BackbufferRatio::Equal);
+  return true;
+}
+
+bool app_is_headless()
+{
+  return headless;
+}
+
 bool app_should_close()
 {
+  if (headless)
+    return frameLimit != 0 && frameCount >= frameLimit;
   return glfwWindowShouldClose(window);
 }
 
 void app_poll_events()
 {
-  glfwPollEvents();
+  if (!headless)
+  {
+    glfwPollEvents();
+    return;
+  }
+  frameCount++;
+  if (frameInterval == 0)
+    return;
+  // fixed rate, a late frame is not made up for
+  nextFrameTime += frameInterval;
+  uint64_t now = get_time_us();
+  if (nextFrameTime > now)
+    std::this_thread::sleep_for(std::chrono::microseconds(nextFrameTime - now));
+  else
+    nextFrameTime = now;
 }
 
 void app_handle_resize(int &width, int &height)
 {
+  if (headless)
+    return;
   int oldWidth = width, oldHeight = height;
   glfwGetWindowSize(window, &width, &height);
   const bgfx::ViewId kClearView = 0;
@@ -102,7 +155,8 @@ void app_handle_resize(int &width, int &height)
 
 void app_terminate()
 {
-  glfwTerminate();
+  if (!headless)
+    glfwTerminate();
 }
 
 void app_set_on_mouse_click(mouse_cb_t cb)
@@ -112,6 +166,8 @@ void app_set_on_mouse_click(mouse_cb_t cb)
 
 bool app_keypressed(int key)
 {
+  if (headless)
+    return false;
   return glfwGetKey(window, key) == GLFW_PRESS;
 }
 
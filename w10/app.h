@@ -1,6 +1,10 @@
 #pragma once
 
 bool app_init(int width, int height);
+// No window and the Noop renderer, for profiling without a display or GPU.
+// app_poll_events paces frames to fps (0 - unlimited), app_should_close is true after max_frames (0 - never).
+bool app_init_headless(int width, int height, float fps, uint32_t max_frames);
+bool app_is_headless();
 bool app_should_close();
 void app_poll_events();
 void app_handle_resize(int &width, int &height);
@@ -0,0 +1,99 @@
+#include "clock_sync.h"
+#include <math.h>
+#include "entity.h"
+
+// corrections below this are slewed over slew_time_us, bigger ones are stepped
+constexpr double max_slew_us = 10000.0;
+constexpr double slew_time_us = 2e6;
+// a sample is as good as its round trip, anything slower than the best by more than this is queuing
+constexpr double rtt_tolerance_us = 500.0;
+
+double clock_sync_server_time(const ClockSync &sync, uint64_t local_us)
+{
+  double dt = double(int64_t(local_us - sync.referenceUs));
+  return double(local_us) + sync.offsetUs + sync.skew * dt;
+}
+
+double clock_sync_server_tick(const ClockSync &sync, uint64_t local_us)
+{
+  double since = clock_sync_server_time(sync, local_us) - double(sync.serverTickUs);
+  return sync.serverTick + since * (sim_tick_rate * 1e-6);
+}
+
+void clock_sync_add_sample(ClockSync &sync, uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3,
+                           uint32_t server_tick, uint64_t server_tick_us)
+{
+  ClockSample sample;
+  sample.localUs = t3;
+  // client and server clocks have unrelated epochs, keep the differences signed
+  sample.offsetUs = (double(int64_t(t1 - t0)) + double(int64_t(t2 - t3))) * 0.5;
+  sample.rttUs = double(int64_t(t3 - t0)) - double(int64_t(t2 - t1));
+  if (sample.rttUs < 0.0)
+    return;
+  sync.samples[sync.next] = sample;
+  sync.next = (sync.next + 1) % clock_sync_window;
+  if (sync.count < clock_sync_window)
+    sync.count++;
+  sync.exchanges++;
+  sync.serverTick = server_tick;
+  sync.serverTickUs = server_tick_us;
+
+  double minRtt = sync.samples[0].rttUs;
+  for (uint8_t i = 1; i < sync.count; ++i)
+    minRtt = fmin(minRtt, sync.samples[i].rttUs);
+  sync.minRttUs = minRtt;
+
+  // least squares line through the fast samples, relative to the newest one
+  double n = 0.0; double sx = 0.0; double sy = 0.0; double sxx = 0.0; double sxy = 0.0;
+  for (uint8_t i = 0; i < sync.count; ++i)
+  {
+    const ClockSample &s = sync.samples[i];
+    if (s.rttUs > minRtt + rtt_tolerance_us)
+      continue;
+    double x = double(int64_t(s.localUs - t3));
+    n += 1.0;
+    sx += x;
+    sy += s.offsetUs;
+    sxx += x * x;
+    sxy += x * s.offsetUs;
+  }
+  double denom = n * sxx - sx * sx;
+  // need a few samples spread over at least a second to tell drift from noise
+  double drift = n >= 4.0 && denom > 0.0 && sxx - sx * sx / n > 1e12 ? (n * sxy - sx * sy) / denom : 0.0;
+  drift = fmax(-1e-3, fmin(1e-3, drift)); // no real clock is off by more than 1000 ppm
+  double fitted = (sy - drift * sx) / n;
+
+  if (!sync.valid)
+  {
+    sync.referenceUs = t3;
+    sync.offsetUs = fitted;
+    sync.skew = drift;
+    sync.driftPpm = drift * 1e6;
+    sync.valid = true;
+    return;
+  }
+
+  double applied = clock_sync_server_time(sync, t3) - double(t3);
+  double error = sample.offsetUs - applied;
+  // queued samples are off by their queuing, that's not an error of the estimate
+  if (sample.rttUs <= minRtt + rtt_tolerance_us)
+  {
+    sync.lastErrorUs = error;
+    sync.meanAbsErrorUs += (fabs(error) - sync.meanAbsErrorUs) * (1.0 / 16.0);
+    sync.maxAbsErrorUs = fmax(sync.maxAbsErrorUs, fabs(error));
+  }
+
+  // rebase on now and steer towards the fitted line
+  sync.referenceUs = t3;
+  sync.offsetUs = applied;
+  sync.driftPpm = drift * 1e6;
+  double correction = fitted - applied;
+  if (fabs(correction) > max_slew_us)
+  {
+    sync.offsetUs = fitted;
+    sync.skew = drift;
+    sync.steps++;
+    return;
+  }
+  sync.skew = drift + correction / slew_time_us;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+// One request/response exchange: t0 client send, t1 server receive, t2 server send,
+// t3 client receive, each on its own clock in us.
+struct ClockSample
+{
+  uint64_t localUs = 0; // t3
+  double offsetUs = 0.0; // server - client
+  double rttUs = 0.0;
+};
+
+constexpr uint8_t clock_sync_window = 16;
+
+// Estimate of server time as offset + skew * (local - reference). Samples are filtered by
+// round trip, the line through the fast ones is fitted for drift, and the applied estimate
+// slews to it instead of jumping, so server time as seen by the client never goes backwards.
+struct ClockSync
+{
+  ClockSample samples[clock_sync_window];
+  uint8_t count = 0;
+  uint8_t next = 0;
+  // applied estimate
+  uint64_t referenceUs = 0;
+  double offsetUs = 0.0;
+  double skew = 0.0; // server us per client us - 1, includes the slew
+  double driftPpm = 0.0; // fitted, without the slew
+  bool valid = false;
+  // last server tick the server reported, and its start in server time
+  uint32_t serverTick = 0;
+  uint64_t serverTickUs = 0;
+  // error statistics
+  uint32_t exchanges = 0;
+  uint32_t steps = 0; // corrections too large to slew
+  double minRttUs = 0.0;
+  double lastErrorUs = 0.0; // sample offset against the applied estimate
+  double meanAbsErrorUs = 0.0;
+  double maxAbsErrorUs = 0.0;
+};
+
+void clock_sync_add_sample(ClockSync &sync, uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3,
+                           uint32_t server_tick, uint64_t server_tick_us);
+double clock_sync_server_time(const ClockSync &sync, uint64_t local_us);
+// Fractional server tick at a local time.
+double clock_sync_server_tick(const ClockSync &sync, uint64_t local_us);
@@ -0,0 +1,287 @@
+#include "collision.h"
+#include <algorithm>
+#include <math.h>
+#include <thread>
+#include "mathUtils.h"
+
+static int32_t cell_coord(float v)
+{
+  return int32_t(floorf(v * (1.f / collision_cell_size)));
+}
+
+static uint64_t cell_key(int32_t cx, int32_t cy)
+{
+  return uint64_t(uint32_t(cx)) << 32 | uint32_t(cy);
+}
+
+static uint32_t home_slot(const SpatialHash &hash, uint64_t key)
+{
+  // murmur finalizer, neighbouring cells land far apart
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return uint32_t(key) & uint32_t(hash.keys.size() - 1);
+}
+
+static uint32_t find_cell(const SpatialHash &hash, uint64_t key)
+{
+  if (hash.used == 0)
+    return no_cell;
+  uint32_t mask = uint32_t(hash.keys.size() - 1);
+  for (uint32_t i = home_slot(hash, key); hash.slots[i] != no_cell; i = (i + 1) & mask)
+    if (hash.keys[i] == key)
+      return hash.slots[i];
+  return no_cell;
+}
+
+static void insert_slot(SpatialHash &hash, uint64_t key, uint32_t cell)
+{
+  uint32_t mask = uint32_t(hash.keys.size() - 1);
+  uint32_t i = home_slot(hash, key);
+  while (hash.slots[i] != no_cell)
+    i = (i + 1) & mask;
+  hash.keys[i] = key;
+  hash.slots[i] = cell;
+}
+
+static uint32_t add_cell(SpatialHash &hash, uint64_t key)
+{
+  if ((hash.used + 1) * 2 > hash.keys.size())
+  {
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> slots;
+    keys.swap(hash.keys);
+    slots.swap(hash.slots);
+    hash.keys.resize(std::max<size_t>(64, keys.size() * 2));
+    hash.slots.assign(hash.keys.size(), no_cell);
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (slots[i] != no_cell)
+        insert_slot(hash, keys[i], slots[i]);
+  }
+  uint32_t cell;
+  if (!hash.freeCells.empty())
+  {
+    cell = hash.freeCells.back();
+    hash.freeCells.pop_back();
+  }
+  else
+  {
+    cell = uint32_t(hash.cells.size());
+    hash.cells.emplace_back();
+  }
+  insert_slot(hash, key, cell);
+  hash.used++;
+  return cell;
+}
+
+static void remove_cell(SpatialHash &hash, uint64_t key)
+{
+  uint32_t mask = uint32_t(hash.keys.size() - 1);
+  uint32_t i = home_slot(hash, key);
+  while (hash.keys[i] != key || hash.slots[i] == no_cell)
+    i = (i + 1) & mask;
+  hash.freeCells.push_back(hash.slots[i]);
+  hash.used--;
+  // shift back whatever probed past the hole, so lookups never stop short of it
+  for (uint32_t j = (i + 1) & mask; hash.slots[j] != no_cell; j = (j + 1) & mask)
+  {
+    uint32_t home = home_slot(hash, hash.keys[j]);
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      hash.keys[i] = hash.keys[j];
+      hash.slots[i] = hash.slots[j];
+      i = j;
+    }
+  }
+  hash.slots[i] = no_cell;
+}
+
+void spatial_hash_update(SpatialHash &hash, uint32_t index, float x, float y)
+{
+  if (index >= hash.cellOf.size())
+  {
+    hash.keyOf.resize(index + 1);
+    hash.cellOf.resize(index + 1, no_cell);
+    hash.slotOf.resize(index + 1);
+  }
+  uint64_t key = cell_key(cell_coord(x), cell_coord(y));
+  if (hash.cellOf[index] != no_cell)
+  {
+    std::vector<SpatialItem> &items = hash.cells[hash.cellOf[index]];
+    if (hash.keyOf[index] == key)
+    {
+      items[hash.slotOf[index]] = {index, x, y};
+      return;
+    }
+    // swap with the last of the old cell
+    SpatialItem last = items.back();
+    items[hash.slotOf[index]] = last;
+    hash.slotOf[last.index] = hash.slotOf[index];
+    items.pop_back();
+    if (items.empty())
+      remove_cell(hash, hash.keyOf[index]);
+  }
+  uint32_t cell = find_cell(hash, key);
+  if (cell == no_cell)
+    cell = add_cell(hash, key);
+  std::vector<SpatialItem> &items = hash.cells[cell];
+  hash.keyOf[index] = key;
+  hash.cellOf[index] = cell;
+  hash.slotOf[index] = uint32_t(items.size());
+  items.push_back({index, x, y});
+}
+
+// Calls fn with every hashed entity whose bounding circle may overlap that of a car at x, y.
+template<typename Fn>
+static void for_each_near(const SpatialHash &hash, float x, float y, Fn fn)
+{
+  constexpr float reach = 2.f * car_bounding_radius;
+  float fx = x * (1.f / collision_cell_size);
+  float fy = y * (1.f / collision_cell_size);
+  int32_t cx = int32_t(floorf(fx));
+  int32_t cy = int32_t(floorf(fy));
+  int32_t sx = fx - cx < 0.5f ? -1 : 1;
+  int32_t sy = fy - cy < 0.5f ? -1 : 1;
+  for (int32_t dy = 0; dy != 2 * sy; dy += sy)
+    for (int32_t dx = 0; dx != 2 * sx; dx += sx)
+    {
+      uint32_t cell = find_cell(hash, cell_key(cx + dx, cy + dy));
+      if (cell == no_cell)
+        continue;
+      for (const SpatialItem &item : hash.cells[cell])
+      {
+        float ox = item.x - x;
+        float oy = item.y - y;
+        if (ox * ox + oy * oy < reach * reach)
+          fn(item.index);
+      }
+    }
+}
+
+void spatial_hash_near(const SpatialHash &hash, float x, float y, std::vector<uint32_t> &near)
+{
+  for_each_near(hash, x, y, [&](uint32_t b) { near.push_back(b); });
+}
+
+static void find_contacts(const SpatialHash &hash, const std::vector<Entity> &entities,
+                          const std::vector<uint32_t> &active, const std::vector<uint32_t> &active_slot,
+                          size_t begin, size_t end, std::vector<Contact> &contacts)
+{
+  for (size_t i = begin; i < end; ++i)
+  {
+    uint32_t a = active[i];
+    const Entity &ea = entities[a];
+    for_each_near(hash, ea.x, ea.y, [&](uint32_t b)
+    {
+      // a pair of two awake ones is seen from both, keep it from the lower index
+      if (b <= a && (b == a || (b < active_slot.size() && active_slot[b] != uint32_t(-1))))
+        return;
+      Contact contact;
+      if (!collide_cars(ea, entities[b], contact))
+        return;
+      contact.a = a;
+      contact.b = b;
+      contacts.push_back(contact);
+    });
+  }
+}
+
+void collision_find_contacts(const SpatialHash &hash, const std::vector<Entity> &entities,
+                             const std::vector<uint32_t> &active, const std::vector<uint32_t> &active_slot,
+                             std::vector<Contact> &contacts, uint32_t threads)
+{
+  contacts.clear();
+  if (threads <= 1 || active.size() < threads * 64)
+  {
+    find_contacts(hash, entities, active, active_slot, 0, active.size(), contacts);
+    return;
+  }
+  // contiguous chunks, appended in order, so the result doesn't depend on the thread count;
+  // per calling thread, the server's rooms look for contacts at the same time
+  static thread_local std::vector<std::vector<Contact>> chunks;
+  chunks.resize(threads);
+  std::vector<std::thread> workers;
+  size_t chunkSize = (active.size() + threads - 1) / threads;
+  for (uint32_t t = 1; t < threads; ++t)
+  {
+    size_t begin = std::min(active.size(), t * chunkSize);
+    size_t end = std::min(active.size(), begin + chunkSize);
+    chunks[t].clear();
+    workers.emplace_back(find_contacts, std::cref(hash), std::cref(entities), std::cref(active), std::cref(active_slot),
+                         begin, end, std::ref(chunks[t]));
+  }
+  find_contacts(hash, entities, active, active_slot, 0, std::min(active.size(), chunkSize), contacts);
+  for (std::thread &worker : workers)
+    worker.join();
+  for (uint32_t t = 1; t < threads; ++t)
+    contacts.insert(contacts.end(), chunks[t].begin(), chunks[t].end());
+}
+
+bool collision_overlaps(const SpatialHash &hash, const std::vector<Entity> &entities, const Entity &e, uint32_t self)
+{
+  bool overlaps = false;
+  for_each_near(hash, e.x, e.y, [&](uint32_t b)
+  {
+    Contact contact;
+    if (b != self && !overlaps)
+      overlaps = collide_cars(e, entities[b], contact);
+  });
+  return overlaps;
+}
+
+bool collide_cars(const Entity &a, const Entity &b, Contact &contact)
+{
+  float ca = cosf(a.ori);
+  float sa = sinf(a.ori);
+  float cb = cosf(b.ori);
+  float sb = sinf(b.ori);
+  float axes[4][2] = {{ca, sa}, {-sa, ca}, {cb, sb}, {-sb, cb}};
+  float dx = b.x - a.x;
+  float dy = b.y - a.y;
+  contact.depth = 1e30f;
+  for (const float *axis : axes)
+  {
+    // half extents of both boxes along the axis
+    float ra = car_half_length * fabsf(ca * axis[0] + sa * axis[1]) + car_half_width * fabsf(-sa * axis[0] + ca * axis[1]);
+    float rb = car_half_length * fabsf(cb * axis[0] + sb * axis[1]) + car_half_width * fabsf(-sb * axis[0] + cb * axis[1]);
+    float dist = dx * axis[0] + dy * axis[1];
+    float overlap = ra + rb - fabsf(dist);
+    if (overlap <= collision_slop)
+      return false;
+    if (overlap < contact.depth)
+    {
+      float s = dist < 0.f ? -1.f : 1.f;
+      contact.depth = overlap;
+      contact.nx = axis[0] * s;
+      contact.ny = axis[1] * s;
+    }
+  }
+  return true;
+}
+
+void resolve_contact(Entity &a, Entity &b, const Contact &contact)
+{
+  float nx = contact.nx;
+  float ny = contact.ny;
+  float push = contact.depth * 0.5f;
+  a.x -= nx * push;
+  a.y -= ny * push;
+  b.x += nx * push;
+  b.y += ny * push;
+
+  float ca = cosf(a.ori);
+  float sa = sinf(a.ori);
+  float cb = cosf(b.ori);
+  float sb = sinf(b.ori);
+  float vax = ca * a.speed;
+  float vay = sa * a.speed;
+  float vbx = cb * b.speed;
+  float vby = sb * b.speed;
+  float closing = (vax - vbx) * nx + (vay - vby) * ny;
+  if (closing <= 0.f)
+    return; // already moving apart
+  float j = (1.f + collision_restitution) * closing * 0.5f;
+  // kept to what snapshots can carry
+  a.speed = clamp((vax - j * nx) * ca + (vay - j * ny) * sa, min_speed, max_speed);
+  b.speed = clamp((vbx + j * nx) * cb + (vby + j * ny) * sb, min_speed, max_speed);
+}
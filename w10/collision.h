@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "entity.h"
+
+// Cars are boxes around what render draws: 4 m long along ori, 2 m wide.
+constexpr float car_half_length = 2.f;
+constexpr float car_half_width = 1.f;
+constexpr float car_bounding_radius = 2.236068f; // corner distance
+// Cells are twice the reach of a car, so whatever it can touch is in its own cell or the
+// neighbours on the side of the cell it is in: four lookups instead of nine. The margin
+// covers a car pushed out of its cell by a contact, it is rehashed on the next tick only.
+constexpr float collision_cell_size = 2.f * (2.f * car_bounding_radius + 0.5f);
+constexpr float collision_restitution = 0.2f;
+// Overlaps up to this are touching, not a contact. Pushed apart cars end up just touching and
+// rounding would otherwise find them again every tick, and never let them sleep.
+constexpr float collision_slop = 0.01f;
+
+// Entities by grid cell, by index into the entity vector like the world history. Updating
+// an entity that stays in its cell is a compare, so moving the awake ones every tick costs
+// only those that cross a cell edge. Cells are found through a flat table with linear
+// probing, a node based map costs a cache miss for every cell a query looks at, and keep
+// a copy of the positions so most candidates are turned down without touching the entity.
+constexpr uint32_t no_cell = uint32_t(-1);
+struct SpatialItem
+{
+  uint32_t index;
+  float x;
+  float y;
+};
+struct SpatialHash
+{
+  std::vector<uint64_t> keys; // power of two, at most half full
+  std::vector<uint32_t> slots; // index into cells or no_cell
+  std::vector<std::vector<SpatialItem>> cells; // empty ones are reused
+  std::vector<uint32_t> freeCells;
+  uint32_t used = 0;
+  std::vector<uint64_t> keyOf; // per entity
+  std::vector<uint32_t> cellOf; // per entity, no_cell until first hashed
+  std::vector<uint32_t> slotOf; // per entity, its place in the cell
+};
+
+struct Contact
+{
+  uint32_t a = 0;
+  uint32_t b = 0;
+  float nx = 0.f; // from a to b
+  float ny = 0.f;
+  float depth = 0.f;
+};
+
+void spatial_hash_update(SpatialHash &hash, uint32_t index, float x, float y);
+
+// Appends the hashed entities a car at x, y could reach, itself included if it is hashed.
+void spatial_hash_near(const SpatialHash &hash, float x, float y, std::vector<uint32_t> &near);
+
+// Overlapping pairs with at least one of active in them, each once and in the same order
+// for any thread count. active_slot is uint32_t(-1) for the entities not in active, the way
+// the server keeps its sleeping ones. threads > 1 splits the queries over that many threads.
+void collision_find_contacts(const SpatialHash &hash, const std::vector<Entity> &entities,
+                             const std::vector<uint32_t> &active, const std::vector<uint32_t> &active_slot,
+                             std::vector<Contact> &contacts, uint32_t threads = 1);
+
+// Whether a car at e would overlap any hashed entity but itself, for finding a free spot.
+bool collision_overlaps(const SpatialHash &hash, const std::vector<Entity> &entities, const Entity &e,
+                        uint32_t self = uint32_t(-1));
+
+// Separating axis test of the two boxes, fills the normal and depth of the smallest overlap.
+// False for boxes apart or only touching.
+bool collide_cars(const Entity &a, const Entity &b, Contact &contact);
+
+// Equal masses. Pushes the two apart and bounces the closing velocity along the normal,
+// what is left is put back on the cars' own axes, tyres don't slide sideways.
+void resolve_contact(Entity &a, Entity &b, const Contact &contact);
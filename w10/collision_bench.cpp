@@ -0,0 +1,90 @@
+// Cost of a collision step per tick for evenly spread cars, all of them awake: rehashing,
+// finding contacts with one thread and with several, and resolving them.
+// collision_bench [entities] [ticks] [threads] [m2 per car]
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "collision.h"
+#include "timeUtils.h"
+
+int main(int argc, const char **argv)
+{
+  size_t count = argc > 1 ? size_t(atoi(argv[1])) : 10000;
+  int ticks = argc > 2 ? atoi(argv[2]) : 300;
+  uint32_t threads = argc > 3 ? uint32_t(atoi(argv[3])) : 4;
+  float areaPerCar = argc > 4 ? float(atof(argv[4])) : 50.f;
+
+  float side = sqrtf(areaPerCar * count);
+  std::vector<Entity> entities(count);
+  std::vector<uint32_t> active(count);
+  std::vector<uint32_t> activeSlot(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    Entity &e = entities[i];
+    e.eid = uint16_t(i);
+    e.x = float(rand()) / RAND_MAX * side;
+    e.y = float(rand()) / RAND_MAX * side;
+    e.ori = float(rand() % 628) * 0.01f - 3.14f;
+    e.thr = float(rand() % 10) * 0.1f;
+    e.steer = float(rand() % 3) - 1.f;
+    active[i] = uint32_t(i);
+    activeSlot[i] = uint32_t(i);
+  }
+
+  SpatialHash hash;
+  std::vector<Contact> contacts;
+  std::vector<Contact> parallelContacts;
+  uint64_t hashTime = 0;
+  uint64_t findTime = 0;
+  uint64_t parallelTime = 0;
+  uint64_t resolveTime = 0;
+  uint64_t contactCount = 0;
+  bool same = true;
+  for (int tick = 0; tick < ticks; ++tick)
+  {
+    for (Entity &e : entities)
+    {
+      simulate_entity(e, fixed_dt);
+      // stay on the square, turned back in at the edges
+      if (e.x < 0.f || e.x > side || e.y < 0.f || e.y > side)
+      {
+        e.x = std::max(0.f, std::min(side, e.x));
+        e.y = std::max(0.f, std::min(side, e.y));
+        e.ori = atan2f(side * 0.5f - e.y, side * 0.5f - e.x);
+      }
+    }
+    uint64_t start = get_time_ns();
+    for (uint32_t i = 0; i < count; ++i)
+      spatial_hash_update(hash, i, entities[i].x, entities[i].y);
+    uint64_t hashed = get_time_ns();
+    collision_find_contacts(hash, entities, active, activeSlot, contacts, 1);
+    uint64_t found = get_time_ns();
+    collision_find_contacts(hash, entities, active, activeSlot, parallelContacts, threads);
+    uint64_t foundParallel = get_time_ns();
+    for (const Contact &c : contacts)
+      resolve_contact(entities[c.a], entities[c.b], c);
+    uint64_t end = get_time_ns();
+
+    same = same && parallelContacts.size() == contacts.size() &&
+           std::equal(contacts.begin(), contacts.end(), parallelContacts.begin(),
+                      [](const Contact &a, const Contact &b) { return a.a == b.a && a.b == b.b; });
+    // the first tick inserts everything
+    if (tick > 0)
+      hashTime += hashed - start;
+    findTime += found - hashed;
+    parallelTime += foundParallel - found;
+    resolveTime += end - foundParallel;
+    contactCount += contacts.size();
+  }
+
+  printf("%zu entities on %.0f x %.0f m, %d ticks, %zu cells, %.1f contacts per tick\n", count, side, side, ticks,
+         size_t(hash.used), double(contactCount) / ticks);
+  printf("rehash           %8.1f us\n", hashTime * 1e-3 / std::max(1, ticks - 1));
+  printf("contacts         %8.1f us\n", findTime * 1e-3 / ticks);
+  printf("contacts, %2u thr %8.1f us%s\n", threads, parallelTime * 1e-3 / ticks, same ? "" : " (differs!)");
+  printf("resolve          %8.1f us\n", resolveTime * 1e-3 / ticks);
+  printf("per entity       %8.1f ns\n", double(hashTime / std::max(1, ticks - 1) + findTime / ticks + resolveTime / ticks) / count);
+  return same ? 0 : 1;
+}
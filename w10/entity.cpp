@@ -12,3 +12,11 @@ void simulate_entity(Entity &e, float dt)
   e.y += sinf(e.ori) * e.speed * dt;
 }
 
+
+void extrapolate_entity(Entity &e, float ticks)
+{
+  for (; ticks >= 1.f; ticks -= 1.f)
+    simulate_entity(e, fixed_dt);
+  if (ticks > 0.f)
+    simulate_entity(e, ticks * fixed_dt);
+}
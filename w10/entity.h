@@ -2,6 +2,13 @@
 #include <cstdint>
 
 constexpr uint16_t invalid_entity = -1;
+
+// Every input is one step of fixed_dt on both the server and the predicting client.
+constexpr uint32_t sim_tick_rate = 60;
+constexpr float fixed_dt = 1.f / sim_tick_rate;
+// what simulate_entity can reach, for quantisation
+constexpr float min_speed = -3.f;
+constexpr float max_speed = 10.f;
 struct Entity
 {
   uint32_t color = 0xff00ffff;
@@ -15,4 +22,7 @@ struct Entity
 };
 
 void simulate_entity(Entity &e, float dt);
+// Dead reckoning: carries on with the same thr and steer for a number of ticks, whole
+// ticks step exactly like the simulation so server and client agree on where it ends up.
+void extrapolate_entity(Entity &e, float ticks);
 
@@ -0,0 +1,107 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+// Q16.16 fixed point. Integer operations give the same bits on every compiler and CPU,
+// which float with cosf/sinf doesn't, so this is what the lockstep simulation runs on.
+typedef int32_t fixed;
+
+constexpr int fixed_shift = 16;
+constexpr fixed fixed_one = 1 << fixed_shift;
+
+// Only for constants and for data coming from outside the simulation, the conversion
+// itself is exact for the same float on every platform.
+constexpr fixed fx_from_float(float v)
+{
+  return fixed(v * float(fixed_one));
+}
+
+constexpr float fx_to_float(fixed v)
+{
+  return float(v) * (1.f / float(fixed_one));
+}
+
+constexpr fixed fx_mul(fixed a, fixed b)
+{
+  return fixed((int64_t(a) * b) >> fixed_shift);
+}
+
+constexpr fixed fx_clamp(fixed in, fixed min, fixed max)
+{
+  return in < min ? min : in > max ? max : in;
+}
+
+constexpr fixed fx_sign(fixed in)
+{
+  return in > 0 ? 1 : in < 0 ? -1 : 0;
+}
+
+constexpr fixed fx_move_to(fixed from, fixed to, fixed dt, fixed vel)
+{
+  fixed d = fx_mul(vel, dt);
+  if ((from > to ? from - to : to - from) < d)
+    return to;
+  return to < from ? from - d : from + d;
+}
+
+// Angles are binary: angle_turn per full turn, so wrapping is the uint16_t overflow.
+typedef uint16_t angle;
+constexpr uint32_t angle_turn = 1 << 16;
+constexpr int sin_table_bits = 10; // entries per quarter turn
+constexpr int sin_table_size = 1 << sin_table_bits;
+
+// Quarter wave of sin in Q16.16, built by the compiler from a series in double, so the
+// table is the same wherever it's compiled.
+constexpr std::array<fixed, sin_table_size + 1> make_sin_table()
+{
+  std::array<fixed, sin_table_size + 1> table = {};
+  for (int i = 0; i <= sin_table_size; ++i)
+  {
+    double x = 1.5707963267948966 * i / sin_table_size;
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 12; ++n)
+    {
+      term *= -x * x / ((2 * n) * (2 * n + 1));
+      sum += term;
+    }
+    table[i] = fixed(sum * fixed_one + 0.5);
+  }
+  return table;
+}
+constexpr std::array<fixed, sin_table_size + 1> sin_table = make_sin_table();
+
+constexpr fixed fx_sin(angle a)
+{
+  constexpr int quarter_shift = 14; // angle bits below the quadrant
+  constexpr int frac_bits = quarter_shift - sin_table_bits;
+  uint32_t quadrant = a >> quarter_shift;
+  uint32_t inQuarter = a & ((1 << quarter_shift) - 1);
+  if (quadrant & 1)
+    inQuarter = (1 << quarter_shift) - inQuarter;
+  uint32_t i = inQuarter >> frac_bits;
+  fixed frac = fixed(inQuarter & ((1 << frac_bits) - 1));
+  fixed v = sin_table[i];
+  if (i < sin_table_size)
+    v += ((sin_table[i + 1] - v) * frac) >> frac_bits;
+  return quadrant & 2 ? -v : v;
+}
+
+constexpr fixed fx_cos(angle a)
+{
+  return fx_sin(angle(a + angle_turn / 4));
+}
+
+// radians in Q16.16 to angle units, 65536 / 2pi
+constexpr fixed radians_to_angle = fixed(10430.378350470453 * fixed_one);
+
+constexpr angle angle_from_radians(fixed rad)
+{
+  return angle(uint32_t((int64_t(rad) * radians_to_angle) >> (2 * fixed_shift)));
+}
+
+constexpr float angle_to_radians(angle a)
+{
+  float r = float(a) * (6.283185307f / float(angle_turn));
+  return r > 3.141592654f ? r - 6.283185307f : r;
+}
@@ -0,0 +1,122 @@
+#include "interpolation.h"
+#include "entity.h"
+#include "mathUtils.h"
+#include <algorithm>
+
+static const double tick_interval_us = 1e6 / sim_tick_rate;
+
+bool history_insert(SnapshotHistory &history, const SnapshotSample &sample)
+{
+  int pos = history.count;
+  while (pos > 0 && history.samples[pos - 1].tick > sample.tick)
+    pos--;
+  if (pos > 0 && history.samples[pos - 1].tick == sample.tick)
+    return false;
+  if (history.count == snapshot_history_size)
+  {
+    if (pos == 0)
+      return false;
+    // drop the oldest to make room
+    for (int i = 1; i < pos; ++i)
+      history.samples[i - 1] = history.samples[i];
+    history.samples[pos - 1] = sample;
+    return true;
+  }
+  for (int i = history.count; i > pos; --i)
+    history.samples[i] = history.samples[i - 1];
+  history.samples[pos] = sample;
+  history.count++;
+  return true;
+}
+
+static float lerp_angle(float from, float to, float t)
+{
+  float d = to - from;
+  d = d > PI ? d - 2.f * PI : d < -PI ? d + 2.f * PI : d;
+  float a = from + d * t;
+  return a > PI ? a - 2.f * PI : a < -PI ? a + 2.f * PI : a;
+}
+
+static Entity reckon(const SnapshotSample &s, double ticks)
+{
+  Entity e;
+  e.x = s.x;
+  e.y = s.y;
+  e.ori = s.ori;
+  e.speed = s.speed;
+  e.thr = s.thr;
+  e.steer = s.steer;
+  extrapolate_entity(e, float(ticks));
+  return e;
+}
+
+bool history_sample(const SnapshotHistory &history, double tick, float &x, float &y, float &ori)
+{
+  if (history.count == 0)
+    return false;
+  const SnapshotSample *s = history.samples;
+  int last = history.count - 1;
+  const SnapshotSample &first = s[0];
+  const SnapshotSample &newest = s[last];
+  if (tick <= first.tick)
+  {
+    x = first.x;
+    y = first.y;
+    ori = first.ori;
+    return true;
+  }
+  if (tick >= newest.tick)
+  {
+    Entity e = reckon(newest, std::min(tick - newest.tick, double(max_extrapolation_ticks)));
+    x = e.x;
+    y = e.y;
+    ori = e.ori;
+    return true;
+  }
+  int i = 0;
+  while (s[i + 1].tick <= tick)
+    i++;
+  uint32_t gap = s[i + 1].tick - s[i].tick;
+  float t = float((tick - s[i].tick) / double(gap));
+  if (gap == 1)
+  {
+    x = s[i].x + (s[i + 1].x - s[i].x) * t;
+    y = s[i].y + (s[i + 1].y - s[i].y) * t;
+    ori = lerp_angle(s[i].ori, s[i + 1].ori, t);
+    return true;
+  }
+  // where the older sample said it would be, moved towards the newer one by as much of
+  // the miss as the time covered, so both ends match their samples
+  Entity at = reckon(s[i], tick - s[i].tick);
+  Entity end = reckon(s[i], double(gap));
+  x = at.x + (s[i + 1].x - end.x) * t;
+  y = at.y + (s[i + 1].y - end.y) * t;
+  ori = lerp_angle(at.ori, at.ori + (s[i + 1].ori - end.ori), t);
+  return true;
+}
+
+void clock_on_snapshot(InterpolationClock &clock, uint32_t tick, uint64_t arrival_us)
+{
+  double offset = double(arrival_us) - tick * tick_interval_us;
+  if (!clock.valid)
+  {
+    clock.offsetUs = offset;
+    clock.valid = true;
+  }
+  // follow faster paths at once and slower ones (clock drift, route change) slowly
+  if (offset < clock.offsetUs)
+    clock.offsetUs = offset;
+  else
+    clock.offsetUs += (offset - clock.offsetUs) * 0.001;
+  double lateness = offset - clock.offsetUs;
+  clock.jitterUs += (lateness - clock.jitterUs) * (1.0 / 16.0);
+  // one tick to have the next sample, plus room for late ones, but never past what the history holds
+  float delay = clamp(1.f + float(2.5 * clock.jitterUs / tick_interval_us), 1.f, float(snapshot_history_size - 2));
+  // ease into the new delay, a jump would make everyone skip or freeze for a moment
+  clock.delayTicks += (delay - clock.delayTicks) * 0.01f;
+}
+
+double clock_render_tick(const InterpolationClock &clock, uint64_t now_us)
+{
+  return (double(now_us) - clock.offsetUs) / tick_interval_us - clock.delayTicks;
+}
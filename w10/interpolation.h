@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+
+struct SnapshotSample
+{
+  uint32_t tick = 0;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+  float speed = 0.f;
+  float thr = 0.f;
+  float steer = 0.f;
+};
+
+constexpr uint8_t snapshot_history_size = 8;
+// The server skips snapshots while dead reckoning is close enough, but past this the
+// entity is more likely gone than going straight, so it is held.
+constexpr uint32_t max_extrapolation_ticks = 60;
+
+// Last snapshots of a remote entity ordered by server tick, oldest first.
+struct SnapshotHistory
+{
+  SnapshotSample samples[snapshot_history_size];
+  uint8_t count = 0;
+};
+
+// Maps local time to server ticks and decides how far behind the newest tick rendering trails.
+struct InterpolationClock
+{
+  double offsetUs = 0.0; // local time at which tick 0 would have arrived on the fastest path
+  double jitterUs = 0.0; // smoothed lateness against offsetUs
+  float delayTicks = 1.f;
+  bool valid = false;
+};
+
+// Returns false if the sample is a duplicate or older than everything kept.
+bool history_insert(SnapshotHistory &history, const SnapshotSample &sample);
+// Position at a fractional tick. Consecutive ticks are interpolated, gaps the server left
+// because dead reckoning was good enough are dead reckoned, blending in the correction the
+// later sample brings, and past the newest one it extrapolates. Holds before the oldest.
+bool history_sample(const SnapshotHistory &history, double tick, float &x, float &y, float &ori);
+
+void clock_on_snapshot(InterpolationClock &clock, uint32_t tick, uint64_t arrival_us);
+double clock_render_tick(const InterpolationClock &clock, uint64_t now_us);
@@ -0,0 +1,91 @@
+// Runs headless w10 clients against a server on localhost with input tracing on and
+// prints how long inputs took until a snapshot showed them, split into where the time went.
+// latency_probe [--clients N] [--seconds N] [--client path/to/w10]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Component
+{
+  const char *name;
+  std::vector<double> ms;
+};
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+  if (sorted.empty())
+    return 0.0;
+  size_t i = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[i];
+}
+
+int main(int argc, const char **argv)
+{
+  int clients = 4;
+  int seconds = 30;
+  const char *clientPath = "./w10";
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--clients") && i + 1 < argc)
+      clients = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+      seconds = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--client") && i + 1 < argc)
+      clientPath = argv[++i];
+  }
+
+  // the clients pace themselves, one thread per process just waits for it
+  std::vector<std::thread> runs;
+  for (int i = 0; i < clients; ++i)
+  {
+    std::string cmd = std::string(clientPath) + " --headless --fps 60 --frames " + std::to_string(seconds * 60) +
+                      " --trace latency_probe_" + std::to_string(i) + ".csv";
+    runs.emplace_back([cmd]()
+    {
+      if (std::system(cmd.c_str()) != 0)
+        fprintf(stderr, "%s failed\n", cmd.c_str());
+    });
+  }
+  for (std::thread &run : runs)
+    run.join();
+
+  Component components[] = {{"total", {}}, {"network", {}}, {"tick wait", {}}, {"queueing", {}}, {"processing", {}}};
+  for (int i = 0; i < clients; ++i)
+  {
+    std::string path = "latency_probe_" + std::to_string(i) + ".csv";
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+    {
+      fprintf(stderr, "Cannot open %s\n", path.c_str());
+      continue;
+    }
+    char line[256];
+    if (!fgets(line, sizeof(line), f)) // header
+      line[0] = '\0';
+    unsigned seq = 0; long long total = 0; long long network = 0;
+    unsigned tickWait = 0; unsigned queue = 0; unsigned process = 0;
+    while (fscanf(f, "%u,%lld,%lld,%u,%u,%u", &seq, &total, &network, &tickWait, &queue, &process) == 6)
+    {
+      components[0].ms.push_back(total * 1e-3);
+      components[1].ms.push_back(network * 1e-3);
+      components[2].ms.push_back(tickWait * 1e-3);
+      components[3].ms.push_back(queue * 1e-3);
+      components[4].ms.push_back(process * 1e-3);
+    }
+    fclose(f);
+  }
+
+  printf("%zu traced inputs from %d clients, ms\n", components[0].ms.size(), clients);
+  printf("%-12s %9s %9s %9s %9s %9s\n", "", "p50", "p95", "p99", "p99.9", "max");
+  for (Component &c : components)
+  {
+    std::sort(c.ms.begin(), c.ms.end());
+    printf("%-12s %9.3f %9.3f %9.3f %9.3f %9.3f\n", c.name, percentile(c.ms, 0.5), percentile(c.ms, 0.95),
+           percentile(c.ms, 0.99), percentile(c.ms, 0.999), c.ms.empty() ? 0.0 : c.ms.back());
+  }
+  return 0;
+}
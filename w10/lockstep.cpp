@@ -0,0 +1,107 @@
+#include "lockstep.h"
+#include <cstddef>
+
+// the float simulation's constants, see simulate_entity
+constexpr fixed fixed_dt_fx = fixed_one / sim_tick_rate;
+constexpr fixed brake_accel = 12 * fixed_one;
+constexpr fixed accel = 3 * fixed_one;
+constexpr fixed min_thr = fx_from_float(-0.3f);
+constexpr fixed max_target_speed = 10 * fixed_one;
+constexpr fixed turn_speed_limit = 2 * fixed_one;
+constexpr fixed turn_rate = fx_from_float(0.3f);
+
+int8_t lockstep_quantize_input(float v)
+{
+  v = v < -1.f ? -1.f : v > 1.f ? 1.f : v;
+  return int8_t(v * 127.f);
+}
+
+static fixed input_to_fixed(int8_t v)
+{
+  return fixed(v) * fixed_one / 127;
+}
+
+FixedEntity fixed_entity_from(const Entity &e)
+{
+  FixedEntity f;
+  f.color = e.color;
+  f.x = fx_from_float(e.x);
+  f.y = fx_from_float(e.y);
+  f.speed = fx_from_float(e.speed);
+  f.ori = angle_from_radians(fx_from_float(e.ori));
+  f.thr = lockstep_quantize_input(e.thr);
+  f.steer = lockstep_quantize_input(e.steer);
+  f.eid = e.eid;
+  return f;
+}
+
+void simulate_entity_fixed(FixedEntity &e)
+{
+  fixed thr = input_to_fixed(e.thr);
+  fixed steer = input_to_fixed(e.steer);
+  bool isBraking = fx_sign(thr) != 0 && fx_sign(thr) != fx_sign(e.speed);
+  fixed target = fx_mul(fx_clamp(thr, min_thr, fixed_one), max_target_speed);
+  e.speed = fx_move_to(e.speed, target, fixed_dt_fx, isBraking ? brake_accel : accel);
+  fixed turn = fx_mul(fx_mul(fx_mul(steer, fixed_dt_fx), fx_clamp(e.speed, -turn_speed_limit, turn_speed_limit)), turn_rate);
+  e.ori = angle(e.ori + angle_from_radians(turn));
+  fixed step = fx_mul(e.speed, fixed_dt_fx);
+  e.x += fx_mul(fx_cos(e.ori), step);
+  e.y += fx_mul(fx_sin(e.ori), step);
+}
+
+void lockstep_step(LockstepWorld &world, const LockstepInput *inputs, uint16_t count)
+{
+  for (uint16_t i = 0; i < count; ++i)
+    for (FixedEntity &e : world.entities)
+      if (e.eid == inputs[i].eid)
+      {
+        e.thr = inputs[i].thr;
+        e.steer = inputs[i].steer;
+      }
+  for (FixedEntity &e : world.entities)
+    simulate_entity_fixed(e);
+  world.tick++;
+}
+
+static uint32_t fnv1a(uint32_t hash, uint32_t v)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    hash ^= (v >> (i * 8)) & 0xff;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t lockstep_hash(const LockstepWorld &world)
+{
+  uint32_t hash = 2166136261u;
+  hash = fnv1a(hash, world.tick);
+  for (const FixedEntity &e : world.entities)
+  {
+    hash = fnv1a(hash, e.eid);
+    hash = fnv1a(hash, uint32_t(e.x));
+    hash = fnv1a(hash, uint32_t(e.y));
+    hash = fnv1a(hash, uint32_t(e.speed));
+    hash = fnv1a(hash, e.ori);
+  }
+  return hash;
+}
+
+void lockstep_to_entities(const LockstepWorld &world, std::vector<Entity> &out)
+{
+  out.resize(world.entities.size());
+  for (size_t i = 0; i < world.entities.size(); ++i)
+  {
+    const FixedEntity &f = world.entities[i];
+    Entity &e = out[i];
+    e.color = f.color;
+    e.x = fx_to_float(f.x);
+    e.y = fx_to_float(f.y);
+    e.speed = fx_to_float(f.speed);
+    e.ori = angle_to_radians(f.ori);
+    e.thr = f.thr / 127.f;
+    e.steer = f.steer / 127.f;
+    e.eid = f.eid;
+  }
+}
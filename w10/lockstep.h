@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "entity.h"
+#include "fixed_math.h"
+
+// Car state of the deterministic simulation, sent as is when someone joins.
+struct FixedEntity
+{
+  uint32_t color = 0xff00ffff;
+  fixed x = 0;
+  fixed y = 0;
+  fixed speed = 0;
+  angle ori = 0;
+  int8_t thr = 0; // -127..127 for -1..1
+  int8_t steer = 0;
+  uint16_t eid = invalid_entity;
+};
+
+// What one player does in one tick, the only thing sent around in lockstep.
+struct LockstepInput
+{
+  uint16_t eid = invalid_entity;
+  int8_t thr = 0;
+  int8_t steer = 0;
+};
+
+constexpr uint32_t lockstep_input_delay = 3; // ticks between sampling an input and simulating it
+constexpr uint32_t lockstep_hash_interval = 30; // ticks between desync checks
+
+struct LockstepWorld
+{
+  uint32_t tick = 0; // last simulated
+  std::vector<FixedEntity> entities;
+};
+
+int8_t lockstep_quantize_input(float v);
+FixedEntity fixed_entity_from(const Entity &e);
+
+void simulate_entity_fixed(FixedEntity &e);
+// Applies the inputs of tick world.tick + 1 and simulates it.
+void lockstep_step(LockstepWorld &world, const LockstepInput *inputs, uint16_t count);
+// FNV-1a over everything the simulation touches, equal on all participants unless they desynced.
+uint32_t lockstep_hash(const LockstepWorld &world);
+void lockstep_to_entities(const LockstepWorld &world, std::vector<Entity> &out);
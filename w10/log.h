@@ -0,0 +1,156 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Calls below LOG_LEVEL compile to nothing, override with -DLOG_LEVEL=LOG_LEVEL_DEBUG.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) log_write(LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+enum LogArgType : uint8_t
+{
+  E_LOG_ARG_INT = 0,
+  E_LOG_ARG_UINT,
+  E_LOG_ARG_DOUBLE,
+  E_LOG_ARG_STRING,
+  E_LOG_ARG_POINTER
+};
+
+constexpr size_t max_log_args = 8;
+constexpr size_t log_string_capacity = 64; // string args are copied, longer ones are truncated
+constexpr uint32_t log_ring_size = 1024; // records per thread, power of two
+
+// Binary record: the format string must outlive the program (a literal), args are formatted
+// by the flusher thread, so the calling thread never touches stdout.
+struct LogRecord
+{
+  const char *fmt;
+  uint8_t level;
+  uint8_t argCount;
+  uint8_t stringsSize;
+  LogArgType argTypes[max_log_args];
+  uint64_t args[max_log_args];
+  char strings[log_string_capacity];
+};
+
+// Single producer (the owning thread), single consumer (the flusher).
+struct LogRing
+{
+  alignas(64) std::atomic<uint32_t> head{0};
+  alignas(64) std::atomic<uint32_t> tail{0};
+  alignas(64) std::atomic<uint32_t> dropped{0};
+  uint32_t cachedTail = 0;
+  LogRecord records[log_ring_size];
+};
+
+LogRing *log_register_thread();
+// Blocks until everything logged so far is written out.
+void log_flush();
+
+inline LogRing &log_thread_ring()
+{
+  thread_local LogRing *ring = log_register_thread();
+  return *ring;
+}
+
+template<typename T>
+inline void log_pack_arg(LogRecord &rec, const T &v)
+{
+  uint64_t &arg = rec.args[rec.argCount];
+  LogArgType &type = rec.argTypes[rec.argCount];
+  rec.argCount++;
+  if constexpr (std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, const char*>)
+  {
+    type = E_LOG_ARG_STRING;
+    size_t room = log_string_capacity - rec.stringsSize;
+    if (room == 0)
+    {
+      arg = log_string_capacity - 1; // terminator of the previous string, prints as empty
+      return;
+    }
+    const char *str = v;
+    size_t len = str ? strnlen(str, room - 1) : 0;
+    if (len > 0)
+      memcpy(rec.strings + rec.stringsSize, str, len);
+    rec.strings[rec.stringsSize + len] = '\0';
+    arg = rec.stringsSize;
+    rec.stringsSize += uint8_t(len + 1);
+  }
+  else if constexpr (std::is_floating_point_v<T>)
+  {
+    double d = double(v);
+    memcpy(&arg, &d, sizeof(double));
+    type = E_LOG_ARG_DOUBLE;
+  }
+  else if constexpr (std::is_pointer_v<T>)
+  {
+    arg = uint64_t(uintptr_t(v));
+    type = E_LOG_ARG_POINTER;
+  }
+  else if constexpr (std::is_enum_v<T> || std::is_signed_v<T>)
+  {
+    arg = uint64_t(int64_t(v));
+    type = E_LOG_ARG_INT;
+  }
+  else
+  {
+    static_assert(std::is_unsigned_v<T>, "unsupported log argument type");
+    arg = uint64_t(v);
+    type = E_LOG_ARG_UINT;
+  }
+}
+
+template<typename... Args>
+inline void log_write(uint8_t level, const char *fmt, const Args&... args)
+{
+  static_assert(sizeof...(Args) <= max_log_args, "too many log arguments");
+  LogRing &ring = log_thread_ring();
+  uint32_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.cachedTail >= log_ring_size)
+  {
+    ring.cachedTail = ring.tail.load(std::memory_order_acquire);
+    if (head - ring.cachedTail >= log_ring_size)
+    {
+      // the flusher is behind, never wait for it
+      ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  LogRecord &rec = ring.records[head & (log_ring_size - 1)];
+  rec.fmt = fmt;
+  rec.level = level;
+  rec.argCount = 0;
+  rec.stringsSize = 0;
+  (log_pack_arg(rec, args), ...);
+  ring.head.store(head + 1, std::memory_order_release);
+}
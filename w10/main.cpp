@@ -4,7 +4,6 @@
 #include <bgfx/bgfx.h>
 #include <bgfx/platform.h>
 #include <bx/timer.h>
-#include <debugdraw/debugdraw.h>
 #include <functional>
 #include "app.h"
 #include <enet/enet.h>
@@ -15,80 +14,82 @@
 
 
 #include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
 #include "entity.h"
-#include "protocol.h"
+#include "log.h"
+#include "render.h"
+#include "net_thread.h"
+#include "timeUtils.h"
+#include "profiler.h"
 
 
-static std::vector<Entity> entities;
-static uint16_t my_entity = invalid_entity;
-
-void on_new_entity_packet(ENetPacket *packet)
+// Where a frame's CPU time goes, dumped one line per frame with --timings.
+struct FrameTimings
 {
-  Entity newEntity;
-  deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
-}
-
-void on_set_controlled_entity(ENetPacket *packet)
-{
-  deserialize_set_controlled_entity(packet, my_entity);
-}
-
-void on_snapshot(ENetPacket *packet)
-{
-  uint16_t eid = invalid_entity;
-  float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
-    }
-}
-
-void on_key(ENetPacket *packet)
+  uint64_t stateNs = 0; // picking up the newest replica
+  uint64_t inputNs = 0;
+  uint64_t renderNs = 0; // culling and instance buffer fill
+  uint64_t frameNs = 0; // bgfx::frame
+  uint64_t pollNs = 0; // window events, or the pacing sleep when headless
+  uint64_t totalNs = 0; // without pollNs
+  uint32_t entities = 0;
+  uint32_t visible = 0;
+  uint32_t packets = 0; // handled by the network thread since the previous frame
+  uint64_t netNs = 0;
+};
+
+static uint64_t hp_ns(int64_t from, int64_t to)
 {
-  deserialize_and_set_key(packet);
+  return uint64_t(double(to - from) * 1e9 / double(bx::getHPFrequency()));
 }
 
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
   {
-    printf("Cannot init ENet");
+    LOG_ERROR("Cannot init ENet");
     return 1;
   }
 
-  ENetHost *client = enet_host_create(nullptr, 1, 2, 0, 0);
-  if (!client)
+  // w10 [--headless] [--fps N] [--frames N] [--timings file.csv] [--trace file.csv] [--profile trace.json] [--room id]
+  bool headless = false;
+  float fps = 60.f;
+  uint32_t maxFrames = 0;
+  const char *timingsPath = nullptr;
+  const char *tracePath = nullptr;
+  const char *profilePath = nullptr;
+  uint16_t room = 0;
+  for (int i = 1; i < argc; ++i)
   {
-    printf("Cannot create ENet client\n");
-    return 1;
-  }
-
-  ENetAddress address;
-  enet_address_set_host(&address, "localhost");
-  address.port = 10131;
-
-  ENetPeer *serverPeer = enet_host_connect(client, &address, 2, 0);
-  if (!serverPeer)
-  {
-    printf("Cannot connect to server");
-    return 1;
+    if (!strcmp(argv[i], "--headless"))
+      headless = true;
+    else if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+      fps = float(atof(argv[++i]));
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+      maxFrames = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--timings") && i + 1 < argc)
+      timingsPath = argv[++i];
+    else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+      tracePath = argv[++i];
+    else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+      profilePath = argv[++i];
+    else if (!strcmp(argv[i], "--room") && i + 1 < argc)
+      room = uint16_t(atoi(argv[++i]));
   }
 
   int width = 1920;
   int height = 1080;
-  if (!app_init(width, height))
+  if (headless ? !app_init_headless(width, height, fps, maxFrames) : !app_init(width, height))
+    return 1;
+  if (!render_init())
+    return 1;
+  FILE *traceFile = tracePath ? fopen(tracePath, "w") : nullptr;
+  if (tracePath && !traceFile)
+    LOG_ERROR("Cannot open %s\n", tracePath);
+  if (!net_thread_start("localhost", 10131, traceFile, room))
     return 1;
-  ddInit();
 
   bx::Vec3 eye(0.f, 0.f, -16.f);
   bx::Vec3 at(0.f, 0.f, 0.f);
@@ -99,63 +100,55 @@ int main(int argc, const char **argv)
   bx::mtxLookAt(view, bx::load<bx::Vec3>(&eye.x), bx::load<bx::Vec3>(&at.x), bx::load<bx::Vec3>(&up.x) );
 
 
-  bool connected = false;
-  int64_t now = bx::getHPCounter();
-  int64_t last = now;
-  float dt = 0.f;
+  FILE *timingsFile = nullptr;
+  if (timingsPath)
+  {
+    timingsFile = fopen(timingsPath, "w");
+    if (!timingsFile)
+      LOG_ERROR("Cannot open %s\n", timingsPath);
+    else
+      fprintf(timingsFile, "frame,state_ns,input_ns,render_ns,frame_ns,poll_ns,total_ns,entities,visible,packets,net_ns\n");
+  }
+  FrameTimings sum;
+  uint64_t maxTotalNs = 0;
+  uint32_t frames = 0;
+  uint32_t lastPackets = 0;
+  uint64_t lastNetNs = 0;
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+  int64_t last = bx::getHPCounter();
+#endif
+  std::vector<Entity> drawn; // interpolated copy of the replica, reused every frame
   while (!app_should_close())
   {
-    ENetEvent event;
-    while (enet_host_service(client, &event, 0) > 0)
+    PROFILE_SCOPE("frame");
+    FrameTimings t;
+    int64_t frameStart = bx::getHPCounter();
+    const ReplicaState &state = net_get_state();
     {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        send_join(serverPeer);
-        connected = true;
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-        case E_SERVER_TO_CLIENT_NEW_ENTITY:
-          on_new_entity_packet(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-          on_set_controlled_entity(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_KEY:
-          on_key(event.packet);
-          break;
-        };
-        break;
-      default:
-        break;
-      };
+      PROFILE_SCOPE("interpolate");
+      net_interpolate_entities(state, get_time_us(), drawn);
     }
-    if (my_entity != invalid_entity)
+    int64_t stateEnd = bx::getHPCounter();
+    if (state.myEntity != invalid_entity)
     {
       bool left = app_keypressed(GLFW_KEY_LEFT);
       bool right = app_keypressed(GLFW_KEY_RIGHT);
       bool up = app_keypressed(GLFW_KEY_UP);
       bool down = app_keypressed(GLFW_KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? 1.f : 0.f) + (right ? -1.f : 0.f);
-
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
+      float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+      float steer = (left ? 1.f : 0.f) + (right ? -1.f : 0.f);
+
+      // picked up by the network thread on its next input tick
+      net_set_input(thr, steer);
     }
+    int64_t inputEnd = bx::getHPCounter();
 
-    app_poll_events();
+    {
+      PROFILE_SCOPE("poll_events");
+      app_poll_events();
+    }
+    int64_t pollEnd = bx::getHPCounter();
     // Handle window resize.
     app_handle_resize(width, height);
     bx::mtxProj(proj, 60.0f, float(width)/float(height), 0.1f, 100.0f, bgfx::getCaps()->homogeneousDepth);
@@ -165,33 +158,78 @@ int main(int argc, const char **argv)
     const bgfx::ViewId kClearView = 0;
     bgfx::touch(kClearView);
 
-    DebugDrawEncoder dde;
-
-    dde.begin(0);
-
-    for (const Entity &e : entities)
+    int64_t renderStart = bx::getHPCounter();
     {
-      dde.push();
-
-        dde.setColor(e.color);
-        bx::Vec3 dir = {cosf(e.ori), sinf(e.ori), 0.f};
-        bx::Vec3 pos = {e.x, e.y, -0.01f};
-        dde.drawCapsule(sub(pos, dir), add(pos, dir), 1.f);
-
-      dde.pop();
+      PROFILE_SCOPE("render_entities");
+      t.visible = render_entities(kClearView, drawn, eye, 60.f, float(width)/float(height));
     }
-
-    dde.end();
+    int64_t renderEnd = bx::getHPCounter();
 
     // Advance to next frame. Process submitted rendering primitives.
-    bgfx::frame();
+    {
+      PROFILE_SCOPE("bgfx_frame");
+      bgfx::frame();
+    }
+    int64_t frameEnd = bx::getHPCounter();
+
+    t.stateNs = hp_ns(frameStart, stateEnd);
+    t.inputNs = hp_ns(stateEnd, inputEnd);
+    t.renderNs = hp_ns(renderStart, renderEnd);
+    t.frameNs = hp_ns(renderEnd, frameEnd);
+    t.pollNs = hp_ns(inputEnd, pollEnd);
+    t.totalNs = hp_ns(frameStart, frameEnd) - t.pollNs;
+    t.entities = uint32_t(state.entities.size());
+    t.packets = state.packetsReceived - lastPackets;
+    t.netNs = state.receiveTimeNs - lastNetNs;
+    lastPackets = state.packetsReceived;
+    lastNetNs = state.receiveTimeNs;
+    if (timingsFile)
+      fprintf(timingsFile, "%u,%llu,%llu,%llu,%llu,%llu,%llu,%u,%u,%u,%llu\n", frames,
+              (unsigned long long)t.stateNs, (unsigned long long)t.inputNs, (unsigned long long)t.renderNs,
+              (unsigned long long)t.frameNs, (unsigned long long)t.pollNs, (unsigned long long)t.totalNs, t.entities, t.visible,
+              t.packets, (unsigned long long)t.netNs);
+    sum.stateNs += t.stateNs;
+    sum.inputNs += t.inputNs;
+    sum.renderNs += t.renderNs;
+    sum.frameNs += t.frameNs;
+    sum.totalNs += t.totalNs;
+    sum.packets += t.packets;
+    sum.netNs += t.netNs;
+    maxTotalNs = std::max(maxTotalNs, t.totalNs);
+    frames++;
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
     const double freq = double(bx::getHPFrequency());
     int64_t now = bx::getHPCounter();
-    dt = (float)((now - last) / freq);
+    float dt = (float)((now - last) / freq);
     last = now;
-    printf("%f\n", 1.f/dt);
+    LOG_DEBUG("%f\n", 1.f/dt);
+#endif
+  }
+  net_thread_stop();
+  if (traceFile)
+    fclose(traceFile);
+  if (profilePath)
+  {
+    // both threads are done recording now
+    PROFILE_REPORT();
+    PROFILE_WRITE_TRACE(profilePath);
+  }
+  const ReplicaState &finalState = net_get_state();
+  if (timingsFile)
+    fclose(timingsFile);
+  if (frames > 0)
+  {
+    LOG_INFO("%u frames, us/frame: state %.2f input %.2f render %.2f bgfx %.2f total %.2f (max %.2f)\n",
+             frames, sum.stateNs * 1e-3 / frames, sum.inputNs * 1e-3 / frames, sum.renderNs * 1e-3 / frames,
+             sum.frameNs * 1e-3 / frames, sum.totalNs * 1e-3 / frames, maxTotalNs * 1e-3);
+    LOG_INFO("network thread: %.1f packets/frame, %.2f us/frame\n", double(sum.packets) / frames, sum.netNs * 1e-3 / frames);
+    LOG_INFO("interpolation: delay %.2f ticks, jitter %.2f ms, %u late and %u dropped snapshots\n",
+             finalState.clock.delayTicks, finalState.clock.jitterUs * 1e-3, finalState.lateSnapshots, finalState.droppedSnapshots);
+    const ClockSync &sync = finalState.sync;
+    LOG_INFO("clock sync: %u exchanges, min rtt %.3f ms, drift %.1f ppm, error mean %.3f ms max %.3f ms, %u steps\n",
+             sync.exchanges, sync.minRttUs * 1e-3, sync.driftPpm, sync.meanAbsErrorUs * 1e-3, sync.maxAbsErrorUs * 1e-3, sync.steps);
   }
-  ddShutdown();
+  render_shutdown();
   bgfx::shutdown();
   app_terminate();
   return 0;
@@ -0,0 +1,170 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "log.h"
+
+enum MetricKind : uint8_t
+{
+  E_METRIC_COUNTER,
+  E_METRIC_GAUGE,
+  E_METRIC_HISTOGRAM
+};
+
+struct MetricEntry
+{
+  std::string name;
+  std::string help;
+  std::string labels;
+  MetricKind kind;
+  std::unique_ptr<MetricCounter> counter;
+  std::unique_ptr<MetricGauge> gauge;
+  std::unique_ptr<MetricHistogram> histogram;
+};
+
+static std::mutex metricsMutex;
+static std::vector<MetricEntry> metrics;
+
+static MetricEntry &add_entry(const char *name, const char *help, const char *labels, MetricKind kind)
+{
+  metrics.push_back(MetricEntry{name, help, labels, kind, nullptr, nullptr, nullptr});
+  return metrics.back();
+}
+
+MetricCounter *metrics_counter(const char *name, const char *help, const char *labels)
+{
+  std::lock_guard<std::mutex> lock(metricsMutex);
+  MetricEntry &e = add_entry(name, help, labels, E_METRIC_COUNTER);
+  e.counter = std::make_unique<MetricCounter>();
+  return e.counter.get();
+}
+
+MetricGauge *metrics_gauge(const char *name, const char *help, const char *labels)
+{
+  std::lock_guard<std::mutex> lock(metricsMutex);
+  MetricEntry &e = add_entry(name, help, labels, E_METRIC_GAUGE);
+  e.gauge = std::make_unique<MetricGauge>();
+  return e.gauge.get();
+}
+
+MetricHistogram *metrics_histogram(const char *name, const char *help, const char *labels)
+{
+  std::lock_guard<std::mutex> lock(metricsMutex);
+  MetricEntry &e = add_entry(name, help, labels, E_METRIC_HISTOGRAM);
+  e.histogram = std::make_unique<MetricHistogram>();
+  return e.histogram.get();
+}
+
+void metrics_remove(const void *metric)
+{
+  std::lock_guard<std::mutex> lock(metricsMutex);
+  metrics.erase(std::remove_if(metrics.begin(), metrics.end(), [metric](const MetricEntry &e)
+    {
+      return e.counter.get() == metric || e.gauge.get() == metric || e.histogram.get() == metric;
+    }), metrics.end());
+}
+
+static uint64_t bucket_upper(uint32_t bucket)
+{
+  if (bucket < metric_sub_buckets)
+    return bucket;
+  uint32_t high = bucket / metric_sub_buckets + 2;
+  uint64_t sub = bucket % metric_sub_buckets;
+  return ((metric_sub_buckets + sub + 1) << (high - 3)) - 1;
+}
+
+uint64_t metric_histogram_quantile(const MetricHistogram &histogram, double q)
+{
+  uint64_t count = 0;
+  uint64_t counts[metric_histogram_buckets];
+  for (uint32_t i = 0; i < metric_histogram_buckets; ++i)
+  {
+    counts[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+    count += counts[i];
+  }
+  if (count == 0)
+    return 0;
+  uint64_t rank = uint64_t(q * double(count - 1)) + 1;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < metric_histogram_buckets; ++i)
+  {
+    seen += counts[i];
+    if (seen >= rank)
+      return std::min(bucket_upper(i), histogram.max.load(std::memory_order_relaxed));
+  }
+  return histogram.max.load(std::memory_order_relaxed);
+}
+
+static void write_sample(FILE *f, const std::string &name, const char *suffix, const std::string &labels,
+                         const char *extra, double value)
+{
+  const char *sep = !labels.empty() && extra[0] ? "," : "";
+  if (labels.empty() && !extra[0])
+    fprintf(f, "%s%s %.17g\n", name.c_str(), suffix, value);
+  else
+    fprintf(f, "%s%s{%s%s%s} %.17g\n", name.c_str(), suffix, labels.c_str(), sep, extra, value);
+}
+
+bool metrics_write_prometheus(const char *path)
+{
+  std::string tmpPath = std::string(path) + ".tmp";
+  FILE *f = fopen(tmpPath.c_str(), "w");
+  if (!f)
+  {
+    LOG_ERROR("Cannot open %s\n", tmpPath.c_str());
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    // the format wants all samples of a name together, under one HELP and TYPE
+    std::vector<const MetricEntry*> sorted;
+    sorted.reserve(metrics.size());
+    for (const MetricEntry &e : metrics)
+      sorted.push_back(&e);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const MetricEntry *a, const MetricEntry *b) { return a->name < b->name; });
+    static const char *kindNames[] = {"counter", "gauge", "summary"};
+    const std::string *lastName = nullptr;
+    for (const MetricEntry *e : sorted)
+    {
+      if (!lastName || *lastName != e->name)
+      {
+        fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", e->name.c_str(), e->help.c_str(), e->name.c_str(), kindNames[e->kind]);
+        lastName = &e->name;
+      }
+      switch (e->kind)
+      {
+      case E_METRIC_COUNTER:
+        write_sample(f, e->name, "", e->labels, "", double(e->counter->value.load(std::memory_order_relaxed)));
+        break;
+      case E_METRIC_GAUGE:
+        write_sample(f, e->name, "", e->labels, "", e->gauge->value.load(std::memory_order_relaxed));
+        break;
+      case E_METRIC_HISTOGRAM:
+      {
+        const MetricHistogram &h = *e->histogram;
+        write_sample(f, e->name, "", e->labels, "quantile=\"0.5\"", double(metric_histogram_quantile(h, 0.5)));
+        write_sample(f, e->name, "", e->labels, "quantile=\"0.9\"", double(metric_histogram_quantile(h, 0.9)));
+        write_sample(f, e->name, "", e->labels, "quantile=\"0.99\"", double(metric_histogram_quantile(h, 0.99)));
+        write_sample(f, e->name, "", e->labels, "quantile=\"0.999\"", double(metric_histogram_quantile(h, 0.999)));
+        write_sample(f, e->name, "", e->labels, "quantile=\"1\"", double(h.max.load(std::memory_order_relaxed)));
+        write_sample(f, e->name, "_sum", e->labels, "", double(h.sum.load(std::memory_order_relaxed)));
+        write_sample(f, e->name, "_count", e->labels, "", double(h.count.load(std::memory_order_relaxed)));
+        break;
+      }
+      };
+    }
+  }
+  fclose(f);
+#ifdef _WIN32
+  remove(path); // rename does not replace on windows
+#endif
+  if (rename(tmpPath.c_str(), path) != 0)
+  {
+    LOG_ERROR("Cannot replace %s\n", path);
+    return false;
+  }
+  return true;
+}
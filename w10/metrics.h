@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Counters, gauges and histograms that any thread can update without locks, exported
+// as Prometheus text. Registering and removing take a lock, keep them out of hot paths
+// and hold on to the returned pointers, they stay valid until removed.
+
+struct MetricCounter
+{
+  std::atomic<uint64_t> value{0};
+};
+
+struct MetricGauge
+{
+  std::atomic<double> value{0.0};
+};
+
+// HDR style: exact below 8, then 8 linear buckets per power of two, so any value is
+// off by at most 12.5%.
+constexpr uint32_t metric_sub_buckets = 8;
+constexpr uint32_t metric_histogram_buckets = (64 - 2) * metric_sub_buckets;
+
+struct MetricHistogram
+{
+  std::atomic<uint64_t> buckets[metric_histogram_buckets] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+};
+
+inline uint32_t metric_bucket_of(uint64_t v)
+{
+  if (v < metric_sub_buckets)
+    return uint32_t(v);
+#if defined(_MSC_VER)
+  unsigned long high;
+  _BitScanReverse64(&high, v);
+#else
+  uint32_t high = 63 - __builtin_clzll(v);
+#endif
+  uint32_t sub = uint32_t(v >> (high - 3)) & (metric_sub_buckets - 1);
+  return (high - 2) * metric_sub_buckets + sub;
+}
+
+inline void metric_add(MetricCounter *counter, uint64_t n = 1)
+{
+  counter->value.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void metric_set(MetricGauge *gauge, double v)
+{
+  gauge->value.store(v, std::memory_order_relaxed);
+}
+
+inline void metric_record(MetricHistogram *histogram, uint64_t v)
+{
+  histogram->buckets[metric_bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+  histogram->count.fetch_add(1, std::memory_order_relaxed);
+  histogram->sum.fetch_add(v, std::memory_order_relaxed);
+  uint64_t prev = histogram->max.load(std::memory_order_relaxed);
+  while (v > prev && !histogram->max.compare_exchange_weak(prev, v, std::memory_order_relaxed))
+    ;
+}
+
+// labels are Prometheus label pairs without the braces, like "type=\"snapshot\"", and may be empty.
+// Metrics of one name share the first help text given for it.
+MetricCounter *metrics_counter(const char *name, const char *help, const char *labels = "");
+MetricGauge *metrics_gauge(const char *name, const char *help, const char *labels = "");
+MetricHistogram *metrics_histogram(const char *name, const char *help, const char *labels = "");
+// Forgets a metric, for labels that go away such as a disconnected peer.
+void metrics_remove(const void *metric);
+
+// Upper bound of the bucket the given quantile falls into.
+uint64_t metric_histogram_quantile(const MetricHistogram &histogram, double q);
+
+// Writes everything to a temporary next to path and renames it over, so a scraper never
+// reads half a file. Histograms come out as summaries with quantiles.
+bool metrics_write_prometheus(const char *path);
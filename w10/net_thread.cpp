@@ -0,0 +1,480 @@
+#include "net_thread.h"
+#include <enet/enet.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "protocol.h"
+#include "log.h"
+#include "profiler.h"
+#include "timeUtils.h"
+#include "triple_buffer.h"
+
+static std::thread netThread;
+static std::atomic<bool> running{false};
+static ENetHost *client = nullptr;
+static ENetPeer *serverPeer = nullptr;
+static FILE *traceFile = nullptr;
+static uint16_t joinRoom = 0;
+
+static TripleBuffer<ReplicaState> published;
+static std::atomic<uint64_t> input{0}; // thr and steer bits, written by the render thread
+
+constexpr uint64_t sync_burst_interval = 50000; // us
+constexpr uint64_t sync_interval = 1000000;
+
+// owned by the network thread
+static ReplicaState replica;
+// per entity, the world cell its snapshots are relative to and its tag
+struct ReplicaCell
+{
+  SnapshotCell cell;
+  uint8_t tag = 0;
+};
+static std::vector<ReplicaCell> replicaCells;
+
+// Inputs the server may not have applied yet, replayed on top of every authoritative state
+// and resent with every new one until acked.
+constexpr uint16_t input_history_size = 128; // ~2 s at sim_tick_rate, divides the seq range
+static InputRecord inputHistory[input_history_size];
+static uint16_t nextInputSeq = 1;
+static uint16_t ackedInputSeq = 0;
+static Entity predicted;
+static bool hasPrediction = false;
+static uint32_t predictedTick = 0; // server tick of the state the prediction was last reconciled with
+
+// lockstep mode, switched on by the server sending the world
+static bool lockstepMode = false;
+static LockstepWorld lockstepWorld;
+static std::vector<LockstepInput> lockstepInputs;
+
+static Entity *find_entity(uint16_t eid, size_t *index = nullptr)
+{
+  // TODO: Direct adressing, of course!
+  for (size_t i = 0; i < replica.entities.size(); ++i)
+    if (replica.entities[i].eid == eid)
+    {
+      if (index)
+        *index = i;
+      return &replica.entities[i];
+    }
+  return nullptr;
+}
+
+static void reconcile(const Entity &authoritative, uint16_t ack_seq)
+{
+  predicted = authoritative;
+  hasPrediction = true;
+  if (seq_newer(ack_seq, ackedInputSeq))
+    ackedInputSeq = ack_seq;
+  uint16_t pending = seq_newer(nextInputSeq, ack_seq) ? uint16_t(nextInputSeq - ack_seq - 1) : 0;
+  if (pending > input_history_size)
+    pending = input_history_size;
+  for (uint16_t seq = nextInputSeq - pending; seq != nextInputSeq; ++seq)
+  {
+    const InputRecord &input = inputHistory[seq % input_history_size];
+    predicted.thr = input.thr;
+    predicted.steer = input.steer;
+    simulate_entity(predicted, fixed_dt);
+  }
+}
+
+static void on_new_entity_packet(ENetPacket *packet)
+{
+  Entity newEntity;
+  deserialize_new_entity(packet, newEntity);
+  if (find_entity(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  replica.entities.push_back(newEntity);
+  replica.snapshotTimes.push_back(0);
+  replica.history.emplace_back();
+  // the server starts from the same cell
+  replicaCells.push_back({snapshot_cell_of(newEntity.x, newEntity.y), 0});
+}
+
+static void on_entity_cell(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  ReplicaCell cell;
+  deserialize_entity_cell(packet, eid, cell.cell, cell.tag);
+  size_t index = 0;
+  if (find_entity(eid, &index))
+    replicaCells[index] = cell;
+}
+
+// The base port of a server with several rooms only says where the room is, join again there.
+static void on_room(ENetPacket *packet)
+{
+  uint16_t room = 0;
+  uint16_t port = 0;
+  deserialize_room(packet, room, port);
+  ENetAddress address = serverPeer->address;
+  address.port = port;
+  LOG_INFO("Room %u is on port %u\n", room, port);
+  enet_peer_disconnect_now(serverPeer, 0);
+  replica.connected = false;
+  serverPeer = enet_host_connect(client, &address, 2, 0);
+  if (!serverPeer)
+    LOG_ERROR("Cannot connect to room %u\n", room);
+}
+
+static void on_set_controlled_entity(ENetPacket *packet)
+{
+  deserialize_set_controlled_entity(packet, replica.myEntity);
+}
+
+static void on_snapshot(ENetPacket *packet, uint64_t arrival_time)
+{
+  PROFILE_SCOPE("on_snapshot");
+  uint32_t tick = 0;
+  uint16_t eid = invalid_entity;
+  float x = 0.f; float y = 0.f; float ori = 0.f; float speed = 0.f; float thr = 0.f; float steer = 0.f;
+  uint8_t cellTag = 0;
+  uint16_t inputSeq = 0;
+  InputTrace trace;
+  bool traced = deserialize_snapshot(packet, tick, eid, x, y, cellTag, ori, speed, thr, steer, inputSeq, trace);
+  if (traced && traceFile && eid == replica.myEntity)
+  {
+    // the server only reports durations, so no clock sync is needed to split the total
+    int64_t total = int64_t(arrival_time - trace.clientTime);
+    int64_t network = total - int64_t(trace.tickWaitUs) - int64_t(trace.queueUs) - int64_t(trace.processUs);
+    // inputs are fuzzed on the way, a corrupted send time shows up as nonsense here
+    if (network >= 0 && total < 10000000)
+      fprintf(traceFile, "%u,%lld,%lld,%u,%u,%u\n", trace.seq, (long long)total, (long long)network,
+              trace.tickWaitUs, trace.queueUs, trace.processUs);
+  }
+  size_t index = 0;
+  Entity *e = find_entity(eid, &index);
+  if (!e)
+    return;
+  const ReplicaCell &cell = replicaCells[index];
+  if (cellTag != (cell.tag & snapshot_cell_tag_mask))
+  {
+    // got here before the reliable cell it is relative to
+    replica.droppedSnapshots++;
+    return;
+  }
+  x += cell.cell.x * snapshot_cell_size;
+  y += cell.cell.y * snapshot_cell_size;
+  replica.snapshotTimes[index] = arrival_time;
+  clock_on_snapshot(replica.clock, tick, arrival_time);
+  if (eid != replica.myEntity)
+  {
+    // the snapshot channel is unsequenced, so ticks may come in any order
+    if (tick < clock_render_tick(replica.clock, arrival_time))
+      replica.lateSnapshots++;
+    if (!history_insert(replica.history[index], {tick, x, y, ori, speed, thr, steer}))
+    {
+      replica.droppedSnapshots++;
+      return;
+    }
+    const SnapshotHistory &history = replica.history[index];
+    if (history.samples[history.count - 1].tick == tick)
+    {
+      e->x = x;
+      e->y = y;
+      e->ori = ori;
+      e->speed = speed;
+      e->thr = thr;
+      e->steer = steer;
+    }
+    return;
+  }
+  if (hasPrediction && tick <= predictedTick)
+    return; // reordered, the prediction already builds on something newer
+  predictedTick = tick;
+  Entity authoritative = *e;
+  authoritative.x = x;
+  authoritative.y = y;
+  authoritative.ori = ori;
+  authoritative.speed = speed;
+  reconcile(authoritative, inputSeq);
+  *e = predicted;
+}
+
+static void on_time_response(ENetPacket *packet, uint64_t arrival_time)
+{
+  uint64_t clientTime = 0; uint64_t serverReceive = 0; uint64_t serverSend = 0; uint64_t serverTickTime = 0;
+  uint32_t serverTick = 0;
+  deserialize_time_response(packet, clientTime, serverReceive, serverSend, serverTick, serverTickTime);
+  clock_sync_add_sample(replica.sync, clientTime, serverReceive, serverSend, arrival_time, serverTick, serverTickTime);
+}
+
+static void update_lockstep_replica()
+{
+  lockstep_to_entities(lockstepWorld, replica.entities);
+  replica.snapshotTimes.resize(replica.entities.size());
+  replica.history.resize(replica.entities.size());
+}
+
+static void on_lockstep_state(ENetPacket *packet)
+{
+  deserialize_lockstep_state(packet, lockstepWorld);
+  lockstepMode = true;
+  update_lockstep_replica();
+}
+
+static void on_lockstep_spawn(ENetPacket *packet)
+{
+  FixedEntity ent;
+  deserialize_lockstep_spawn(packet, ent);
+  lockstepWorld.entities.push_back(ent);
+  update_lockstep_replica();
+}
+
+static void on_lockstep_tick(ENetPacket *packet)
+{
+  uint32_t tick = 0;
+  deserialize_lockstep_tick(packet, tick, lockstepInputs);
+  if (tick != lockstepWorld.tick + 1)
+  {
+    // the channel is reliable and ordered, so this is a bug rather than the network
+    LOG_ERROR("Lockstep tick %u after %u\n", tick, lockstepWorld.tick);
+    return;
+  }
+  lockstep_step(lockstepWorld, lockstepInputs.data(), uint16_t(lockstepInputs.size()));
+  if (tick % lockstep_hash_interval == 0)
+    send_state_hash(serverPeer, tick, lockstep_hash(lockstepWorld));
+  update_lockstep_replica();
+}
+
+static void on_key(ENetPacket *packet)
+{
+  deserialize_and_set_key(packet);
+}
+
+// Records and sends this tick's input, then moves the own car by it right away.
+// Returns true if the prediction changed.
+static bool send_input()
+{
+  if (replica.myEntity == invalid_entity)
+    return false;
+  uint64_t bits = input.load(std::memory_order_relaxed);
+  float thr = 0.f; float steer = 0.f;
+  uint32_t thrBits = uint32_t(bits >> 32);
+  uint32_t steerBits = uint32_t(bits);
+  memcpy(&thr, &thrBits, sizeof(float));
+  memcpy(&steer, &steerBits, sizeof(float));
+
+  if (lockstepMode)
+  {
+    // everyone simulates it lockstep_input_delay ticks from now, nothing to predict
+    send_lockstep_input(serverPeer, replica.myEntity, lockstepWorld.tick + lockstep_input_delay,
+                        lockstep_quantize_input(thr), lockstep_quantize_input(steer));
+    return false;
+  }
+
+  uint16_t seq = nextInputSeq++;
+  inputHistory[seq % input_history_size] = {seq, thr, steer};
+  // newest first, back to the last one the server has confirmed
+  InputRecord inputs[max_redundant_inputs];
+  uint8_t count = 0;
+  for (uint16_t s = seq; count < max_redundant_inputs && (count == 0 || seq_newer(s, ackedInputSeq)); --s)
+    inputs[count++] = inputHistory[s % input_history_size];
+  uint8_t interpDelay = uint8_t(std::min(replica.clock.delayTicks * 16.f, 255.f));
+  send_entity_input(serverPeer, replica.myEntity, interpDelay, inputs, count, traceFile ? get_time_us() : 0);
+
+  Entity *e = find_entity(replica.myEntity);
+  if (!hasPrediction || !e)
+    return false;
+  predicted.thr = thr;
+  predicted.steer = steer;
+  simulate_entity(predicted, fixed_dt);
+  *e = predicted;
+  return true;
+}
+
+static void publish_state()
+{
+  ReplicaState &state = published.back();
+  state.entities.assign(replica.entities.begin(), replica.entities.end());
+  state.snapshotTimes.assign(replica.snapshotTimes.begin(), replica.snapshotTimes.end());
+  state.history.assign(replica.history.begin(), replica.history.end());
+  state.clock = replica.clock;
+  state.sync = replica.sync;
+  state.myEntity = replica.myEntity;
+  state.connected = replica.connected;
+  state.packetsReceived = replica.packetsReceived;
+  state.receiveTimeNs = replica.receiveTimeNs;
+  state.lateSnapshots = replica.lateSnapshots;
+  state.droppedSnapshots = replica.droppedSnapshots;
+  published.publish();
+}
+
+static void net_thread_loop()
+{
+  const uint64_t inputInterval = 1000000 / sim_tick_rate; // us
+  uint64_t nextInputTime = get_time_us();
+  uint64_t nextSyncTime = 0;
+  PROFILE_THREAD("net");
+  while (running.load(std::memory_order_relaxed))
+  {
+    // sleep in the socket until the next input tick, anything arriving wakes us up right away
+    uint64_t now = get_time_us();
+    uint32_t waitMs = nextInputTime > now ? uint32_t((nextInputTime - now) / 1000) : 0;
+    bool changed = false;
+    ENetEvent event;
+    int res;
+    {
+      PROFILE_SCOPE("service_wait");
+      res = enet_host_service(client, &event, waitMs);
+    }
+    while (res > 0)
+    {
+      PROFILE_SCOPE("event");
+      uint64_t handleStart = get_time_ns();
+      uint64_t arrivalTime = handleStart / 1000;
+      switch (event.type)
+      {
+      case ENET_EVENT_TYPE_CONNECT:
+        LOG_INFO("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        send_join(serverPeer, joinRoom);
+        replica.connected = true;
+        changed = true;
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        LOG_INFO("Disconnected from %x:%u\n", event.peer->address.host, event.peer->address.port);
+        replica.connected = false;
+        changed = true;
+        break;
+      case ENET_EVENT_TYPE_RECEIVE:
+        switch (get_packet_type(event.packet))
+        {
+        case E_SERVER_TO_CLIENT_NEW_ENTITY:
+          on_new_entity_packet(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
+          on_set_controlled_entity(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_SNAPSHOT:
+          on_snapshot(event.packet, arrivalTime);
+          break;
+        case E_SERVER_TO_CLIENT_KEY:
+          on_key(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_TIME_RESPONSE:
+          on_time_response(event.packet, arrivalTime);
+          break;
+        case E_SERVER_TO_CLIENT_LOCKSTEP_STATE:
+          on_lockstep_state(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_LOCKSTEP_SPAWN:
+          on_lockstep_spawn(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_LOCKSTEP_TICK:
+          on_lockstep_tick(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_ENTITY_CELL:
+          on_entity_cell(event.packet);
+          break;
+        case E_SERVER_TO_CLIENT_ROOM:
+          on_room(event.packet);
+          break;
+        };
+        enet_packet_destroy(event.packet);
+        replica.packetsReceived++;
+        changed = true;
+        break;
+      default:
+        break;
+      };
+      replica.receiveTimeNs += get_time_ns() - handleStart;
+      res = enet_host_service(client, &event, 0);
+    }
+    now = get_time_us();
+    if (now >= nextInputTime)
+    {
+      PROFILE_SCOPE("send_input");
+      changed |= send_input();
+      enet_host_flush(client);
+      nextInputTime += inputInterval;
+      // don't try to catch up after a stall, keep the rate
+      if (nextInputTime < now)
+        nextInputTime = now + inputInterval;
+    }
+    // a quick burst to get a first estimate, then enough to follow the drift
+    if (replica.connected && now >= nextSyncTime)
+    {
+      send_time_request(serverPeer, get_time_us());
+      enet_host_flush(client); // t0 is only as good as the time it really leaves
+      nextSyncTime = now + (replica.sync.exchanges < clock_sync_window / 2 ? sync_burst_interval : sync_interval);
+    }
+    if (changed)
+    {
+      PROFILE_SCOPE("publish_state");
+      publish_state();
+    }
+  }
+  if (serverPeer)
+    enet_peer_disconnect_now(serverPeer, 0);
+  enet_host_destroy(client);
+  client = nullptr;
+  serverPeer = nullptr;
+}
+
+bool net_thread_start(const char *host, uint16_t port, FILE *trace_file, uint16_t room)
+{
+  client = enet_host_create(nullptr, 1, 2, 0, 0);
+  if (!client)
+  {
+    LOG_ERROR("Cannot create ENet client\n");
+    return false;
+  }
+
+  ENetAddress address;
+  enet_address_set_host(&address, host);
+  address.port = port;
+
+  serverPeer = enet_host_connect(client, &address, 2, 0);
+  if (!serverPeer)
+  {
+    LOG_ERROR("Cannot connect to server");
+    enet_host_destroy(client);
+    client = nullptr;
+    return false;
+  }
+
+  traceFile = trace_file;
+  joinRoom = room;
+  if (traceFile)
+    fprintf(traceFile, "seq,total_us,network_us,tick_wait_us,queue_us,process_us\n");
+  running = true;
+  netThread = std::thread(net_thread_loop);
+  return true;
+}
+
+void net_thread_stop()
+{
+  if (!netThread.joinable())
+    return;
+  running = false;
+  netThread.join();
+}
+
+const ReplicaState &net_get_state()
+{
+  published.update();
+  return published.front();
+}
+
+void net_set_input(float thr, float steer)
+{
+  uint32_t thrBits = 0; uint32_t steerBits = 0;
+  memcpy(&thrBits, &thr, sizeof(float));
+  memcpy(&steerBits, &steer, sizeof(float));
+  input.store(uint64_t(thrBits) << 32 | steerBits, std::memory_order_relaxed);
+}
+
+void net_interpolate_entities(const ReplicaState &state, uint64_t now_us, std::vector<Entity> &out)
+{
+  out.assign(state.entities.begin(), state.entities.end());
+  if (!state.clock.valid)
+    return;
+  double tick = clock_render_tick(state.clock, now_us);
+  for (size_t i = 0; i < out.size(); ++i)
+  {
+    Entity &e = out[i];
+    if (e.eid != state.myEntity)
+      history_sample(state.history[i], tick, e.x, e.y, e.ori);
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "entity.h"
+#include "interpolation.h"
+#include "clock_sync.h"
+
+// Replica as the network thread last saw it, handed to the render thread as a whole.
+struct ReplicaState
+{
+  std::vector<Entity> entities;
+  std::vector<uint64_t> snapshotTimes; // us, arrival of the last snapshot of each entity
+  std::vector<SnapshotHistory> history; // per entity, only filled for remote ones
+  InterpolationClock clock;
+  ClockSync sync; // server time, see clock_sync_server_tick
+  uint16_t myEntity = invalid_entity;
+  bool connected = false;
+  // running totals of what the network thread did, for frame timings
+  uint32_t packetsReceived = 0;
+  uint64_t receiveTimeNs = 0;
+  uint32_t lateSnapshots = 0; // arrived after their tick was already rendered
+  uint32_t droppedSnapshots = 0; // duplicates, older than the whole history or ahead of their cell
+};
+
+// Connects and starts servicing ENet on its own thread. Inputs go out sim_tick_rate times
+// a second and the own car is predicted from them, remote cars are interpolated between snapshots.
+// Against a server in lockstep mode everything is simulated locally from the inputs it relays.
+// With a trace file every input is traced, one CSV line per echoed trace, see InputTrace.
+// room is the one to join on a server hosting several, see send_room.
+bool net_thread_start(const char *host, uint16_t port, FILE *trace_file = nullptr, uint16_t room = 0);
+void net_thread_stop();
+
+// Render thread side, never blocks on the network thread.
+const ReplicaState &net_get_state();
+void net_set_input(float thr, float steer);
+// Remote entities a few ticks in the past, see InterpolationClock, the own one as predicted.
+// Reuses the storage of out.
+void net_interpolate_entities(const ReplicaState &state, uint64_t now_us, std::vector<Entity> &out);
@@ -0,0 +1,146 @@
+#include "profiler.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "log.h"
+
+static std::mutex ringsMutex;
+static std::vector<std::unique_ptr<ProfileRing>> rings;
+
+// tick and steady clock pair at the first registration, against a fresh one at export
+// they give the tick rate and a common zero
+static uint64_t epochTicks = 0;
+static uint64_t epochNs = 0;
+
+static uint64_t steady_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileRing *profiler_register_thread(const char *name)
+{
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  if (rings.empty())
+  {
+    epochNs = steady_ns();
+    epochTicks = profile_ticks();
+  }
+  rings.push_back(std::make_unique<ProfileRing>());
+  ProfileRing *ring = rings.back().get();
+  ring->threadName = name;
+  ring->tid = uint32_t(rings.size());
+  return ring;
+}
+
+void profiler_set_thread_name(const char *name)
+{
+  profile_thread_ring().threadName = name;
+}
+
+static double ns_per_tick()
+{
+#if PROFILE_HAS_RDTSC
+  uint64_t ticks = profile_ticks() - epochTicks;
+  uint64_t ns = steady_ns() - epochNs;
+  return ticks > 0 ? double(ns) / double(ticks) : 1.0;
+#else
+  return 1.0;
+#endif
+}
+
+bool profiler_write_trace(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+  {
+    LOG_ERROR("Cannot open %s\n", path);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  double scale = ns_per_tick() * 1e-3; // trace events are in us
+  fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (const std::unique_ptr<ProfileRing> &ring : rings)
+  {
+    if (ring->threadName)
+    {
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",\n", ring->tid, ring->threadName);
+      first = false;
+    }
+    uint64_t begin = ring->head > profile_ring_size ? ring->head - profile_ring_size : 0;
+    for (uint64_t i = begin; i < ring->head; ++i)
+    {
+      const ProfileEvent &e = ring->events[i & (profile_ring_size - 1)];
+      fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              first ? "" : ",\n", e.name, ring->tid, double(e.start - epochTicks) * scale, double(e.end - e.start) * scale);
+      first = false;
+    }
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  fclose(f);
+  return true;
+}
+
+// power of two buckets in ns, 0 is below 2 ns and the last one is everything from ~1 s
+constexpr int profile_histogram_buckets = 32;
+
+struct ProfileHistogram
+{
+  uint32_t buckets[profile_histogram_buckets] = {};
+  uint32_t count = 0;
+  double totalNs = 0.0;
+  double maxNs = 0.0;
+};
+
+static int bucket_of(double ns)
+{
+  int b = 0;
+  for (uint64_t v = uint64_t(ns); v > 1 && b < profile_histogram_buckets - 1; v >>= 1)
+    b++;
+  return b;
+}
+
+// upper bound of the bucket the p-th event falls into
+static double histogram_percentile(const ProfileHistogram &h, double p)
+{
+  uint32_t target = uint32_t(p * h.count);
+  uint32_t seen = 0;
+  for (int b = 0; b < profile_histogram_buckets; ++b)
+  {
+    seen += h.buckets[b];
+    if (seen > target)
+      return double(uint64_t(1) << (b + 1));
+  }
+  return h.maxNs;
+}
+
+void profiler_report()
+{
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  double scale = ns_per_tick();
+  for (const std::unique_ptr<ProfileRing> &ring : rings)
+  {
+    std::map<const char*, ProfileHistogram> phases;
+    uint64_t begin = ring->head - ring->reported > profile_ring_size ? ring->head - profile_ring_size : ring->reported;
+    for (uint64_t i = begin; i < ring->head; ++i)
+    {
+      const ProfileEvent &e = ring->events[i & (profile_ring_size - 1)];
+      double ns = double(e.end - e.start) * scale;
+      ProfileHistogram &h = phases[e.name];
+      h.buckets[bucket_of(ns)]++;
+      h.count++;
+      h.totalNs += ns;
+      h.maxNs = ns > h.maxNs ? ns : h.maxNs;
+    }
+    ring->reported = ring->head;
+    const char *thread = ring->threadName ? ring->threadName : "thread";
+    for (const auto &[name, h] : phases)
+      LOG_INFO("%s %s: %u calls, mean %.2f us, p50 < %.2f us, p99 < %.2f us, max %.2f us\n", thread, name, h.count,
+               h.totalNs * 1e-3 / h.count, histogram_percentile(h, 0.5) * 1e-3, histogram_percentile(h, 0.99) * 1e-3,
+               h.maxNs * 1e-3);
+  }
+}
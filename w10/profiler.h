@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// PROFILE_SCOPE("name") times the rest of the enclosing block into a ring of the calling
+// thread. Names must be string literals, they are kept by pointer. Build with
+// -DPROFILE_ENABLED=0 and every marker compiles to nothing.
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILE_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_HAS_RDTSC 1
+#else
+#include <chrono>
+#define PROFILE_HAS_RDTSC 0
+#endif
+
+constexpr uint32_t profile_ring_size = 1 << 16; // events per thread, power of two, oldest are overwritten
+
+struct ProfileEvent
+{
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+};
+
+// Written by its thread only. Export and reports read it, so call them from that thread
+// or once it has stopped.
+struct ProfileRing
+{
+  uint64_t head = 0;
+  uint64_t reported = 0; // head at the last profiler_report
+  const char *threadName = nullptr;
+  uint32_t tid = 0;
+  ProfileEvent events[profile_ring_size];
+};
+
+// rdtsc where there is one, converted to time only when exporting
+inline uint64_t profile_ticks()
+{
+#if PROFILE_HAS_RDTSC
+  return __rdtsc();
+#else
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+ProfileRing *profiler_register_thread(const char *name);
+
+inline ProfileRing &profile_thread_ring()
+{
+  thread_local ProfileRing *ring = profiler_register_thread(nullptr);
+  return *ring;
+}
+
+struct ProfileScope
+{
+  const char *name;
+  uint64_t start;
+  explicit ProfileScope(const char *n) : name(n), start(profile_ticks()) {}
+  ~ProfileScope()
+  {
+    uint64_t end = profile_ticks();
+    ProfileRing &ring = profile_thread_ring();
+    ring.events[ring.head & (profile_ring_size - 1)] = {name, start, end};
+    ring.head++;
+  }
+};
+
+// Chrome trace-event JSON of everything still in the rings, open it in chrome://tracing or Perfetto.
+bool profiler_write_trace(const char *path);
+// Logs a histogram summary of every phase recorded since the last report, per thread.
+void profiler_report();
+// Names the calling thread in the trace.
+void profiler_set_thread_name(const char *name);
+
+#if PROFILE_ENABLED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD(name) profiler_set_thread_name(name)
+#define PROFILE_REPORT() profiler_report()
+#define PROFILE_WRITE_TRACE(path) profiler_write_trace(path)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#define PROFILE_REPORT() ((void)0)
+#define PROFILE_WRITE_TRACE(path) ((void)0)
+#endif
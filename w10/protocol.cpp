@@ -1,17 +1,64 @@
 #include "protocol.h"
 #include "quantisation.h"
+#include "profiler.h"
 #include <cstring> // memcpy
 #include <iostream>
 #include <stdlib.h>
 
 static uint32_t xorCipherKey = 0;
 
-void send_join(ENetPeer *peer)
+static PacketSendHook sendHook = nullptr;
+
+constexpr size_t snapshot_trace_size = sizeof(uint16_t) + sizeof(uint64_t) + 3 * sizeof(uint32_t);
+
+void set_packet_send_hook(PacketSendHook hook)
+{
+  sendHook = hook;
+}
+
+const char *message_type_name(uint8_t type)
+{
+  static const char *names[message_type_count] =
+  {
+    "join", "new_entity", "set_controlled_entity", "input", "snapshot", "key", "time_request", "time_response",
+    "lockstep_input", "lockstep_state", "lockstep_spawn", "lockstep_tick", "state_hash", "entity_cell",
+    "room"
+  };
+  return type < message_type_count ? names[type] : "unknown";
+}
+
+// everything leaves through here
+static void send_packet(ENetPeer *peer, uint8_t channel, ENetPacket *packet)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  // ENet only takes the packet if it queues it, peers that aren't connected refuse it
+  if (enet_peer_send(peer, channel, packet) != 0)
+  {
+    enet_packet_destroy(packet);
+    return;
+  }
+  if (sendHook)
+    sendHook(peer, channel, packet);
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_join(ENetPeer *peer, uint16_t room)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t), ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_CLIENT_TO_SERVER_JOIN; ptr += sizeof(uint8_t);
+  memcpy(ptr, &room, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+
+  send_packet(peer, 0, packet);
+}
+
+void send_room(ENetPeer *peer, uint16_t room, uint16_t port)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + 2 * sizeof(uint16_t), ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_ROOM; ptr += sizeof(uint8_t);
+  memcpy(ptr, &room, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &port, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+
+  send_packet(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
@@ -22,7 +69,7 @@ void send_new_entity(ENetPeer *peer, const Entity &ent)
   *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
   memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
 
-  enet_peer_send(peer, 0, packet);
+  send_packet(peer, 0, packet);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
@@ -33,7 +80,7 @@ void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
   *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
 
-  enet_peer_send(peer, 0, packet);
+  send_packet(peer, 0, packet);
 }
 
 void send_cipher_key(ENetPeer *peer, uint32_t key)
@@ -44,7 +91,7 @@ void send_cipher_key(ENetPeer *peer, uint32_t key)
   *ptr = E_SERVER_TO_CLIENT_KEY; ptr += sizeof(uint8_t);
   memcpy(ptr, &key, sizeof(uint32_t)); ptr += sizeof(uint32_t);
 
-  enet_peer_send(peer, 0, packet);
+  send_packet(peer, 0, packet);
 }
 
 void fuzz_packet_data(ENetPacket *packet)
@@ -52,53 +99,231 @@ void fuzz_packet_data(ENetPacket *packet)
   packet->data[rand() % packet->dataLength] = (uint8_t)rand();
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
+void send_entity_input(ENetPeer *peer, uint16_t eid, uint8_t interp_delay, const InputRecord *inputs, uint8_t count,
+                       uint64_t trace_time)
 {
+  // consecutive inputs are mostly the same keys held, those are a bit in sameMask instead
+  uint8_t sameMask = 0;
+  uint8_t full = 1;
+  for (uint8_t i = 1; i < count; ++i)
+    if (inputs[i].thr == inputs[i - 1].thr && inputs[i].steer == inputs[i - 1].steer)
+      sameMask |= 1 << i;
+    else
+      full++;
   ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(float) * 2,
-                                                   //sizeof(uint8_t),
+                                                   sizeof(uint16_t) + sizeof(uint8_t) +
+                                                   sizeof(uint8_t) + sizeof(uint8_t) +
+                                                   sizeof(float) * 2 * full +
+                                                   (trace_time ? sizeof(uint64_t) : 0),
                                                    ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t countFlags = count | (trace_time ? input_traced_flag : 0);
   uint8_t *ptr = packet->data;
   *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
-  /*
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
+  memcpy(ptr, &inputs[0].seq, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &interp_delay, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  memcpy(ptr, &countFlags, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  memcpy(ptr, &sameMask, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    if (sameMask & (1 << i))
+      continue;
+    memcpy(ptr, &inputs[i].thr, sizeof(float)); ptr += sizeof(float);
+    memcpy(ptr, &inputs[i].steer, sizeof(float)); ptr += sizeof(float);
+  }
+  if (trace_time)
+  {
+    memcpy(ptr, &trace_time, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+  }
 
   fuzz_packet_data(packet);
   cipher_data(packet);
 
-  enet_peer_send(peer, 1, packet);
+  send_packet(peer, 1, packet);
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+void send_entity_cell(ENetPeer *peer, uint16_t eid, SnapshotCell cell, uint8_t tag)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) + 2 * sizeof(int16_t) +
+                                                   sizeof(uint8_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_ENTITY_CELL; ptr += sizeof(uint8_t);
+  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &cell.x, sizeof(int16_t)); ptr += sizeof(int16_t);
+  memcpy(ptr, &cell.y, sizeof(int16_t)); ptr += sizeof(int16_t);
+  memcpy(ptr, &tag, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+
+  send_packet(peer, 0, packet);
+}
+
+static uint16_t pack_cell_offset(float v, int16_t cell, const SnapshotPacking &packing)
+{
+  return pack_float<uint16_t>(v - cell * snapshot_cell_size, packing.lo, packing.hi, packing.bits);
+}
+
+void send_snapshot(ENetPeer *peer, uint32_t tick, uint16_t eid, float x, float y, uint8_t cell_tag, float ori,
+                   float speed, float thr, float steer, uint16_t input_seq, const InputTrace *trace)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t) +
                                                    sizeof(uint16_t) +
                                                    sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
+                                                   sizeof(uint8_t) +
+                                                   sizeof(uint16_t) +
+                                                   sizeof(int8_t) * 2 +
+                                                   sizeof(uint16_t) +
+                                                   (trace ? snapshot_trace_size : 0),
                                                    ENET_PACKET_FLAG_UNSEQUENCED);
   uint8_t *ptr = packet->data;
   *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
+  memcpy(ptr, &tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
   memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  uint16_t xPacked = pack_float<uint16_t>(x, -16.f, 16.f, 11);
-  uint16_t yPacked = pack_float<uint16_t>(y, -8.f, 8.f, 10);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
+  SnapshotCell cell = snapshot_cell_of(x, y);
+  uint16_t xPacked = pack_cell_offset(x, cell.x, snapshot_x_packing) | uint16_t((cell_tag & 1) << 15);
+  uint16_t yPacked = pack_cell_offset(y, cell.y, snapshot_y_packing) | uint16_t((cell_tag & 2) << 14);
+  uint8_t oriPacked = pack_float<uint8_t>(ori, snapshot_ori_packing.lo, snapshot_ori_packing.hi, snapshot_ori_packing.bits);
+  uint16_t speedPacked = pack_float<uint16_t>(speed, snapshot_speed_packing.lo, snapshot_speed_packing.hi,
+                                                snapshot_speed_packing.bits);
   //printf("xPacked/unpacked %d %f\n", xPacked, x);
   memcpy(ptr, &xPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   memcpy(ptr, &yPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
   memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  memcpy(ptr, &speedPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  int8_t thrPacked = lockstep_quantize_input(thr);
+  int8_t steerPacked = lockstep_quantize_input(steer);
+  memcpy(ptr, &thrPacked, sizeof(int8_t)); ptr += sizeof(int8_t);
+  memcpy(ptr, &steerPacked, sizeof(int8_t)); ptr += sizeof(int8_t);
+  memcpy(ptr, &input_seq, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  if (trace)
+  {
+    memcpy(ptr, &trace->seq, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+    memcpy(ptr, &trace->clientTime, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+    memcpy(ptr, &trace->tickWaitUs, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+    memcpy(ptr, &trace->queueUs, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+    memcpy(ptr, &trace->processUs, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  }
+
+  send_packet(peer, 1, packet);
+}
+
+Entity quantize_snapshot_entity(const Entity &e)
+{
+  Entity q = e;
+  SnapshotCell cell = snapshot_cell_of(e.x, e.y);
+  q.x = cell.x * snapshot_cell_size + unpack_float<uint16_t>(pack_cell_offset(e.x, cell.x, snapshot_x_packing),
+                                                             snapshot_x_packing.lo, snapshot_x_packing.hi,
+                                                             snapshot_x_packing.bits);
+  q.y = cell.y * snapshot_cell_size + unpack_float<uint16_t>(pack_cell_offset(e.y, cell.y, snapshot_y_packing),
+                                                             snapshot_y_packing.lo, snapshot_y_packing.hi,
+                                                             snapshot_y_packing.bits);
+  q.ori = unpack_float<uint8_t>(pack_float<uint8_t>(e.ori, snapshot_ori_packing.lo, snapshot_ori_packing.hi,
+                                                    snapshot_ori_packing.bits),
+                                snapshot_ori_packing.lo, snapshot_ori_packing.hi, snapshot_ori_packing.bits);
+  q.speed = unpack_float<uint16_t>(pack_float<uint16_t>(e.speed, snapshot_speed_packing.lo, snapshot_speed_packing.hi,
+                                                        snapshot_speed_packing.bits),
+                                   snapshot_speed_packing.lo, snapshot_speed_packing.hi, snapshot_speed_packing.bits);
+  q.thr = lockstep_quantize_input(e.thr) / 127.f;
+  q.steer = lockstep_quantize_input(e.steer) / 127.f;
+  return q;
+}
+
+void send_time_request(ENetPeer *peer, uint64_t client_time)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint64_t),
+                                                   ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = packet->data;
+  *ptr = E_CLIENT_TO_SERVER_TIME_REQUEST; ptr += sizeof(uint8_t);
+  memcpy(ptr, &client_time, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+
+  send_packet(peer, 1, packet);
+}
+
+void send_time_response(ENetPeer *peer, uint64_t client_time, uint64_t server_receive, uint64_t server_send,
+                        uint32_t server_tick, uint64_t server_tick_time)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint64_t) * 4 + sizeof(uint32_t),
+                                                   ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_TIME_RESPONSE; ptr += sizeof(uint8_t);
+  memcpy(ptr, &client_time, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+  memcpy(ptr, &server_receive, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+  memcpy(ptr, &server_send, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+  memcpy(ptr, &server_tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &server_tick_time, sizeof(uint64_t)); ptr += sizeof(uint64_t);
 
-  enet_peer_send(peer, 1, packet);
+  send_packet(peer, 1, packet);
+}
+
+void send_lockstep_input(ENetPeer *peer, uint16_t eid, uint32_t tick, int8_t thr, int8_t steer)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t) +
+                                                   sizeof(int8_t) * 2,
+                                                   ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = packet->data;
+  *ptr = E_CLIENT_TO_SERVER_LOCKSTEP_INPUT; ptr += sizeof(uint8_t);
+  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &thr, sizeof(int8_t)); ptr += sizeof(int8_t);
+  memcpy(ptr, &steer, sizeof(int8_t)); ptr += sizeof(int8_t);
+
+  send_packet(peer, 1, packet);
+}
+
+void send_lockstep_state(ENetPeer *peer, const LockstepWorld &world)
+{
+  uint16_t count = uint16_t(world.entities.size());
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t) +
+                                                   count * sizeof(FixedEntity),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_LOCKSTEP_STATE; ptr += sizeof(uint8_t);
+  memcpy(ptr, &world.tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &count, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, world.entities.data(), count * sizeof(FixedEntity)); ptr += count * sizeof(FixedEntity);
+
+  send_packet(peer, 0, packet);
+}
+
+void send_lockstep_spawn(ENetPeer *peer, const FixedEntity &ent)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(FixedEntity),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_LOCKSTEP_SPAWN; ptr += sizeof(uint8_t);
+  memcpy(ptr, &ent, sizeof(FixedEntity)); ptr += sizeof(FixedEntity);
+
+  send_packet(peer, 0, packet);
+}
+
+void send_lockstep_tick(ENetPeer *peer, uint32_t tick, const LockstepInput *inputs, uint16_t count)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t) +
+                                                   count * (sizeof(uint16_t) + sizeof(int8_t) * 2),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_SERVER_TO_CLIENT_LOCKSTEP_TICK; ptr += sizeof(uint8_t);
+  memcpy(ptr, &tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &count, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  for (uint16_t i = 0; i < count; ++i)
+  {
+    memcpy(ptr, &inputs[i].eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+    memcpy(ptr, &inputs[i].thr, sizeof(int8_t)); ptr += sizeof(int8_t);
+    memcpy(ptr, &inputs[i].steer, sizeof(int8_t)); ptr += sizeof(int8_t);
+  }
+
+  send_packet(peer, 0, packet);
+}
+
+void send_state_hash(ENetPeer *peer, uint32_t tick, uint32_t hash)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t) * 2,
+                                                   ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = packet->data;
+  *ptr = E_CLIENT_TO_SERVER_STATE_HASH; ptr += sizeof(uint8_t);
+  memcpy(ptr, &tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &hash, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+
+  send_packet(peer, 1, packet);
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -106,6 +331,22 @@ MessageType get_packet_type(ENetPacket *packet)
   return (MessageType)*packet->data;
 }
 
+void deserialize_join(ENetPacket *packet, uint16_t &room)
+{
+  room = 0;
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint16_t))
+    return; // from before there were rooms
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  room = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+}
+
+void deserialize_room(ENetPacket *packet, uint16_t &room, uint16_t &port)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  room = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  port = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+}
+
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
   uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
@@ -136,40 +377,86 @@ void cipher_data(ENetPacket *packet)
 
 void decipher_data(ENetPacket *packet, ENetPeer *peer)
 {
+  PROFILE_SCOPE("decipher_data");
   xor_packet_data(packet, (uint8_t*)peer->data);
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+uint8_t deserialize_entity_input(ENetPacket *packet, uint16_t &eid, uint8_t &interp_delay, InputRecord *inputs,
+                                 uint64_t &trace_time)
 {
+  const size_t headerSize = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint16_t) + 3 * sizeof(uint8_t);
+  if (packet->dataLength < headerSize)
+    return 0;
   uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
 
   eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
-  //uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  /*
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-  */
+  uint16_t seq = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  interp_delay = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
+  uint8_t count = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
+  uint8_t sameMask = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
+  bool traced = count & input_traced_flag;
+  count &= ~input_traced_flag;
+  if (count == 0 || count > max_redundant_inputs || (sameMask & 1))
+    return 0;
+  uint8_t full = 0;
+  for (uint8_t i = 0; i < count; ++i)
+    full += (sameMask & (1 << i)) ? 0 : 1;
+  if (packet->dataLength != headerSize + sizeof(float) * 2 * full + (traced ? sizeof(uint64_t) : 0))
+    return 0;
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    inputs[i].seq = seq - i;
+    if (sameMask & (1 << i))
+    {
+      inputs[i].thr = inputs[i - 1].thr;
+      inputs[i].steer = inputs[i - 1].steer;
+      continue;
+    }
+    inputs[i].thr = *(float*)(ptr); ptr += sizeof(float);
+    inputs[i].steer = *(float*)(ptr); ptr += sizeof(float);
+  }
+  trace_time = traced ? *(uint64_t*)(ptr) : 0;
+  return count;
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+bool deserialize_snapshot(ENetPacket *packet, uint32_t &tick, uint16_t &eid, float &x, float &y, uint8_t &cell_tag,
+                          float &ori, float &speed, float &thr, float &steer, uint16_t &input_seq, InputTrace &trace)
 {
   uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
   eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
   uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
   uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
   uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = unpack_float<uint16_t>(xPacked, -16.f, 16.f, 11);
-  y = unpack_float<uint16_t>(yPacked, -8.f, 8.f, 10);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  uint16_t speedPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  int8_t thrPacked = *(int8_t*)(ptr); ptr += sizeof(int8_t);
+  int8_t steerPacked = *(int8_t*)(ptr); ptr += sizeof(int8_t);
+  input_seq = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  cell_tag = uint8_t(xPacked >> 15 | (yPacked >> 15) << 1);
+  x = unpack_float<uint16_t>(xPacked & 0x7fff, snapshot_x_packing.lo, snapshot_x_packing.hi, snapshot_x_packing.bits);
+  y = unpack_float<uint16_t>(yPacked & 0x7fff, snapshot_y_packing.lo, snapshot_y_packing.hi, snapshot_y_packing.bits);
+  ori = unpack_float<uint8_t>(oriPacked, snapshot_ori_packing.lo, snapshot_ori_packing.hi, snapshot_ori_packing.bits);
+  speed = unpack_float<uint16_t>(speedPacked, snapshot_speed_packing.lo, snapshot_speed_packing.hi,
+                                 snapshot_speed_packing.bits);
+  thr = thrPacked / 127.f;
+  steer = steerPacked / 127.f;
+  if (packet->dataLength < size_t(ptr - packet->data) + snapshot_trace_size)
+    return false;
+  trace.seq = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  trace.clientTime = *(uint64_t*)(ptr); ptr += sizeof(uint64_t);
+  trace.tickWaitUs = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  trace.queueUs = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  trace.processUs = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  return true;
+}
+
+void deserialize_entity_cell(ENetPacket *packet, uint16_t &eid, SnapshotCell &cell, uint8_t &tag)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  cell.x = *(int16_t*)(ptr); ptr += sizeof(int16_t);
+  cell.y = *(int16_t*)(ptr); ptr += sizeof(int16_t);
+  tag = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
 }
 
 void deserialize_and_set_key(ENetPacket *packet)
@@ -178,3 +465,74 @@ void deserialize_and_set_key(ENetPacket *packet)
   xorCipherKey = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
 }
 
+
+bool deserialize_time_request(ENetPacket *packet, uint64_t &client_time)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint64_t))
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  client_time = *(uint64_t*)(ptr); ptr += sizeof(uint64_t);
+  return true;
+}
+
+void deserialize_time_response(ENetPacket *packet, uint64_t &client_time, uint64_t &server_receive, uint64_t &server_send,
+                               uint32_t &server_tick, uint64_t &server_tick_time)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  client_time = *(uint64_t*)(ptr); ptr += sizeof(uint64_t);
+  server_receive = *(uint64_t*)(ptr); ptr += sizeof(uint64_t);
+  server_send = *(uint64_t*)(ptr); ptr += sizeof(uint64_t);
+  server_tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  server_tick_time = *(uint64_t*)(ptr); ptr += sizeof(uint64_t);
+}
+
+bool deserialize_lockstep_input(ENetPacket *packet, uint16_t &eid, uint32_t &tick, int8_t &thr, int8_t &steer)
+{
+  if (packet->dataLength != sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(int8_t) * 2)
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  thr = *(int8_t*)(ptr); ptr += sizeof(int8_t);
+  steer = *(int8_t*)(ptr); ptr += sizeof(int8_t);
+  return true;
+}
+
+void deserialize_lockstep_state(ENetPacket *packet, LockstepWorld &world)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  world.tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint16_t count = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  world.entities.resize(count);
+  memcpy(world.entities.data(), ptr, count * sizeof(FixedEntity)); ptr += count * sizeof(FixedEntity);
+}
+
+void deserialize_lockstep_spawn(ENetPacket *packet, FixedEntity &ent)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  ent = *(FixedEntity*)(ptr); ptr += sizeof(FixedEntity);
+}
+
+void deserialize_lockstep_tick(ENetPacket *packet, uint32_t &tick, std::vector<LockstepInput> &inputs)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint16_t count = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  inputs.resize(count);
+  for (LockstepInput &input : inputs)
+  {
+    input.eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+    input.thr = *(int8_t*)(ptr); ptr += sizeof(int8_t);
+    input.steer = *(int8_t*)(ptr); ptr += sizeof(int8_t);
+  }
+}
+
+bool deserialize_state_hash(ENetPacket *packet, uint32_t &tick, uint32_t &hash)
+{
+  if (packet->dataLength != sizeof(uint8_t) + sizeof(uint32_t) * 2)
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  hash = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  return true;
+}
@@ -2,6 +2,8 @@
 #include <enet/enet.h>
 #include <cstdint>
 #include "entity.h"
+#include "mathUtils.h"
+#include "lockstep.h"
 
 enum MessageType : uint8_t
 {
@@ -10,23 +12,142 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_KEY
+  E_SERVER_TO_CLIENT_KEY,
+  E_CLIENT_TO_SERVER_TIME_REQUEST,
+  E_SERVER_TO_CLIENT_TIME_RESPONSE,
+  E_CLIENT_TO_SERVER_LOCKSTEP_INPUT,
+  E_SERVER_TO_CLIENT_LOCKSTEP_STATE,
+  E_SERVER_TO_CLIENT_LOCKSTEP_SPAWN,
+  E_SERVER_TO_CLIENT_LOCKSTEP_TICK,
+  E_CLIENT_TO_SERVER_STATE_HASH,
+  E_SERVER_TO_CLIENT_ENTITY_CELL,
+  E_SERVER_TO_CLIENT_ROOM
 };
+constexpr uint8_t message_type_count = E_SERVER_TO_CLIENT_ROOM + 1;
 
-void send_join(ENetPeer *peer);
+// Inputs are sent with the ones before them, so a lost packet is covered by the next.
+constexpr uint8_t max_redundant_inputs = 8;
+struct InputRecord
+{
+  uint16_t seq = 0;
+  float thr = 0.f;
+  float steer = 0.f;
+};
+
+// Latency tracing: a traced input carries the client's send time, and once the server
+// has applied it the next snapshot of that entity to its owner echoes it together with
+// how long the input spent in each stage on the server, in us.
+struct InputTrace
+{
+  uint16_t seq = 0;
+  uint64_t clientTime = 0;
+  uint32_t tickWaitUs = 0; // receive until the tick it could first be applied at
+  uint32_t queueUs = 0; // further ticks in the jitter buffer
+  uint32_t processUs = 0; // apply until the snapshot goes out
+};
+constexpr uint8_t input_traced_flag = 0x80; // in the input count
+
+// How send_snapshot quantizes the state: the range a value is clamped to and the bits kept of it.
+struct SnapshotPacking
+{
+  float lo;
+  float hi;
+  int bits;
+};
+// Positions are offsets into the world cell the entity is in, so the precision is the same
+// anywhere. The cell goes out reliably with send_entity_cell whenever it changes, and the
+// top bit of x and of y carry the low bits of how many times it did for this client: a
+// snapshot that overtakes its cell is told apart and dropped rather than put in the wrong one.
+constexpr float snapshot_cell_size = 64.f;
+constexpr uint16_t snapshot_cell_tag_mask = 3;
+constexpr SnapshotPacking snapshot_x_packing = {0.f, snapshot_cell_size, 15};
+constexpr SnapshotPacking snapshot_y_packing = {0.f, snapshot_cell_size, 15};
+constexpr SnapshotPacking snapshot_ori_packing = {-PI, PI, 8};
+constexpr SnapshotPacking snapshot_speed_packing = {min_speed, max_speed, 12};
+
+// A server with several rooms answers a join on its base port with send_room, the port of
+// the one asked for, and the client joins again there. A plain join byte means room 0.
+void send_join(ENetPeer *peer, uint16_t room = 0);
+void send_room(ENetPeer *peer, uint16_t room, uint16_t port);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_cipher_key(ENetPeer *peer, uint32_t key);
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// inputs are newest first with consecutive seqs, count up to max_redundant_inputs;
+// interp_delay is how far behind the newest snapshot the client renders, in 1/16 ticks;
+// a non zero trace_time traces the newest input
+void send_entity_input(ENetPeer *peer, uint16_t eid, uint8_t interp_delay, const InputRecord *inputs, uint8_t count,
+                       uint64_t trace_time = 0);
+// input_seq is the last input of the entity's owner the server has applied; thr and steer
+// let the client dead reckon the entity until the next one
+struct SnapshotCell
+{
+  int16_t x = 0;
+  int16_t y = 0;
+};
+// int16 cells reach 2000 km either way
+inline SnapshotCell snapshot_cell_of(float x, float y)
+{
+  return {int16_t(floorf(x * (1.f / snapshot_cell_size))), int16_t(floorf(y * (1.f / snapshot_cell_size)))};
+}
+
+void send_entity_cell(ENetPeer *peer, uint16_t eid, SnapshotCell cell, uint8_t tag);
+// x and y are world positions, they go out relative to snapshot_cell_of them.
+void send_snapshot(ENetPeer *peer, uint32_t tick, uint16_t eid, float x, float y, uint8_t cell_tag, float ori,
+                   float speed, float thr, float steer, uint16_t input_seq, const InputTrace *trace = nullptr);
+// The entity as a client decodes it from a snapshot, what both sides dead reckon from.
+Entity quantize_snapshot_entity(const Entity &e);
+// Clock sync exchange, times in us on the sender's own clock. The response echoes
+// client_time and says when the server got the request, when it answered, and
+// which tick it was at since when.
+void send_time_request(ENetPeer *peer, uint64_t client_time);
+void send_time_response(ENetPeer *peer, uint64_t client_time, uint64_t server_receive, uint64_t server_send,
+                        uint32_t server_tick, uint64_t server_tick_time);
+// Lockstep: the server collects everyone's input for a tick and sends the set to all,
+// state only goes out whole to someone joining, new cars are spawned between ticks.
+void send_lockstep_input(ENetPeer *peer, uint16_t eid, uint32_t tick, int8_t thr, int8_t steer);
+void send_lockstep_state(ENetPeer *peer, const LockstepWorld &world);
+void send_lockstep_spawn(ENetPeer *peer, const FixedEntity &ent);
+void send_lockstep_tick(ENetPeer *peer, uint32_t tick, const LockstepInput *inputs, uint16_t count);
+void send_state_hash(ENetPeer *peer, uint32_t tick, uint32_t hash);
 
 MessageType get_packet_type(ENetPacket *packet);
+// "unknown" past the last type, a fuzzed packet can carry anything there.
+const char *message_type_name(uint8_t type);
+
+// Called with every packet ENet accepted from the send_* functions, for counting or capturing.
+using PacketSendHook = void (*)(ENetPeer *peer, uint8_t channel, const ENetPacket *packet);
+void set_packet_send_hook(PacketSendHook hook);
+
+// Sequence numbers wrap around, a is newer if it is less than half the range ahead of b.
+inline bool seq_newer(uint16_t a, uint16_t b)
+{
+  return int16_t(a - b) > 0;
+}
 
+void deserialize_join(ENetPacket *packet, uint16_t &room);
+void deserialize_room(ENetPacket *packet, uint16_t &room, uint16_t &port);
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+// Returns the number of inputs written, 0 if the packet is malformed. trace_time is 0 if not traced.
+uint8_t deserialize_entity_input(ENetPacket *packet, uint16_t &eid, uint8_t &interp_delay, InputRecord *inputs,
+                                 uint64_t &trace_time);
+// Returns true if the snapshot echoes a trace.
+// x and y come out relative to the cell, the one whose tag matches cell_tag.
+bool deserialize_snapshot(ENetPacket *packet, uint32_t &tick, uint16_t &eid, float &x, float &y, uint8_t &cell_tag,
+                          float &ori, float &speed, float &thr, float &steer, uint16_t &input_seq, InputTrace &trace);
+void deserialize_entity_cell(ENetPacket *packet, uint16_t &eid, SnapshotCell &cell, uint8_t &tag);
 void deserialize_and_set_key(ENetPacket *packet);
+// Returns false if the packet is too short.
+bool deserialize_time_request(ENetPacket *packet, uint64_t &client_time);
+// Returns false if the packet isn't exactly the size send_lockstep_input makes.
+bool deserialize_lockstep_input(ENetPacket *packet, uint16_t &eid, uint32_t &tick, int8_t &thr, int8_t &steer);
+void deserialize_lockstep_state(ENetPacket *packet, LockstepWorld &world);
+void deserialize_lockstep_spawn(ENetPacket *packet, FixedEntity &ent);
+void deserialize_lockstep_tick(ENetPacket *packet, uint32_t &tick, std::vector<LockstepInput> &inputs);
+// Returns false if the packet isn't exactly the size send_state_hash makes.
+bool deserialize_state_hash(ENetPacket *packet, uint32_t &tick, uint32_t &hash);
+void deserialize_time_response(ENetPacket *packet, uint64_t &client_time, uint64_t &server_receive, uint64_t &server_send,
+                               uint32_t &server_tick, uint64_t &server_tick_time);
 
 void cipher_data(ENetPacket *packet);
 void decipher_data(ENetPacket *packet, ENetPeer *peer);
@@ -0,0 +1,108 @@
+#include "recording.h"
+#include <cstring>
+#include "log.h"
+
+static const char recording_magic[4] = {'W', '1', '0', 'R'};
+constexpr size_t snapshot_source_size = sizeof(uint16_t) + 4 * sizeof(float);
+
+FILE *recording_create(const char *path, bool lockstep)
+{
+  FILE *f = fopen(path, "wb");
+  if (!f)
+  {
+    LOG_ERROR("Cannot open %s\n", path);
+    return nullptr;
+  }
+  uint8_t header[sizeof(recording_magic) + sizeof(uint16_t) + sizeof(uint8_t)];
+  uint8_t *ptr = header;
+  memcpy(ptr, recording_magic, sizeof(recording_magic)); ptr += sizeof(recording_magic);
+  memcpy(ptr, &recording_version, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  *ptr = lockstep ? 1 : 0;
+  fwrite(header, sizeof(header), 1, f);
+  return f;
+}
+
+void recording_write(FILE *f, uint32_t tick, RecordKind kind, uint8_t peer, const uint8_t *data, size_t size)
+{
+  if (size > UINT16_MAX)
+  {
+    LOG_WARNING("Not recording a %u byte event\n", uint32_t(size));
+    return;
+  }
+  uint16_t size16 = uint16_t(size);
+  uint8_t header[sizeof(uint32_t) + 2 * sizeof(uint8_t) + sizeof(uint16_t)];
+  uint8_t *ptr = header;
+  memcpy(ptr, &tick, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  *ptr = kind; ptr += sizeof(uint8_t);
+  *ptr = peer; ptr += sizeof(uint8_t);
+  memcpy(ptr, &size16, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  fwrite(header, sizeof(header), 1, f);
+  if (size > 0)
+    fwrite(data, size, 1, f);
+}
+
+void recording_write_snapshot_source(FILE *f, uint32_t tick, uint16_t eid, float x, float y, float ori, float speed)
+{
+  uint8_t data[snapshot_source_size];
+  uint8_t *ptr = data;
+  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &x, sizeof(float)); ptr += sizeof(float);
+  memcpy(ptr, &y, sizeof(float)); ptr += sizeof(float);
+  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
+  memcpy(ptr, &speed, sizeof(float)); ptr += sizeof(float);
+  recording_write(f, tick, E_RECORD_SNAPSHOT_SOURCE, 0, data, sizeof(data));
+}
+
+FILE *recording_open(const char *path, bool &lockstep)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    LOG_ERROR("Cannot open %s\n", path);
+    return nullptr;
+  }
+  uint8_t header[sizeof(recording_magic) + sizeof(uint16_t) + sizeof(uint8_t)];
+  if (fread(header, sizeof(header), 1, f) != 1 || memcmp(header, recording_magic, sizeof(recording_magic)) != 0)
+  {
+    LOG_ERROR("%s is not a recording\n", path);
+    fclose(f);
+    return nullptr;
+  }
+  uint8_t *ptr = header; ptr += sizeof(recording_magic);
+  uint16_t version = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  if (version == 0 || version > recording_version)
+  {
+    LOG_ERROR("%s is version %u, only up to %u is known\n", path, version, recording_version);
+    fclose(f);
+    return nullptr;
+  }
+  lockstep = *ptr != 0;
+  return f;
+}
+
+bool recording_read(FILE *f, RecordEvent &event)
+{
+  uint8_t header[sizeof(uint32_t) + 2 * sizeof(uint8_t) + sizeof(uint16_t)];
+  if (fread(header, sizeof(header), 1, f) != 1)
+    return false;
+  uint8_t *ptr = header;
+  event.tick = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  event.kind = (RecordKind)*ptr; ptr += sizeof(uint8_t);
+  event.peer = *ptr; ptr += sizeof(uint8_t);
+  uint16_t size = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  event.data.resize(size);
+  return size == 0 || fread(event.data.data(), size, 1, f) == 1;
+}
+
+bool recording_read_snapshot_source(const RecordEvent &event, uint16_t &eid, float &x, float &y, float &ori, float &speed)
+{
+  if (event.kind != E_RECORD_SNAPSHOT_SOURCE || event.data.size() < snapshot_source_size)
+    return false;
+  const uint8_t *ptr = event.data.data();
+  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  x = *(float*)(ptr); ptr += sizeof(float);
+  y = *(float*)(ptr); ptr += sizeof(float);
+  ori = *(float*)(ptr); ptr += sizeof(float);
+  speed = *(float*)(ptr); ptr += sizeof(float);
+  return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Server traffic recording: what ENet handed the server and at which tick, so a replay
+// can push the same events through the same handlers. A capture also has what the server
+// sent and the unquantized state behind each snapshot, for traffic_analyzer.
+// Little endian, append only:
+//   header: "W10R", u16 version, u8 lockstep
+//   event:  u32 tick, u8 kind, u8 peer index, u16 size, size bytes
+constexpr uint16_t recording_version = 2; // 1 had no capture events
+
+enum RecordKind : uint8_t
+{
+  E_RECORD_CONNECT = 0,
+  E_RECORD_DISCONNECT,
+  E_RECORD_RECEIVE, // packet as it arrived, still ciphered
+  E_RECORD_CIPHER_KEY, // the key on_join made up, u32, replays can't draw the same one
+  E_RECORD_SENT, // packet as it left, after cipher_data
+  E_RECORD_SNAPSHOT_SOURCE // what a snapshot of this tick was made from: u16 eid, f32 x, y, ori, speed
+};
+
+struct RecordEvent
+{
+  uint32_t tick = 0;
+  RecordKind kind = E_RECORD_CONNECT;
+  uint8_t peer = 0;
+  std::vector<uint8_t> data;
+};
+
+FILE *recording_create(const char *path, bool lockstep);
+void recording_write(FILE *f, uint32_t tick, RecordKind kind, uint8_t peer, const uint8_t *data = nullptr, size_t size = 0);
+
+void recording_write_snapshot_source(FILE *f, uint32_t tick, uint16_t eid, float x, float y, float ori, float speed);
+
+FILE *recording_open(const char *path, bool &lockstep);
+// False at the end of the file or at a truncated event, as the last one of a crashed server would be.
+bool recording_read(FILE *f, RecordEvent &event);
+bool recording_read_snapshot_source(const RecordEvent &event, uint16_t &eid, float &x, float &y, float &ori, float &speed);
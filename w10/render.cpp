@@ -0,0 +1,215 @@
+#include "render.h"
+#include <cstdio>
+#include <math.h>
+#include <debugdraw/debugdraw.h>
+#include "log.h"
+
+// Shader binaries are built from w10/shaders, e.g. for OpenGL:
+// shaderc -f vs_cars.sc -o shaders/glsl/vs_cars.bin --type v --platform linux -p 120 -i <bgfx>/src
+static bgfx::ProgramHandle program = BGFX_INVALID_HANDLE;
+static bgfx::VertexBufferHandle carVb = BGFX_INVALID_HANDLE;
+static bgfx::IndexBufferHandle carIb = BGFX_INVALID_HANDLE;
+static bool debugDraw = false; // no shader binaries or no instancing, one capsule per car then
+
+// Same capsule the debug draw used: two half circles of radius 1 at x = -1 and x = 1.
+constexpr int car_arc_segments = 8;
+constexpr float car_radius = 2.f; // bounding circle for culling
+constexpr uint16_t instance_stride = 2 * 4 * sizeof(float);
+
+static bgfx::ShaderHandle load_shader(const char *name)
+{
+  const char *dir = nullptr;
+  switch (bgfx::getRendererType())
+  {
+  case bgfx::RendererType::Direct3D11:
+  case bgfx::RendererType::Direct3D12: dir = "dx11"; break;
+  case bgfx::RendererType::OpenGL: dir = "glsl"; break;
+  case bgfx::RendererType::OpenGLES: dir = "essl"; break;
+  case bgfx::RendererType::Vulkan: dir = "spirv"; break;
+  case bgfx::RendererType::Metal: dir = "metal"; break;
+  default:
+    LOG_ERROR("No shaders for renderer %s\n", bgfx::getRendererName(bgfx::getRendererType()));
+    return BGFX_INVALID_HANDLE;
+  }
+
+  char path[256];
+  snprintf(path, sizeof(path), "shaders/%s/%s.bin", dir, name);
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    LOG_ERROR("Cannot open shader %s\n", path);
+    return BGFX_INVALID_HANDLE;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  const bgfx::Memory *mem = bgfx::alloc(uint32_t(size + 1));
+  size_t read = fread(mem->data, 1, size_t(size), f);
+  fclose(f);
+  if (read != size_t(size))
+  {
+    LOG_ERROR("Cannot read shader %s\n", path);
+    return BGFX_INVALID_HANDLE;
+  }
+  mem->data[size] = '\0';
+  return bgfx::createShader(mem);
+}
+
+static void create_car_mesh()
+{
+  // fan around the center: vertex 0 is the center, then the outline
+  std::vector<float> vertices = {0.f, 0.f};
+  for (int side = 0; side < 2; ++side)
+  {
+    float cx = side == 0 ? 1.f : -1.f;
+    float start = side == 0 ? -0.5f * bx::kPi : 0.5f * bx::kPi;
+    for (int i = 0; i <= car_arc_segments; ++i)
+    {
+      float a = start + bx::kPi * i / car_arc_segments;
+      vertices.push_back(cx + cosf(a));
+      vertices.push_back(sinf(a));
+    }
+  }
+  uint16_t outline = uint16_t(vertices.size() / 2 - 1);
+  std::vector<uint16_t> indices;
+  for (uint16_t i = 0; i < outline; ++i)
+  {
+    indices.push_back(0);
+    indices.push_back(1 + i);
+    indices.push_back(1 + (i + 1) % outline);
+  }
+
+  bgfx::VertexLayout layout;
+  layout.begin()
+    .add(bgfx::Attrib::Position, 2, bgfx::AttribType::Float)
+    .end();
+  carVb = bgfx::createVertexBuffer(bgfx::copy(vertices.data(), uint32_t(vertices.size() * sizeof(float))), layout);
+  carIb = bgfx::createIndexBuffer(bgfx::copy(indices.data(), uint32_t(indices.size() * sizeof(uint16_t))));
+}
+
+bool render_init()
+{
+  if (bgfx::getRendererType() == bgfx::RendererType::Noop)
+  {
+    // headless: no shaders to load, everything but the draw itself still runs
+    create_car_mesh();
+    return true;
+  }
+  bgfx::ShaderHandle vsh = BGFX_INVALID_HANDLE;
+  bgfx::ShaderHandle fsh = BGFX_INVALID_HANDLE;
+  if (!(bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING))
+    LOG_ERROR("Instancing is not supported by the renderer\n");
+  else
+  {
+    vsh = load_shader("vs_cars");
+    fsh = load_shader("fs_cars");
+  }
+  if (!bgfx::isValid(vsh) || !bgfx::isValid(fsh))
+  {
+    if (bgfx::isValid(vsh))
+      bgfx::destroy(vsh);
+    if (bgfx::isValid(fsh))
+      bgfx::destroy(fsh);
+    LOG_WARNING("Drawing cars one by one with debug draw\n");
+    ddInit();
+    debugDraw = true;
+    return true;
+  }
+  program = bgfx::createProgram(vsh, fsh, true);
+  create_car_mesh();
+  return true;
+}
+
+void render_shutdown()
+{
+  if (debugDraw)
+    ddShutdown();
+  debugDraw = false;
+  if (bgfx::isValid(program))
+    bgfx::destroy(program);
+  if (bgfx::isValid(carVb))
+    bgfx::destroy(carVb);
+  if (bgfx::isValid(carIb))
+    bgfx::destroy(carIb);
+  program = BGFX_INVALID_HANDLE;
+  carVb = BGFX_INVALID_HANDLE;
+  carIb = BGFX_INVALID_HANDLE;
+}
+
+// What the client drew before instancing, for when render_init found no shaders.
+static uint32_t draw_debug(bgfx::ViewId view, const std::vector<Entity> &entities, const bx::Vec3 &eye, float half_w,
+                           float half_h)
+{
+  DebugDrawEncoder dde;
+  dde.begin(view);
+  uint32_t visible = 0;
+  for (const Entity &e : entities)
+  {
+    if (fabsf(e.x - eye.x) > half_w || fabsf(e.y - eye.y) > half_h)
+      continue;
+    dde.push();
+    dde.setColor(e.color);
+    bx::Vec3 dir = {cosf(e.ori), sinf(e.ori), 0.f};
+    bx::Vec3 pos = {e.x, e.y, -0.01f};
+    dde.drawCapsule(bx::sub(pos, dir), bx::add(pos, dir), 1.f);
+    dde.pop();
+    visible++;
+  }
+  dde.end();
+  return visible;
+}
+
+uint32_t render_entities(bgfx::ViewId view, const std::vector<Entity> &entities, const bx::Vec3 &eye, float fovy, float aspect)
+{
+  if (entities.empty() || (!debugDraw && !bgfx::isValid(carVb)))
+    return 0;
+
+  // visible rectangle of the z = 0 plane, grown by the car size
+  float halfH = fabsf(eye.z) * tanf(bx::toRad(fovy) * 0.5f) + car_radius;
+  float halfW = (halfH - car_radius) * aspect + car_radius;
+  if (debugDraw)
+    return draw_debug(view, entities, eye, halfW, halfH);
+
+  uint32_t count = bgfx::getAvailInstanceDataBuffer(uint32_t(entities.size()), instance_stride);
+  if (count < entities.size())
+  {
+    static bool warned = false;
+    if (!warned)
+      LOG_WARNING("Instance buffer fits %u of %zu entities\n", count, entities.size());
+    warned = true;
+  }
+  if (count == 0)
+    return 0;
+
+  bgfx::InstanceDataBuffer idb;
+  bgfx::allocInstanceDataBuffer(&idb, count, instance_stride);
+  float *data = (float*)idb.data;
+  uint32_t visible = 0;
+  for (size_t i = 0; i < entities.size() && visible < count; ++i)
+  {
+    const Entity &e = entities[i];
+    if (fabsf(e.x - eye.x) > halfW || fabsf(e.y - eye.y) > halfH)
+      continue;
+    data[0] = e.x;
+    data[1] = e.y;
+    data[2] = cosf(e.ori);
+    data[3] = sinf(e.ori);
+    // abgr, as dde.setColor took it
+    data[4] = float(e.color & 0xff) * (1.f / 255.f);
+    data[5] = float((e.color >> 8) & 0xff) * (1.f / 255.f);
+    data[6] = float((e.color >> 16) & 0xff) * (1.f / 255.f);
+    data[7] = float(e.color >> 24) * (1.f / 255.f);
+    data += 8;
+    visible++;
+  }
+  if (visible == 0)
+    return 0;
+
+  bgfx::setVertexBuffer(0, carVb);
+  bgfx::setIndexBuffer(carIb);
+  bgfx::setInstanceDataBuffer(&idb, 0, visible);
+  bgfx::setState(BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | BGFX_STATE_MSAA);
+  // invalid program in headless mode, bgfx drops the draw
+  bgfx::submit(view, program);
+  return visible;
+}
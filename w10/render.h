@@ -0,0 +1,16 @@
+#pragma once
+#include <bgfx/bgfx.h>
+#include <bx/math.h>
+#include <cstdint>
+#include <vector>
+#include "entity.h"
+
+// Needs shaders/<renderer>/vs_cars.bin and fs_cars.bin next to the executable, compile them from w10/shaders with shaderc.
+// Without them, or without instancing, cars are drawn one by one through debug draw instead.
+bool render_init();
+void render_shutdown();
+
+// Draws all entities in view with a single instanced submit. The camera looks along +z at the
+// z = 0 plane from eye with vertical fov in degrees, entities outside of what it sees are culled.
+// Returns the number of drawn entities.
+uint32_t render_entities(bgfx::ViewId view, const std::vector<Entity> &entities, const bx::Vec3 &eye, float fovy, float aspect);
@@ -2,26 +2,262 @@
 #include <iostream>
 #include "entity.h"
 #include "protocol.h"
+#include "log.h"
 #include "mathUtils.h"
+#include "timeUtils.h"
+#include "world_history.h"
+#include "collision.h"
+#include "profiler.h"
+#include "metrics.h"
+#include "recording.h"
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <map>
+#include <memory>
 #include <random>
+#include <thread>
+#include <algorithm>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+// Entities at rest fall asleep: they are not simulated and only their driver gets snapshots
+// of them until an input or a contact wakes them. Only the awake ones are listed in
+// activeEntities, so a mostly parked world costs what its moving part and its drivers do. entities itself stays append only, the
+// world history relies on that.
+constexpr uint32_t sleep_ticks = 30; // at rest this long before falling asleep
+constexpr uint32_t asleep = uint32_t(-1);
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+// Inputs of one client waiting for their tick. One is applied per tick, so jitter in
+// arrival doesn't turn into jitter in movement; the buffer deepens by one every time
+// it runs dry and is trimmed back if it holds more than max_buffered_inputs.
+constexpr uint16_t input_buffer_size = 32; // divides the seq range
+constexpr uint16_t max_buffered_inputs = 6; // 100 ms at sim_tick_rate
+struct InputBuffer
 {
+  InputRecord inputs[input_buffer_size];
+  bool received[input_buffer_size] = {};
+  uint16_t lastSeq = 0; // last applied
+  uint16_t newestSeq = 0; // newest received
+  InputRecord current; // repeated while starved
+  uint8_t interpDelay = 0;
+  bool started = false;
+  uint32_t starvedStreak = 0;
+  ENetPeer *peer = nullptr;
+  // counters
+  uint32_t applied = 0;
+  uint32_t duplicates = 0; // redundant copies of inputs already buffered or applied
+  uint32_t late = 0; // arrived after their tick was skipped
+  uint32_t lost = 0; // never arrived in any packet
+  uint32_t starved = 0; // ticks without an input to apply
+  uint32_t trimmed = 0; // dropped to keep the buffer short
+  // latency tracing, clientTime is 0 for untraced inputs
+  struct TraceStamp
+  {
+    uint64_t clientTime = 0;
+    uint64_t receiveTime = 0;
+    uint64_t tickDue = 0; // start of the first tick after receiveTime
+  };
+  TraceStamp traces[input_buffer_size];
+  InputTrace pendingTrace; // applied, waiting for the next snapshot
+  uint64_t pendingApplyTime = 0;
+  bool hasPendingTrace = false;
+};
+
+constexpr size_t max_peers = 32; // per room
+static FILE *recordFile = nullptr; // --record or --capture
+static bool captureSent = false; // --capture, sent packets and snapshot sources as well
+constexpr float contact_distance = 2.f; // between car centers
+// --lag-contacts: also look for contacts where each driver saw the others when steering,
+// counted in w10_lag_compensated_contacts_total. Off by default, the world history is
+// only recorded for it.
+static bool lagContacts = false;
+static uint32_t collisionThreads = 1; // per room
+
+// Dead reckoning: clients extrapolate remote entities from their last snapshot, the server
+// runs the same extrapolation for every client and only sends an entity again once that is
+// off by more than reckonError or reckonMaxAge ticks have passed. The own entity always
+// goes out, its snapshots ack inputs and keep the client's clock going.
+struct ReckonedEntity
+{
+  Entity view; // where the client has it now, as far as the server can tell
+  uint32_t sentTick = 0;
+};
+struct PeerReckoning
+{
+  std::map<uint16_t, ReckonedEntity> entities;
+  uint32_t sent = 0;
+  uint32_t suppressed = 0;
+};
+static float reckonError = 0.05f; // m, 0 sends every entity every tick
+static uint32_t reckonMaxAge = 30; // ticks
+
+// The world cell each client has for each entity, snapshots are relative to it. It starts
+// where the entity was when send_new_entity went out, the client takes it from there too.
+struct SentCell
+{
+  SnapshotCell cell;
+  uint8_t tag = 0;
+};
+
+// Lockstep mode: everyone runs the fixed point simulation, the server only decides which
+// input goes into which tick and checks the state hashes the clients report.
+static bool lockstep = false;
+constexpr uint32_t lockstep_window = 64; // ticks ahead an input may be sent for, and hashes kept
+struct LockstepPlayer
+{
+  struct Slot
+  {
+    uint32_t tick = 0;
+    int8_t thr = 0;
+    int8_t steer = 0;
+  };
+  Slot slots[lockstep_window];
+  LockstepInput last; // repeated if the input for a tick didn't make it in time
+  ENetPeer *peer = nullptr;
+  uint32_t missed = 0;
+  uint32_t desyncs = 0;
+};
+
+struct PeerMetrics
+{
+  MetricGauge *rttMs = nullptr;
+  MetricGauge *rttVarianceMs = nullptr;
+  MetricGauge *loss = nullptr;
+  MetricGauge *throttle = nullptr;
+};
+
+struct ServerMetrics
+{
+  // by message type, the last one for types that don't exist
+  MetricCounter *packetsIn[message_type_count + 1] = {};
+  MetricCounter *bytesIn[message_type_count + 1] = {};
+  MetricCounter *packetsOut[message_type_count + 1] = {};
+  MetricCounter *bytesOut[message_type_count + 1] = {};
+  MetricCounter *snapshotsSent = nullptr;
+  MetricCounter *snapshotsSuppressed = nullptr;
+  MetricCounter *lagContacts = nullptr;
+};
+static ServerMetrics serverMetrics;
+
+// What --metrics exports about one room, labelled with its id.
+struct RoomMetrics
+{
+  MetricHistogram *tickUs = nullptr;
+  MetricGauge *entities = nullptr;
+  MetricGauge *activeEntities = nullptr;
+  MetricGauge *peers = nullptr;
+};
+
+// A world of its own with its own ENet host, ticked on its own thread when there are several.
+// Rooms share nothing but the settings above and the process wide counters, so a long tick
+// in one never holds up another.
+struct Room
+{
+  uint16_t id = 0;
+  ENetHost *host = nullptr;
+  std::thread thread;
+
+  std::vector<Entity> entities;
+  std::map<uint16_t, uint32_t> entityIndex; // eid -> index into entities
+  std::map<uint16_t, ENetPeer*> controlledMap;
+  std::vector<uint32_t> activeEntities; // indices into entities
+  std::vector<uint32_t> activeSlot; // per entity, its place in activeEntities or asleep
+  std::vector<uint32_t> restTicks; // per entity
+  std::vector<uint32_t> fallingAsleep; // reused every tick
+
+  // Cars push each other apart after everyone moved. Only the awake ones are rehashed and
+  // queried, a sleeping car is found when an awake one runs into it, and woken.
+  SpatialHash spatialHash;
+  std::vector<Contact> contacts; // reused every tick
+
+  std::map<uint16_t, InputBuffer> inputBuffers; // by controlled eid
+  WorldHistory worldHistory; // --lag-contacts only
+  std::vector<uint32_t> nearby; // reused by every input
+  uint32_t serverTick = 0;
+  uint64_t serverTickTime = 0; // us, when serverTick started
+  std::map<ENetPeer*, PeerReckoning> peerReckoning;
+  std::map<ENetPeer*, std::map<uint16_t, SentCell>> peerCells;
+
+  LockstepWorld lockstepWorld;
+  std::map<uint16_t, LockstepPlayer> lockstepPlayers; // by controlled eid
+  uint32_t lockstepHashTicks[lockstep_window] = {};
+  uint32_t lockstepHashes[lockstep_window] = {};
+  std::vector<LockstepInput> lockstepInputs; // reused every tick
+
+  RoomMetrics metrics;
+  std::map<ENetPeer*, PeerMetrics> peerMetrics;
+};
+static std::vector<std::unique_ptr<Room>> rooms;
+
+static bool at_rest(const Entity &e)
+{
+  return e.thr == 0.f && e.steer == 0.f && e.speed == 0.f;
+}
+
+static void wake_entity(Room &room, uint32_t index)
+{
+  room.restTicks[index] = 0;
+  if (room.activeSlot[index] != asleep)
+    return;
+  room.activeSlot[index] = uint32_t(room.activeEntities.size());
+  room.activeEntities.push_back(index);
+}
+
+static void sleep_entity(Room &room, uint32_t index)
+{
+  uint32_t slot = room.activeSlot[index];
+  if (slot == asleep)
+    return;
+  uint32_t last = room.activeEntities.back();
+  room.activeEntities[slot] = last;
+  room.activeSlot[last] = slot;
+  room.activeEntities.pop_back();
+  room.activeSlot[index] = asleep;
+}
+
+static void add_entity(Room &room, const Entity &ent)
+{
+  uint32_t index = uint32_t(room.entities.size());
+  room.entities.push_back(ent);
+  room.entityIndex[ent.eid] = index;
+  room.activeSlot.push_back(asleep);
+  room.restTicks.push_back(0);
+  wake_entity(room, index);
+  spatial_hash_update(room.spatialHash, index, ent.x, ent.y);
+}
+
+static void send_entity(Room &room, ENetPeer *peer, const Entity &ent)
+{
+  send_new_entity(peer, ent);
+  if (peer->state == ENET_PEER_STATE_CONNECTED)
+    room.peerCells[peer][ent.eid] = {snapshot_cell_of(ent.x, ent.y), 0};
+}
+
+// Tag of the cell e is in, sending it to the client first if it has another one.
+static uint8_t sync_cell(Room &room, ENetPeer *peer, const Entity &e)
+{
+  SnapshotCell cell = snapshot_cell_of(e.x, e.y);
+  auto [it, added] = room.peerCells[peer].try_emplace(e.eid);
+  SentCell &sent = it->second;
+  if (added || sent.cell.x != cell.x || sent.cell.y != cell.y)
+  {
+    if (!added)
+      sent.tag++;
+    sent.cell = cell;
+    send_entity_cell(peer, e.eid, cell, sent.tag);
+  }
+  return sent.tag & snapshot_cell_tag_mask;
+}
+
+// Whatever room the join asks for, the port it came in on already picked this one.
+void on_join(Room &room, ENetPacket *packet, ENetPeer *peer)
+{
+  PROFILE_SCOPE("on_join");
   // send all entities
-  for (const Entity &ent : entities)
-    send_new_entity(peer, ent);
-
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+  if (!lockstep)
+    for (const Entity &ent : room.entities)
+      send_entity(room, peer, ent);
+
+  uint16_t newEid = room.entityIndex.empty() ? 0 : room.entityIndex.rbegin()->first + 1;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
@@ -29,14 +265,35 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   float x = (rand() % 4) * 2.f;
   float y = (rand() % 4) * 2.f;
   Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
-
-  controlledMap[newEid] = peer;
+  // not into another car, further out while the spots nearby are taken
+  for (int spread = 4; spread < 64 && collision_overlaps(room.spatialHash, room.entities, ent); spread += 2)
+  {
+    ent.x = (rand() % spread) * 2.f;
+    ent.y = (rand() % spread) * 2.f;
+  }
+  add_entity(room, ent);
 
+  room.controlledMap[newEid] = peer;
 
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  if (lockstep)
+  {
+    // between two ticks for everyone: the others spawn it, the new one gets it with the rest
+    FixedEntity fixedEnt = fixed_entity_from(ent);
+    room.lockstepWorld.entities.push_back(fixedEnt);
+    for (const auto &[eid, player] : room.lockstepPlayers)
+      send_lockstep_spawn(player.peer, fixedEnt);
+    send_lockstep_state(peer, room.lockstepWorld);
+    LockstepPlayer &player = room.lockstepPlayers[newEid];
+    player.peer = peer;
+    player.last.eid = newEid;
+  }
+  else
+  {
+    room.inputBuffers[newEid].peer = peer;
+    // send info about new entity to everyone
+    for (size_t i = 0; i < room.host->peerCount; ++i)
+      send_entity(room, &room.host->peers[i], ent);
+  }
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
   uint32_t *keyPtr = (uint32_t*)peer->data;
@@ -47,97 +304,842 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   send_cipher_key(peer, *keyPtr);
 }
 
-void on_input(ENetPacket *packet)
+void on_input(Room &room, ENetPacket *packet, ENetPeer *peer, uint64_t receive_time, uint64_t next_tick)
 {
+  PROFILE_SCOPE("on_input");
   uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  uint8_t interpDelay = 0;
+  InputRecord inputs[max_redundant_inputs];
+  uint64_t traceTime = 0;
+  uint8_t count = deserialize_entity_input(packet, eid, interpDelay, inputs, traceTime);
+  auto owner = room.controlledMap.find(eid);
+  if (count == 0 || owner == room.controlledMap.end() || owner->second != peer)
+    return;
+  auto it = room.inputBuffers.find(eid);
+  if (it == room.inputBuffers.end())
+    return; // on_join makes it, lockstep players have none
+  InputBuffer &buffer = it->second;
+  // oldest first, so newestSeq only moves over what was really received
+  for (int i = count - 1; i >= 0; --i)
+  {
+    const InputRecord &input = inputs[i];
+    if (!(fabsf(input.thr) <= 1.f && fabsf(input.steer) <= 1.f))
+      return; // corrupted, don't trust the rest either
+    if (!seq_newer(input.seq, buffer.lastSeq))
+    {
+      // the first of a packet is new to it, the rest were sent before
+      if (i == 0)
+        buffer.late++;
+      else
+        buffer.duplicates++;
+      continue;
+    }
+    if (uint16_t(input.seq - buffer.lastSeq) > input_buffer_size)
     {
-      e.thr = thr;
-      e.steer = steer;
+      // too far ahead to be genuine, unless the client has been cut off for a while
+      if (buffer.starvedStreak < input_buffer_size)
+        return;
+      buffer.lastSeq = input.seq - 1;
+      buffer.newestSeq = buffer.lastSeq;
+      for (bool &received : buffer.received)
+        received = false;
+      buffer.starvedStreak = 0;
     }
+    uint16_t slot = input.seq % input_buffer_size;
+    if (buffer.received[slot])
+    {
+      buffer.duplicates++;
+      continue;
+    }
+    buffer.inputs[slot] = input;
+    buffer.received[slot] = true;
+    // the send time is that of the newest input, the others went out earlier
+    buffer.traces[slot] = {i == 0 ? traceTime : 0, receive_time, next_tick};
+    if (!buffer.started || seq_newer(input.seq, buffer.newestSeq))
+      buffer.newestSeq = input.seq;
+    buffer.started = true;
+  }
+  buffer.interpDelay = interpDelay;
 }
 
-int main(int argc, const char **argv)
+// Takes the next input off the buffer, or repeats the last one if there is none yet.
+// Returns false if the client hasn't sent anything at all.
+static bool next_input(InputBuffer &buffer, InputRecord &input)
 {
-  if (enet_initialize() != 0)
+  if (!buffer.started)
+    return false;
+  // keep the delay bounded, the client has sent more than a burst ahead
+  while (uint16_t(buffer.newestSeq - buffer.lastSeq) > max_buffered_inputs)
   {
-    printf("Cannot init ENet");
-    return 1;
+    buffer.lastSeq++;
+    uint16_t slot = buffer.lastSeq % input_buffer_size;
+    if (buffer.received[slot])
+      buffer.current = buffer.inputs[slot];
+    buffer.received[slot] = false;
+    buffer.trimmed++;
   }
-  ENetAddress address;
+  if (!seq_newer(buffer.newestSeq, buffer.lastSeq))
+  {
+    buffer.starved++;
+    buffer.starvedStreak++;
+    input = buffer.current;
+    return true;
+  }
+  // everything up to newestSeq came with it unless it was lost in more than
+  // max_redundant_inputs packets in a row, skip such holes right away
+  uint16_t seq = buffer.lastSeq + 1;
+  while (!buffer.received[seq % input_buffer_size])
+  {
+    buffer.lost++;
+    seq++;
+  }
+  const InputBuffer::TraceStamp &stamp = buffer.traces[seq % input_buffer_size];
+  if (stamp.clientTime)
+  {
+    uint64_t now = get_time_us();
+    uint64_t tickWait = stamp.tickDue > stamp.receiveTime ? stamp.tickDue - stamp.receiveTime : 0;
+    uint64_t held = now - stamp.receiveTime;
+    buffer.pendingTrace = {seq, stamp.clientTime, uint32_t(tickWait), uint32_t(held > tickWait ? held - tickWait : 0), 0};
+    buffer.pendingApplyTime = now;
+    buffer.hasPendingTrace = true;
+  }
+  buffer.received[seq % input_buffer_size] = false;
+  buffer.current = buffer.inputs[seq % input_buffer_size];
+  buffer.lastSeq = seq;
+  buffer.applied++;
+  buffer.starvedStreak = 0;
+  input = buffer.current;
+  return true;
+}
 
-  address.host = ENET_HOST_ANY;
-  address.port = 10131;
+static void apply_input(Room &room, uint16_t eid, InputBuffer &buffer)
+{
+  PROFILE_SCOPE("apply_input");
+  InputRecord input;
+  if (!next_input(buffer, input))
+    return;
+  auto index = room.entityIndex.find(eid);
+  if (index == room.entityIndex.end())
+    return;
+  Entity *moved = &room.entities[index->second];
+  if (room.activeSlot[index->second] == asleep)
+  {
+    // parked and told to stay so, nothing to simulate
+    if (input.thr == 0.f && input.steer == 0.f)
+      return;
+    wake_entity(room, index->second);
+  }
+  // the client predicts with exactly this step, so every input moves the car by fixed_dt
+  moved->thr = input.thr;
+  moved->steer = input.steer;
+  {
+    PROFILE_SCOPE("simulate_entity");
+    simulate_entity(*moved, fixed_dt);
+  }
+  if (!lagContacts || at_rest(*moved))
+    return; // doesn't run into anything
+
+  // check contacts against the neighbours where this client saw them: the input took half
+  // a round trip to get here and the snapshots it was looking at another half, and the
+  // client draws them interpDelay behind the newest one
+  double latencyTicks = buffer.peer->roundTripTime * 1e-3 * sim_tick_rate;
+  double seenTick = double(room.serverTick) - latencyTicks - buffer.interpDelay / 16.0;
+  PROFILE_SCOPE("contact_check");
+  float x = moved->x;
+  float y = moved->y;
+  room.nearby.clear();
+  spatial_hash_near(room.spatialHash, x, y, room.nearby);
+  room.nearby.erase(std::remove(room.nearby.begin(), room.nearby.end(), index->second), room.nearby.end());
+  world_history_rewind(room.worldHistory, room.entities, seenTick, room.nearby);
+  for (uint32_t i : room.nearby)
+  {
+    const Entity &e = room.entities[i];
+    float dx = e.x - x;
+    float dy = e.y - y;
+    if (dx * dx + dy * dy < contact_distance * contact_distance)
+    {
+      metric_add(serverMetrics.lagContacts);
+      LOG_DEBUG("contact %u with %u at tick %.2f\n", eid, e.eid, seenTick);
+    }
+  }
+  world_history_restore(room.worldHistory, room.entities);
+}
+
+static void on_time_request(Room &room, ENetPacket *packet, ENetPeer *peer, uint64_t receive_time)
+{
+  uint64_t clientTime = 0;
+  if (!deserialize_time_request(packet, clientTime))
+    return;
+  send_time_response(peer, clientTime, receive_time, get_time_us(), room.serverTick, room.serverTickTime);
+}
+
+static void on_lockstep_input(Room &room, ENetPacket *packet, ENetPeer *peer)
+{
+  uint16_t eid = invalid_entity;
+  uint32_t tick = 0;
+  int8_t thr = 0; int8_t steer = 0;
+  if (!deserialize_lockstep_input(packet, eid, tick, thr, steer))
+    return;
+  auto player = room.lockstepPlayers.find(eid);
+  if (player == room.lockstepPlayers.end() || player->second.peer != peer)
+    return;
+  // only ticks still to come, and not so far ahead they'd overwrite one
+  if (tick <= room.lockstepWorld.tick || tick > room.lockstepWorld.tick + lockstep_window)
+    return;
+  player->second.slots[tick % lockstep_window] = {tick, thr, steer};
+}
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+static void on_state_hash(Room &room, ENetPacket *packet, ENetPeer *peer)
+{
+  uint32_t tick = 0; uint32_t hash = 0;
+  if (!deserialize_state_hash(packet, tick, hash))
+    return;
+  if (room.lockstepHashTicks[tick % lockstep_window] != tick || room.lockstepHashes[tick % lockstep_window] == hash)
+    return;
+  for (auto &[eid, player] : room.lockstepPlayers)
+    if (player.peer == peer)
+    {
+      player.desyncs++;
+      LOG_ERROR("%u desynced at tick %u: %08x, server has %08x\n", eid, tick, hash,
+                room.lockstepHashes[tick % lockstep_window]);
+    }
+}
 
-  if (!server)
+static void lockstep_tick(Room &room)
+{
+  PROFILE_SCOPE("lockstep_tick");
+  uint32_t tick = room.lockstepWorld.tick + 1;
+  std::vector<LockstepInput> &inputs = room.lockstepInputs;
+  inputs.clear();
+  for (auto &[eid, player] : room.lockstepPlayers)
   {
-    printf("Cannot create ENet server\n");
-    return 1;
+    const LockstepPlayer::Slot &slot = player.slots[tick % lockstep_window];
+    if (slot.tick == tick)
+      player.last = {eid, slot.thr, slot.steer};
+    else
+      player.missed++;
+    inputs.push_back(player.last);
+  }
+  lockstep_step(room.lockstepWorld, inputs.data(), uint16_t(inputs.size()));
+  if (tick % lockstep_hash_interval == 0)
+  {
+    room.lockstepHashTicks[tick % lockstep_window] = tick;
+    room.lockstepHashes[tick % lockstep_window] = lockstep_hash(room.lockstepWorld);
   }
+  // a few bytes per player no matter how many cars there are
+  for (const auto &[eid, player] : room.lockstepPlayers)
+    send_lockstep_tick(player.peer, tick, inputs.data(), uint16_t(inputs.size()));
+}
 
-  uint32_t lastTime = enet_time_get();
-  while (true)
+// What --metrics exports for all rooms together, updated as things happen. The room and
+// peer gauges are copied over once a second by the room they belong to.
+static void on_packet_sent(ENetPeer *peer, uint8_t, const ENetPacket *packet)
+{
+  uint8_t type = std::min(*packet->data, message_type_count);
+  metric_add(serverMetrics.packetsOut[type]);
+  metric_add(serverMetrics.bytesOut[type], packet->dataLength);
+  // recording takes a single room
+  if (captureSent && recordFile)
+    recording_write(recordFile, rooms.front()->serverTick, E_RECORD_SENT, uint8_t(peer - peer->host->peers),
+                    packet->data, packet->dataLength);
+}
+
+static void on_packet_received(const ENetPacket *packet)
+{
+  uint8_t type = packet->dataLength > 0 ? std::min(*packet->data, message_type_count) : message_type_count;
+  metric_add(serverMetrics.packetsIn[type]);
+  metric_add(serverMetrics.bytesIn[type], packet->dataLength);
+}
+
+static void init_metrics()
+{
+  ServerMetrics &m = serverMetrics;
+  m.snapshotsSent = metrics_counter("w10_snapshots_sent_total", "Entity snapshots sent");
+  m.snapshotsSuppressed = metrics_counter("w10_snapshots_suppressed_total",
+                                          "Entity snapshots skipped because the client's dead reckoning was close enough");
+  m.lagContacts = metrics_counter("w10_lag_compensated_contacts_total",
+                                  "Cars within contact distance of a neighbour where the driver saw it, --lag-contacts");
+  for (uint8_t type = 0; type <= message_type_count; ++type)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
-    ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
+    char labels[64];
+    snprintf(labels, sizeof(labels), "type=\"%s\"", message_type_name(type));
+    m.packetsIn[type] = metrics_counter("w10_packets_received_total", "Packets received by message type", labels);
+    m.bytesIn[type] = metrics_counter("w10_bytes_received_total", "Payload bytes received by message type", labels);
+    m.packetsOut[type] = metrics_counter("w10_packets_sent_total", "Packets sent by message type", labels);
+    m.bytesOut[type] = metrics_counter("w10_bytes_sent_total", "Payload bytes sent by message type", labels);
+  }
+  set_packet_send_hook(on_packet_sent);
+}
+
+static Room &add_room(uint16_t id)
+{
+  rooms.push_back(std::make_unique<Room>());
+  Room &room = *rooms.back();
+  room.id = id;
+  char labels[64];
+  snprintf(labels, sizeof(labels), "room=\"%u\"", id);
+  RoomMetrics &m = room.metrics;
+  m.tickUs = metrics_histogram("w10_tick_duration_us", "Time spent simulating and sending one tick", labels);
+  m.entities = metrics_gauge("w10_entities", "Entities in the world", labels);
+  m.activeEntities = metrics_gauge("w10_active_entities", "Entities awake and simulated, the rest are parked", labels);
+  m.peers = metrics_gauge("w10_connected_peers", "Connected clients", labels);
+  return room;
+}
+
+static void add_peer_metrics(Room &room, ENetPeer *peer)
+{
+  char labels[64];
+  snprintf(labels, sizeof(labels), "room=\"%u\",peer=\"%x:%u\"", room.id, peer->address.host, peer->address.port);
+  PeerMetrics &m = room.peerMetrics[peer];
+  m.rttMs = metrics_gauge("w10_peer_rtt_ms", "Smoothed round trip time as ENet sees it", labels);
+  m.rttVarianceMs = metrics_gauge("w10_peer_rtt_variance_ms", "Round trip time variance", labels);
+  m.loss = metrics_gauge("w10_peer_packet_loss_ratio", "Reliable packets lost, as a fraction", labels);
+  m.throttle = metrics_gauge("w10_peer_throttle_ratio", "Share of unreliable packets ENet lets through", labels);
+}
+
+static void remove_peer_metrics(Room &room, ENetPeer *peer)
+{
+  auto it = room.peerMetrics.find(peer);
+  if (it == room.peerMetrics.end())
+    return;
+  const PeerMetrics &m = it->second;
+  metrics_remove(m.rttMs);
+  metrics_remove(m.rttVarianceMs);
+  metrics_remove(m.loss);
+  metrics_remove(m.throttle);
+  room.peerMetrics.erase(it);
+}
+
+// The peer stats are ENet's, which only the room's own thread may look at.
+static void update_room_metrics(Room &room)
+{
+  for (auto &[peer, m] : room.peerMetrics)
+  {
+    metric_set(m.rttMs, peer->roundTripTime);
+    metric_set(m.rttVarianceMs, peer->roundTripTimeVariance);
+    metric_set(m.loss, double(peer->packetLoss) / ENET_PEER_PACKET_LOSS_SCALE);
+    metric_set(m.throttle, double(peer->packetThrottle) / ENET_PEER_PACKET_THROTTLE_SCALE);
+  }
+  metric_set(room.metrics.peers, double(room.peerMetrics.size()));
+  metric_set(room.metrics.entities, double(room.entities.size()));
+  metric_set(room.metrics.activeEntities, double(room.activeEntities.size()));
+}
+
+static void on_disconnect(Room &room, ENetPeer *peer)
+{
+  remove_peer_metrics(room, peer);
+  auto reckoning = room.peerReckoning.find(peer);
+  if (reckoning != room.peerReckoning.end())
+  {
+    LOG_INFO("snapshots to %x:%u: %u sent, %u suppressed by dead reckoning\n", peer->address.host, peer->address.port,
+             reckoning->second.sent, reckoning->second.suppressed);
+    room.peerReckoning.erase(reckoning);
+  }
+  room.peerCells.erase(peer);
+  // ENet hands the peer to the next client, which must not get or drive this one's car
+  for (auto it = room.controlledMap.begin(); it != room.controlledMap.end();)
+    it = it->second == peer ? room.controlledMap.erase(it) : std::next(it);
+  for (auto it = room.lockstepPlayers.begin(); it != room.lockstepPlayers.end(); ++it)
+    if (it->second.peer == peer)
     {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        event.peer->data = new uint32_t;
-        *(uint32_t*)event.peer->data = 0;
+      LOG_INFO("lockstep inputs of %u: %u missed their tick, %u desyncs\n", it->first, it->second.missed, it->second.desyncs);
+      room.lockstepPlayers.erase(it);
+      break;
+    }
+  for (auto it = room.inputBuffers.begin(); it != room.inputBuffers.end(); ++it)
+  {
+    const InputBuffer &b = it->second;
+    if (b.peer != peer)
+      continue;
+    LOG_INFO("inputs of %u: %u applied, %u duplicates, %u late, %u lost, %u starved ticks, %u trimmed\n",
+             it->first, b.applied, b.duplicates, b.late, b.lost, b.starved, b.trimmed);
+    // nobody drives it any more, park it where it is so it falls asleep
+    auto index = room.entityIndex.find(it->first);
+    if (index != room.entityIndex.end())
+    {
+      Entity &e = room.entities[index->second];
+      e.thr = 0.f;
+      e.steer = 0.f;
+      e.speed = 0.f;
+    }
+    room.inputBuffers.erase(it);
+    break;
+  }
+}
+
+static void on_event(Room &room, ENetEvent &event, uint64_t receive_time, uint64_t next_tick)
+{
+  PROFILE_SCOPE("event");
+  uint8_t peerIndex = uint8_t(event.peer - room.host->peers);
+  switch (event.type)
+  {
+  case ENET_EVENT_TYPE_CONNECT:
+    LOG_INFO("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+    if (recordFile)
+      recording_write(recordFile, room.serverTick, E_RECORD_CONNECT, peerIndex);
+    event.peer->data = new uint32_t;
+    *(uint32_t*)event.peer->data = 0;
+    add_peer_metrics(room, event.peer);
+    break;
+  case ENET_EVENT_TYPE_DISCONNECT:
+    LOG_INFO("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
+    if (recordFile)
+      recording_write(recordFile, room.serverTick, E_RECORD_DISCONNECT, peerIndex);
+    on_disconnect(room, event.peer);
+    delete event.peer->data;
+    break;
+  case ENET_EVENT_TYPE_RECEIVE:
+    if (recordFile)
+      recording_write(recordFile, room.serverTick, E_RECORD_RECEIVE, peerIndex, event.packet->data,
+                      event.packet->dataLength);
+    on_packet_received(event.packet);
+    switch (get_packet_type(event.packet))
+    {
+      case E_CLIENT_TO_SERVER_JOIN:
+        on_join(room, event.packet, event.peer);
+        if (recordFile)
+          recording_write(recordFile, room.serverTick, E_RECORD_CIPHER_KEY, peerIndex, (uint8_t*)event.peer->data,
+                          sizeof(uint32_t));
         break;
-      case ENET_EVENT_TYPE_DISCONNECT:
-        printf("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
-        delete event.peer->data;
+      case E_CLIENT_TO_SERVER_INPUT:
+        decipher_data(event.packet, event.peer);
+        on_input(room, event.packet, event.peer, receive_time, next_tick);
         break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            decipher_data(event.packet, event.peer);
-            on_input(event.packet);
-            break;
-        };
-        enet_packet_destroy(event.packet);
+      case E_CLIENT_TO_SERVER_TIME_REQUEST:
+        on_time_request(room, event.packet, event.peer, receive_time);
         break;
-      default:
+      case E_CLIENT_TO_SERVER_LOCKSTEP_INPUT:
+        on_lockstep_input(room, event.packet, event.peer);
         break;
-      };
-    }
-    static int t = 0;
-    for (Entity &e : entities)
+      case E_CLIENT_TO_SERVER_STATE_HASH:
+        on_state_hash(room, event.packet, event.peer);
+        break;
+    };
+    enet_packet_destroy(event.packet);
+    break;
+  default:
+    break;
+  };
+}
+
+// The last input of eid's driver the server applied, and its trace if that hasn't gone out yet.
+static const InputTrace *take_input_trace(Room &room, uint16_t eid, uint16_t &input_seq, ENetPeer *&driver)
+{
+  auto buffer = room.inputBuffers.find(eid);
+  if (buffer == room.inputBuffers.end())
+    return nullptr;
+  InputBuffer &b = buffer->second;
+  input_seq = b.lastSeq;
+  driver = b.peer;
+  if (!b.hasPendingTrace)
+    return nullptr;
+  b.pendingTrace.processUs = uint32_t(get_time_us() - b.pendingApplyTime);
+  b.hasPendingTrace = false;
+  return &b.pendingTrace;
+}
+
+// Moves the client's view of e on by a tick, true if it needs a snapshot to be corrected.
+static bool snapshot_due(PeerReckoning &reckoning, const Entity &e, bool force, uint32_t tick)
+{
+  auto it = reckoning.entities.find(e.eid);
+  if (it != reckoning.entities.end() && !force)
+  {
+    ReckonedEntity &r = it->second;
+    simulate_entity(r.view, fixed_dt);
+    float dx = r.view.x - e.x;
+    float dy = r.view.y - e.y;
+    if (reckonError > 0.f && dx * dx + dy * dy <= reckonError * reckonError && tick - r.sentTick < reckonMaxAge)
+      return false;
+  }
+  ReckonedEntity &r = reckoning.entities[e.eid];
+  r.view = quantize_snapshot_entity(e);
+  r.sentTick = tick;
+  return true;
+}
+
+static void collide_entities(Room &room)
+{
+  PROFILE_SCOPE("collisions");
+  for (uint32_t index : room.activeEntities)
+    spatial_hash_update(room.spatialHash, index, room.entities[index].x, room.entities[index].y);
+  collision_find_contacts(room.spatialHash, room.entities, room.activeEntities, room.activeSlot, room.contacts,
+                          collisionThreads);
+  for (const Contact &c : room.contacts)
+  {
+    resolve_contact(room.entities[c.a], room.entities[c.b], c);
+    wake_entity(room, c.a);
+    wake_entity(room, c.b);
+  }
+}
+
+static void server_tick(Room &room, uint64_t now)
+{
+  PROFILE_SCOPE("tick");
+  if (lockstep)
+  {
+    lockstep_tick(room);
+    room.serverTick = room.lockstepWorld.tick;
+    room.serverTickTime = now;
+    metric_record(room.metrics.tickUs, get_time_us() - now);
+    return;
+  }
+  for (auto &[eid, buffer] : room.inputBuffers)
+    apply_input(room, eid, buffer);
+  // a car nobody drives only moves when a contact pushed it, it coasts to a stop and sleeps again
+  for (uint32_t index : room.activeEntities)
+  {
+    Entity &e = room.entities[index];
+    if (e.speed == 0.f || room.inputBuffers.count(e.eid))
+      continue;
+    e.thr = 0.f;
+    e.steer = 0.f;
+    simulate_entity(e, fixed_dt);
+  }
+  collide_entities(room);
+  room.serverTick++;
+  room.serverTickTime = now;
+  // what the snapshots below show, for rewinding to it later
+  if (lagContacts)
+  {
+    PROFILE_SCOPE("history_record");
+    world_history_record(room.worldHistory, room.serverTick, room.entities, room.activeEntities);
+  }
+  PROFILE_SCOPE("snapshots");
+  room.fallingAsleep.clear();
+  for (uint32_t index : room.activeEntities)
+  {
+    const Entity &e = room.entities[index];
+    room.restTicks[index] = at_rest(e) ? room.restTicks[index] + 1 : 0;
+    // the last one goes to everyone, so nobody is left reckoning it towards somewhere else
+    bool last = room.restTicks[index] >= sleep_ticks;
+    if (last)
+      room.fallingAsleep.push_back(index);
+    uint16_t inputSeq = 0;
+    ENetPeer *driver = nullptr;
+    const InputTrace *trace = take_input_trace(room, e.eid, inputSeq, driver);
+    if (captureSent && recordFile)
+      recording_write_snapshot_source(recordFile, room.serverTick, e.eid, e.x, e.y, e.ori, e.speed);
+    auto owner = room.controlledMap.find(e.eid);
+    for (size_t i = 0; i < room.host->peerCount; ++i)
     {
-      // simulate
-      simulate_entity(e, dt);
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
+      ENetPeer *peer = &room.host->peers[i];
+      if (peer->state != ENET_PEER_STATE_CONNECTED)
+        continue;
+      PeerReckoning &reckoning = room.peerReckoning[peer];
+      bool own = owner != room.controlledMap.end() && owner->second == peer;
+      if (!own && !snapshot_due(reckoning, e, last, room.serverTick))
       {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+        reckoning.suppressed++;
+        metric_add(serverMetrics.snapshotsSuppressed);
+        continue;
       }
+      reckoning.sent++;
+      metric_add(serverMetrics.snapshotsSent);
+      uint8_t cellTag = sync_cell(room, peer, e);
+      send_snapshot(peer, room.serverTick, e.eid, e.x, e.y, cellTag, e.ori, e.speed, e.thr, e.steer, inputSeq,
+                    driver == peer ? trace : nullptr);
     }
-    usleep(10000);
   }
+  // a parked car still goes to its driver, its snapshots ack the inputs that keep it parked
+  for (const auto &[eid, peer] : room.controlledMap)
+  {
+    auto index = room.entityIndex.find(eid);
+    if (index == room.entityIndex.end() || room.activeSlot[index->second] != asleep ||
+        peer->state != ENET_PEER_STATE_CONNECTED)
+      continue;
+    const Entity &e = room.entities[index->second];
+    uint16_t inputSeq = 0;
+    ENetPeer *driver = nullptr;
+    const InputTrace *trace = take_input_trace(room, eid, inputSeq, driver);
+    room.peerReckoning[peer].sent++;
+    metric_add(serverMetrics.snapshotsSent);
+    uint8_t cellTag = sync_cell(room, peer, e);
+    send_snapshot(peer, room.serverTick, eid, e.x, e.y, cellTag, e.ori, e.speed, e.thr, e.steer, inputSeq,
+                  driver == peer ? trace : nullptr);
+  }
+  for (uint32_t index : room.fallingAsleep)
+    sleep_entity(room, index);
+  metric_record(room.metrics.tickUs, get_time_us() - now);
+}
 
-  enet_host_destroy(server);
+// Runs a recording through the handlers of room as fast as it goes. The peers are never
+// connected, so everything is encoded but ENet refuses to queue it.
+static int replay(Room &room, const char *path, const char *metrics_path)
+{
+  bool recordedLockstep = false;
+  FILE *f = recording_open(path, recordedLockstep);
+  if (!f)
+    return 1;
+  lockstep = recordedLockstep;
+  std::vector<ENetPeer> peers(max_peers);
+  ENetHost host = {};
+  host.peers = peers.data();
+  host.peerCount = peers.size();
+  for (ENetPeer &peer : peers)
+    peer.host = &host;
+  room.host = &host;
 
-  atexit(enet_deinitialize);
+  PROFILE_THREAD("replay");
+  uint32_t ticks = 0;
+  uint32_t events = 0;
+  uint64_t start = get_time_us();
+  RecordEvent record;
+  while (recording_read(f, record))
+  {
+    if (record.peer >= max_peers)
+      continue;
+    uint64_t now = get_time_us();
+    while (room.serverTick < record.tick)
+    {
+      server_tick(room, now);
+      ticks++;
+    }
+    ENetPeer *peer = &peers[record.peer];
+    if (record.kind == E_RECORD_CIPHER_KEY)
+    {
+      if (peer->data && record.data.size() == sizeof(uint32_t))
+        memcpy(peer->data, record.data.data(), sizeof(uint32_t));
+      continue;
+    }
+    ENetEvent event = {};
+    event.peer = peer;
+    // what ENet would have done, the peers still refuse packets for lack of channels
+    if (record.kind == E_RECORD_CONNECT)
+    {
+      event.type = ENET_EVENT_TYPE_CONNECT;
+      peer->state = ENET_PEER_STATE_CONNECTED;
+    }
+    else if (record.kind == E_RECORD_DISCONNECT)
+    {
+      event.type = ENET_EVENT_TYPE_DISCONNECT;
+      peer->state = ENET_PEER_STATE_DISCONNECTED;
+    }
+    else if (record.kind == E_RECORD_RECEIVE && !record.data.empty() && peer->data)
+    {
+      event.type = ENET_EVENT_TYPE_RECEIVE;
+      event.packet = enet_packet_create(record.data.data(), record.data.size(), 0);
+    }
+    else
+      continue; // what a capture sent, the replay makes its own, or a peer cut off by the start of the file
+    on_event(room, event, now, now);
+    events++;
+  }
+  fclose(f);
+  room.host = nullptr;
+  double seconds = (get_time_us() - start) * 1e-6;
+  const MetricHistogram &tickUs = *room.metrics.tickUs;
+  LOG_INFO("replayed %u events and %u ticks in %.3f s, %.0f ticks/s\n", events, ticks, seconds, ticks / seconds);
+  LOG_INFO("tick: p50 %u us, p99 %u us, max %u us\n", uint32_t(metric_histogram_quantile(tickUs, 0.5)),
+           uint32_t(metric_histogram_quantile(tickUs, 0.99)), uint32_t(tickUs.max.load(std::memory_order_relaxed)));
+  if (metrics_path)
+  {
+    update_room_metrics(room);
+    metrics_write_prometheus(metrics_path);
+  }
+  PROFILE_REPORT();
   return 0;
 }
 
+// Services the room's host and ticks it at sim_tick_rate, forever. Only a server with a
+// single room reports the profile and writes the metrics from here, see dispatch.
+static void run_room(Room &room, const char *profile_path, const char *metrics_path)
+{
+  const uint64_t tickInterval = 1000000 / sim_tick_rate; // us
+  const uint32_t profileReportTicks = 10 * sim_tick_rate;
+  const uint32_t metricsExportTicks = sim_tick_rate;
+  uint64_t nextTick = get_time_us();
+  PROFILE_THREAD("room");
+  while (true)
+  {
+    uint64_t now = get_time_us();
+    uint32_t waitMs = nextTick > now ? uint32_t((nextTick - now) / 1000) : 0;
+    ENetEvent event;
+    int res = 0;
+    {
+      PROFILE_SCOPE("service_wait");
+      res = enet_host_service(room.host, &event, waitMs);
+    }
+    while (res > 0)
+    {
+      on_event(room, event, get_time_us(), nextTick);
+      PROFILE_SCOPE("service");
+      res = enet_host_service(room.host, &event, 0);
+    }
+
+    now = get_time_us();
+    if (now < nextTick)
+      continue;
+    nextTick += tickInterval;
+    if (nextTick < now)
+      nextTick = now + tickInterval;
+    if (profile_path && room.serverTick % profileReportTicks == 0)
+    {
+      PROFILE_REPORT();
+      PROFILE_WRITE_TRACE(profile_path);
+    }
+    if (room.serverTick % metricsExportTicks == 0)
+    {
+      update_room_metrics(room);
+      if (metrics_path)
+        metrics_write_prometheus(metrics_path);
+      // a crash loses at most a second of the recording
+      if (recordFile)
+        fflush(recordFile);
+    }
+    server_tick(room, now);
+  }
+}
+
+// With several rooms the base port only routes: a client joins with the room it wants and
+// is sent the port of that one, rooms are on the ports right after. Also writes the metrics
+// every room keeps up to date.
+static void dispatch(ENetHost *dispatcher, const char *metrics_path)
+{
+  const uint64_t metricsExportInterval = 1000000; // us
+  uint64_t nextExport = get_time_us();
+  while (true)
+  {
+    uint64_t now = get_time_us();
+    uint32_t waitMs = nextExport > now ? uint32_t((nextExport - now) / 1000) : 0;
+    ENetEvent event;
+    int res = enet_host_service(dispatcher, &event, waitMs);
+    while (res > 0)
+    {
+      if (event.type == ENET_EVENT_TYPE_RECEIVE)
+      {
+        on_packet_received(event.packet);
+        if (get_packet_type(event.packet) == E_CLIENT_TO_SERVER_JOIN)
+        {
+          uint16_t id = 0;
+          deserialize_join(event.packet, id);
+          if (id < rooms.size())
+            send_room(event.peer, id, rooms[id]->host->address.port);
+          else
+          {
+            LOG_ERROR("%x:%u asked for room %u, there are %zu\n", event.peer->address.host, event.peer->address.port,
+                      id, rooms.size());
+            enet_peer_disconnect_later(event.peer, 0);
+          }
+        }
+        enet_packet_destroy(event.packet);
+      }
+      res = enet_host_service(dispatcher, &event, 0);
+    }
+    now = get_time_us();
+    if (now < nextExport)
+      continue;
+    nextExport = now + metricsExportInterval;
+    if (metrics_path)
+      metrics_write_prometheus(metrics_path);
+  }
+}
 
+int main(int argc, const char **argv)
+{
+  if (enet_initialize() != 0)
+  {
+    LOG_ERROR("Cannot init ENet");
+    return 1;
+  }
+  ENetAddress address;
+
+  address.host = ENET_HOST_ANY;
+  // the lobby starts instances with their own port, with --rooms n that one only routes to
+  // the rooms on the n ports after it
+  // server [port] [--lockstep] [--profile trace.json] [--metrics file.prom] [--record file.w10rec] [--replay file.w10rec]
+  //        [--capture file.w10rec] [--reckon-error m] [--reckon-max-age ticks] [--collision-threads n] [--rooms n]
+  //        [--lag-contacts]
+  address.port = 10131;
+  const char *profilePath = nullptr;
+  const char *metricsPath = nullptr;
+  const char *recordPath = nullptr;
+  const char *replayPath = nullptr;
+  uint16_t roomCount = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--lockstep"))
+      lockstep = true;
+    else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+      profilePath = argv[++i];
+    else if (!strcmp(argv[i], "--metrics") && i + 1 < argc)
+      metricsPath = argv[++i];
+    else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+      recordPath = argv[++i];
+    else if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+    {
+      recordPath = argv[++i];
+      captureSent = true;
+    }
+    else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+      replayPath = argv[++i];
+    else if (!strcmp(argv[i], "--reckon-error") && i + 1 < argc)
+      reckonError = float(atof(argv[++i]));
+    else if (!strcmp(argv[i], "--reckon-max-age") && i + 1 < argc)
+      reckonMaxAge = uint32_t(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--lag-contacts"))
+      lagContacts = true;
+    else if (!strcmp(argv[i], "--collision-threads") && i + 1 < argc)
+      collisionThreads = uint32_t(std::max(1, atoi(argv[++i])));
+    else if (!strcmp(argv[i], "--rooms") && i + 1 < argc)
+      roomCount = uint16_t(std::max(1, atoi(argv[++i])));
+    else
+      address.port = atoi(argv[i]);
+  }
+  // a recording is of one world, and profile reports read every thread's ring
+  if (roomCount > 1 && (profilePath || recordPath || replayPath))
+  {
+    LOG_ERROR("--profile, --record, --capture and --replay take a single room\n");
+    return 1;
+  }
+
+  init_metrics();
+  if (replayPath)
+  {
+    int res = replay(add_room(0), replayPath, metricsPath);
+    atexit(enet_deinitialize);
+    return res;
+  }
+
+  for (uint16_t id = 0; id < roomCount; ++id)
+  {
+    Room &room = add_room(id);
+    ENetAddress roomAddress = address;
+    if (roomCount > 1)
+      roomAddress.port = address.port + 1 + id;
+    room.host = enet_host_create(&roomAddress, max_peers, 2, 0, 0);
+    if (!room.host)
+    {
+      LOG_ERROR("Cannot create ENet server for room %u on port %u\n", id, roomAddress.port);
+      return 1;
+    }
+  }
+  if (recordPath && !(recordFile = recording_create(recordPath, lockstep)))
+    return 1;
+
+  if (roomCount == 1)
+    run_room(*rooms.front(), profilePath, metricsPath);
+  else
+  {
+    ENetHost *dispatcher = enet_host_create(&address, max_peers, 2, 0, 0);
+    if (!dispatcher)
+    {
+      LOG_ERROR("Cannot create ENet server\n");
+      return 1;
+    }
+    for (std::unique_ptr<Room> &room : rooms)
+      room->thread = std::thread(run_room, std::ref(*room), nullptr, nullptr);
+    LOG_INFO("%u rooms on ports %u to %u\n", roomCount, address.port + 1, address.port + roomCount);
+    dispatch(dispatcher, metricsPath);
+    enet_host_destroy(dispatcher);
+  }
+
+  for (std::unique_ptr<Room> &room : rooms)
+  {
+    if (room->thread.joinable())
+      room->thread.join();
+    enet_host_destroy(room->host);
+  }
+
+  atexit(enet_deinitialize);
+  return 0;
+}
@@ -0,0 +1,13 @@
+$input a_position, i_data0, i_data1
+$output v_color0
+
+#include <bgfx_shader.sh>
+
+// i_data0 = (x, y, cos(ori), sin(ori)), i_data1 = color
+void main()
+{
+  vec2 rotated = vec2(a_position.x * i_data0.z - a_position.y * i_data0.w,
+                      a_position.x * i_data0.w + a_position.y * i_data0.z);
+  gl_Position = mul(u_viewProj, vec4(rotated + i_data0.xy, -0.01, 1.0));
+  v_color0 = i_data1;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+inline uint64_t get_time_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint64_t get_time_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,330 @@
+// Reads a server capture (server --capture file.w10rec) and prints where the bandwidth
+// goes: per message type and direction, per peer and per field, plus how far the
+// quantized snapshot fields are off the state they were made from.
+// Sizes are game payload only, ENet and UDP headers come on top.
+// traffic_analyzer file.w10rec
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "protocol.h"
+#include "recording.h"
+
+struct Field
+{
+  const char *name;
+  size_t size;
+};
+
+struct TypeStats
+{
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+  uint64_t malformed = 0;
+  std::map<std::string, uint64_t> fieldBytes;
+  std::vector<std::string> fieldOrder;
+};
+
+struct PeerStats
+{
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+  uint64_t packetsIn = 0;
+  uint64_t packetsOut = 0;
+};
+
+struct QuantizationStats
+{
+  const char *name;
+  SnapshotPacking packing;
+  bool wraps;
+  std::vector<float> errors; // decoded - source
+  uint64_t clamped = 0;
+};
+
+// Splits a packet into its fields the way the send_* functions lay them out, using the
+// deserializers for the parts whose size depends on the content. False if it doesn't decode.
+static bool split_fields(ENetPacket &packet, std::vector<Field> &fields)
+{
+  fields.clear();
+  fields.push_back({"type", sizeof(uint8_t)});
+  size_t size = packet.dataLength;
+  auto fixed = [&](std::initializer_list<Field> rest)
+  {
+    size_t total = sizeof(uint8_t);
+    for (const Field &f : rest)
+      total += f.size;
+    if (size != total)
+      return false;
+    fields.insert(fields.end(), rest);
+    return true;
+  };
+  switch (get_packet_type(&packet))
+  {
+  case E_CLIENT_TO_SERVER_JOIN:
+    // recorded before there were rooms, or with the room
+    return size == sizeof(uint8_t) || fixed({{"room", sizeof(uint16_t)}});
+  case E_SERVER_TO_CLIENT_NEW_ENTITY:
+    return fixed({{"entity", sizeof(Entity)}});
+  case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
+    return fixed({{"eid", sizeof(uint16_t)}});
+  case E_SERVER_TO_CLIENT_KEY:
+    return fixed({{"key", sizeof(uint32_t)}});
+  case E_CLIENT_TO_SERVER_INPUT:
+  {
+    uint16_t eid = 0;
+    uint8_t interpDelay = 0;
+    InputRecord inputs[max_redundant_inputs];
+    uint64_t traceTime = 0;
+    if (deserialize_entity_input(&packet, eid, interpDelay, inputs, traceTime) == 0)
+      return false;
+    size_t header = sizeof(uint8_t) + 2 * sizeof(uint16_t) + 3 * sizeof(uint8_t);
+    size_t traceSize = traceTime ? sizeof(uint64_t) : 0;
+    fields.insert(fields.end(), {{"eid", sizeof(uint16_t)}, {"seq", sizeof(uint16_t)}, {"interp_delay", sizeof(uint8_t)},
+                                 {"count", sizeof(uint8_t)}, {"same_mask", sizeof(uint8_t)},
+                                 {"thr+steer", size - header - traceSize}, {"trace_time", traceSize}});
+    return true;
+  }
+  case E_SERVER_TO_CLIENT_SNAPSHOT:
+  {
+    size_t header = sizeof(uint8_t) + sizeof(uint32_t) + 4 * sizeof(uint16_t) + sizeof(uint8_t) + 2 * sizeof(int8_t) +
+                    sizeof(uint16_t);
+    if (size < header)
+      return false;
+    uint32_t tick = 0;
+    uint16_t eid = 0, inputSeq = 0;
+    float x, y, ori, speed, thr, steer;
+    uint8_t cellTag = 0;
+    InputTrace trace;
+    size_t traceSize = deserialize_snapshot(&packet, tick, eid, x, y, cellTag, ori, speed, thr, steer, inputSeq, trace) ?
+                       size - header : 0;
+    if (size != header + traceSize)
+      return false;
+    fields.insert(fields.end(), {{"tick", sizeof(uint32_t)}, {"eid", sizeof(uint16_t)}, {"x", sizeof(uint16_t)},
+                                 {"y", sizeof(uint16_t)}, {"ori", sizeof(uint8_t)}, {"speed", sizeof(uint16_t)},
+                                 {"thr", sizeof(int8_t)}, {"steer", sizeof(int8_t)}, {"input_seq", sizeof(uint16_t)},
+                                 {"trace", traceSize}});
+    return true;
+  }
+  case E_CLIENT_TO_SERVER_TIME_REQUEST:
+    return fixed({{"client_time", sizeof(uint64_t)}});
+  case E_SERVER_TO_CLIENT_TIME_RESPONSE:
+    return fixed({{"client_time", sizeof(uint64_t)}, {"server_receive", sizeof(uint64_t)},
+                  {"server_send", sizeof(uint64_t)}, {"server_tick", sizeof(uint32_t)},
+                  {"server_tick_time", sizeof(uint64_t)}});
+  case E_CLIENT_TO_SERVER_LOCKSTEP_INPUT:
+    return fixed({{"eid", sizeof(uint16_t)}, {"tick", sizeof(uint32_t)}, {"thr", sizeof(int8_t)}, {"steer", sizeof(int8_t)}});
+  case E_SERVER_TO_CLIENT_LOCKSTEP_STATE:
+  case E_SERVER_TO_CLIENT_LOCKSTEP_TICK:
+  {
+    size_t header = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t);
+    if (size < header)
+      return false;
+    bool state = get_packet_type(&packet) == E_SERVER_TO_CLIENT_LOCKSTEP_STATE;
+    uint16_t count = *(uint16_t*)(packet.data + sizeof(uint8_t) + sizeof(uint32_t));
+    size_t item = state ? sizeof(FixedEntity) : sizeof(uint16_t) + 2 * sizeof(int8_t);
+    if (size != header + count * item)
+      return false;
+    fields.insert(fields.end(), {{"tick", sizeof(uint32_t)}, {"count", sizeof(uint16_t)},
+                                 {state ? "entities" : "inputs", count * item}});
+    return true;
+  }
+  case E_SERVER_TO_CLIENT_LOCKSTEP_SPAWN:
+    return fixed({{"entity", sizeof(FixedEntity)}});
+  case E_CLIENT_TO_SERVER_STATE_HASH:
+    return fixed({{"tick", sizeof(uint32_t)}, {"hash", sizeof(uint32_t)}});
+  case E_SERVER_TO_CLIENT_ENTITY_CELL:
+    return fixed({{"eid", sizeof(uint16_t)}, {"cell", 2 * sizeof(int16_t)}, {"tag", sizeof(uint8_t)}});
+  case E_SERVER_TO_CLIENT_ROOM:
+    return fixed({{"room", sizeof(uint16_t)}, {"port", sizeof(uint16_t)}});
+  };
+  return false;
+}
+
+static float percentile(const std::vector<float> &sorted, double p)
+{
+  if (sorted.empty())
+    return 0.f;
+  size_t i = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[i];
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2)
+  {
+    printf("traffic_analyzer file.w10rec\n");
+    return 1;
+  }
+  bool lockstep = false;
+  FILE *f = recording_open(argv[1], lockstep);
+  if (!f)
+    return 1;
+
+  // [0] received, [1] sent
+  TypeStats types[2][message_type_count + 1];
+  std::map<uint8_t, PeerStats> peers;
+  uint32_t keys[256] = {};
+  ENetPeer keyPeer = {};
+  QuantizationStats quantization[] = {
+    {"x", snapshot_x_packing, false, {}, 0},
+    {"y", snapshot_y_packing, false, {}, 0},
+    {"ori", snapshot_ori_packing, true, {}, 0},
+    {"speed", snapshot_speed_packing, false, {}, 0}
+  };
+  struct Source
+  {
+    float values[4];
+  };
+  std::map<std::pair<uint32_t, uint16_t>, Source> sources; // by tick and eid, until the first snapshot of it
+  bool sawSent = false;
+  uint32_t firstTick = ~0u;
+  uint32_t lastTick = 0;
+
+  RecordEvent event;
+  std::vector<Field> fields;
+  while (recording_read(f, event))
+  {
+    firstTick = std::min(firstTick, event.tick);
+    lastTick = std::max(lastTick, event.tick);
+    if (event.kind == E_RECORD_CIPHER_KEY && event.data.size() == sizeof(uint32_t))
+    {
+      memcpy(&keys[event.peer], event.data.data(), sizeof(uint32_t));
+      continue;
+    }
+    if (event.kind == E_RECORD_SNAPSHOT_SOURCE)
+    {
+      uint16_t eid = 0;
+      Source s;
+      if (recording_read_snapshot_source(event, eid, s.values[0], s.values[1], s.values[2], s.values[3]))
+        sources[{event.tick, eid}] = s;
+      // dead reckoning leaves most of them without a snapshot, the sent ones go out the same tick
+      sources.erase(sources.begin(), sources.lower_bound({event.tick, 0}));
+      continue;
+    }
+    if ((event.kind != E_RECORD_RECEIVE && event.kind != E_RECORD_SENT) || event.data.empty())
+      continue;
+    bool sent = event.kind == E_RECORD_SENT;
+    sawSent |= sent;
+    ENetPacket packet = {};
+    packet.data = event.data.data();
+    packet.dataLength = event.data.size();
+    uint8_t type = std::min(uint8_t(get_packet_type(&packet)), message_type_count);
+    TypeStats &stats = types[sent][type];
+    stats.packets++;
+    stats.bytes += packet.dataLength;
+    PeerStats &peer = peers[event.peer];
+    (sent ? peer.packetsOut : peer.packetsIn)++;
+    (sent ? peer.bytesOut : peer.bytesIn) += packet.dataLength;
+    if (type == E_CLIENT_TO_SERVER_INPUT && !sent)
+    {
+      keyPeer.data = &keys[event.peer];
+      decipher_data(&packet, &keyPeer);
+    }
+    if (!split_fields(packet, fields))
+    {
+      stats.malformed++;
+      continue;
+    }
+    for (const Field &field : fields)
+    {
+      if (stats.fieldBytes.find(field.name) == stats.fieldBytes.end())
+        stats.fieldOrder.push_back(field.name);
+      stats.fieldBytes[field.name] += field.size;
+    }
+    if (type != E_SERVER_TO_CLIENT_SNAPSHOT)
+      continue;
+    uint32_t tick = 0;
+    uint16_t eid = 0, inputSeq = 0;
+    float decoded[4], thr, steer;
+    uint8_t cellTag = 0;
+    InputTrace trace;
+    deserialize_snapshot(&packet, tick, eid, decoded[0], decoded[1], cellTag, decoded[2], decoded[3], thr, steer,
+                         inputSeq, trace);
+    auto source = sources.find({tick, eid});
+    if (source == sources.end())
+      continue;
+    // positions are compared within the cell the server sent them relative to
+    SnapshotCell cell = snapshot_cell_of(source->second.values[0], source->second.values[1]);
+    float origins[4] = {cell.x * snapshot_cell_size, cell.y * snapshot_cell_size, 0.f, 0.f};
+    for (int i = 0; i < 4; ++i)
+    {
+      QuantizationStats &q = quantization[i];
+      float value = source->second.values[i] - origins[i];
+      float err = decoded[i] - value;
+      if (q.wraps)
+        err = err > PI ? err - 2.f * PI : err < -PI ? err + 2.f * PI : err;
+      else if (value < q.packing.lo || value > q.packing.hi)
+        q.clamped++;
+      q.errors.push_back(err);
+    }
+    sources.erase(source);
+  }
+  fclose(f);
+
+  if (firstTick > lastTick)
+  {
+    printf("%s has no packets\n", argv[1]);
+    return 1;
+  }
+  double seconds = double(lastTick - firstTick + 1) / sim_tick_rate;
+  printf("%s: %u ticks, %.1f s%s\n", argv[1], lastTick - firstTick + 1, seconds,
+         sawSent ? "" : ", received packets only (a --record, not a --capture)");
+
+  static const char *directions[2] = {"received", "sent"};
+  for (int dir = 0; dir < 2; ++dir)
+  {
+    uint64_t totalBytes = 0;
+    for (const TypeStats &t : types[dir])
+      totalBytes += t.bytes;
+    if (totalBytes == 0)
+      continue;
+    printf("\n%s: %.1f kB/s\n", directions[dir], totalBytes / seconds * 1e-3);
+    printf("  %-22s %10s %10s %10s %8s %7s %9s\n", "type", "packets", "packets/s", "bytes/s", "avg size", "share", "malformed");
+    for (uint8_t type = 0; type <= message_type_count; ++type)
+    {
+      const TypeStats &t = types[dir][type];
+      if (t.packets == 0)
+        continue;
+      printf("  %-22s %10llu %10.1f %10.0f %8.1f %6.1f%% %9llu\n", message_type_name(type), (unsigned long long)t.packets,
+             t.packets / seconds, t.bytes / seconds, double(t.bytes) / t.packets, 100.0 * t.bytes / totalBytes,
+             (unsigned long long)t.malformed);
+      for (const std::string &name : t.fieldOrder)
+      {
+        uint64_t bytes = t.fieldBytes.at(name);
+        printf("    %-20s %43.0f %6.1f%%\n", name.c_str(), bytes / seconds, 100.0 * bytes / t.bytes);
+      }
+    }
+  }
+
+  printf("\nper peer:\n  %-6s %12s %12s %12s %12s\n", "peer", "in bytes/s", "in pkts/s", "out bytes/s", "out pkts/s");
+  for (const auto &[index, p] : peers)
+    printf("  %-6u %12.0f %12.1f %12.0f %12.1f\n", index, p.bytesIn / seconds, p.packetsIn / seconds,
+           p.bytesOut / seconds, p.packetsOut / seconds);
+
+  if (quantization[0].errors.empty())
+    return 0;
+  printf("\nsnapshot quantization error (decoded - source), %u samples:\n", uint32_t(quantization[0].errors.size()));
+  printf("  %-6s %5s %10s %10s %10s %10s %10s %8s\n", "field", "bits", "step", "mean", "p50 |err|", "p99 |err|", "max |err|",
+         "clamped");
+  for (QuantizationStats &q : quantization)
+  {
+    double mean = 0.0;
+    for (float err : q.errors)
+      mean += err;
+    mean /= q.errors.size();
+    std::vector<float> abs;
+    abs.reserve(q.errors.size());
+    for (float err : q.errors)
+      abs.push_back(fabsf(err));
+    std::sort(abs.begin(), abs.end());
+    float step = (q.packing.hi - q.packing.lo) / float((1 << q.packing.bits) - 1);
+    printf("  %-6s %5d %10.5f %10.5f %10.5f %10.5f %10.5f %8llu\n", q.name, q.packing.bits, step, mean,
+           percentile(abs, 0.5), percentile(abs, 0.99), abs.back(), (unsigned long long)q.clamped);
+  }
+  return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// One writer thread fills back() and publishes it, one reader thread picks up the newest
+// published value with update() and reads front(). Neither side ever waits for the other,
+// the writer always overwrites back() completely as it may hold any older value.
+template<typename T>
+class TripleBuffer
+{
+public:
+  T &back() { return buffers[backIdx]; }
+
+  void publish()
+  {
+    backIdx = middle.exchange(backIdx | dirty_bit, std::memory_order_acq_rel) & index_mask;
+  }
+
+  // Returns true if front() changed.
+  bool update()
+  {
+    if (!(middle.load(std::memory_order_relaxed) & dirty_bit))
+      return false;
+    frontIdx = middle.exchange(frontIdx, std::memory_order_acq_rel) & index_mask;
+    return true;
+  }
+
+  const T &front() const { return buffers[frontIdx]; }
+
+private:
+  static constexpr uint8_t dirty_bit = 4;
+  static constexpr uint8_t index_mask = 3;
+
+  T buffers[3];
+  uint8_t backIdx = 0;
+  uint8_t frontIdx = 1;
+  std::atomic<uint8_t> middle{2};
+};
@@ -0,0 +1,117 @@
+#include "world_history.h"
+#include <algorithm>
+#include <cassert>
+#include "mathUtils.h"
+
+void world_history_record(WorldHistory &history, uint32_t tick, const std::vector<Entity> &entities,
+                          const std::vector<uint32_t> &awake)
+{
+  assert(!history.rewound);
+  history.newest = history.count == 0 ? 0 : (history.newest + 1) % world_history_size;
+  if (history.count < world_history_size)
+    history.count++;
+  history.ticks[history.newest] = tick;
+  if (history.trackOf.size() < entities.size())
+    history.trackOf.resize(entities.size(), no_track);
+  for (uint32_t index : awake)
+  {
+    uint32_t &track = history.trackOf[index];
+    if (track == no_track)
+    {
+      track = uint32_t(history.tracks.size());
+      history.tracks.emplace_back();
+    }
+    const Entity &e = entities[index];
+    history.tracks[track].poses[history.newest] = {tick, e.x, e.y, e.ori};
+  }
+}
+
+static uint32_t slot_back(const WorldHistory &history, uint32_t age)
+{
+  return (history.newest + world_history_size - age) % world_history_size;
+}
+
+// The entity's pose at the tick in slot, nullptr if it wasn't recorded then.
+static const WorldTrack::Pose *find_pose(const WorldHistory &history, uint32_t index, uint32_t slot)
+{
+  if (index >= history.trackOf.size() || history.trackOf[index] == no_track)
+    return nullptr;
+  const WorldTrack::Pose &pose = history.tracks[history.trackOf[index]].poses[slot];
+  return pose.tick == history.ticks[slot] ? &pose : nullptr;
+}
+
+static float lerp_angle(float from, float to, float t)
+{
+  float d = to - from;
+  d = d > PI ? d - 2.f * PI : d < -PI ? d + 2.f * PI : d;
+  float a = from + d * t;
+  return a > PI ? a - 2.f * PI : a < -PI ? a + 2.f * PI : a;
+}
+
+double world_history_rewind(WorldHistory &history, std::vector<Entity> &entities, double tick,
+                            const std::vector<uint32_t> &indices)
+{
+  assert(!history.rewound);
+  if (history.count == 0)
+    return tick;
+
+  uint32_t newest = history.ticks[slot_back(history, 0)];
+  uint32_t oldest = history.ticks[slot_back(history, history.count - 1)];
+  tick = std::max(double(oldest), std::min(double(newest), tick));
+  // newest slot at or after tick, the one before it is at or before
+  uint32_t age = 0;
+  while (age + 1 < history.count && history.ticks[slot_back(history, age + 1)] >= tick)
+    age++;
+  uint32_t to = slot_back(history, age);
+  uint32_t from = age + 1 < history.count ? slot_back(history, age + 1) : to;
+  uint32_t fromTick = history.ticks[from];
+  uint32_t toTick = history.ticks[to];
+  float t = fromTick == toTick ? 1.f : float((tick - fromTick) / double(toTick - fromTick));
+
+  history.savedIndex.clear();
+  history.savedX.clear();
+  history.savedY.clear();
+  history.savedOri.clear();
+  for (uint32_t index : indices)
+  {
+    const WorldTrack::Pose *a = find_pose(history, index, from);
+    const WorldTrack::Pose *b = find_pose(history, index, to);
+    if (!a && !b)
+      continue;
+    Entity &e = entities[index];
+    history.savedIndex.push_back(index);
+    history.savedX.push_back(e.x);
+    history.savedY.push_back(e.y);
+    history.savedOri.push_back(e.ori);
+    if (a && b)
+    {
+      e.x = a->x + (b->x - a->x) * t;
+      e.y = a->y + (b->y - a->y) * t;
+      e.ori = lerp_angle(a->ori, b->ori, t);
+    }
+    else
+    {
+      const WorldTrack::Pose &pose = a ? *a : *b;
+      e.x = pose.x;
+      e.y = pose.y;
+      e.ori = pose.ori;
+    }
+  }
+  history.rewound = true;
+  return tick;
+}
+
+void world_history_restore(WorldHistory &history, std::vector<Entity> &entities)
+{
+  if (!history.rewound)
+    return;
+  // backwards, so an index listed twice ends up with what it had before the first
+  for (size_t i = history.savedIndex.size(); i-- > 0;)
+  {
+    Entity &e = entities[history.savedIndex[i]];
+    e.x = history.savedX[i];
+    e.y = history.savedY[i];
+    e.ori = history.savedOri[i];
+  }
+  history.rewound = false;
+}
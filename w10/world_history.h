@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "entity.h"
+
+// ~1 s at sim_tick_rate, rewinds further back than that are clamped to the oldest tick
+constexpr uint32_t world_history_size = 64;
+
+constexpr uint32_t no_track = uint32_t(-1);
+
+// Where one entity was at the ticks in the history's ring, by slot. A pose is only valid
+// if its tick is the one in that slot, the entity was asleep or not there yet otherwise.
+struct WorldTrack
+{
+  struct Pose
+  {
+    uint32_t tick = uint32_t(-1);
+    float x = 0.f;
+    float y = 0.f;
+    float ori = 0.f;
+  };
+  Pose poses[world_history_size];
+};
+
+// Ring of the last world_history_size ticks. Only the awake entities are recorded, sleeping
+// ones don't move, so a mostly parked world costs next to nothing. An entity gets its track
+// the first time it is recorded awake and keeps it, memory is world_history_size * 16 bytes
+// for every entity that was ever awake.
+struct WorldHistory
+{
+  uint32_t ticks[world_history_size] = {};
+  uint32_t count = 0;
+  uint32_t newest = 0; // slot of the last recorded tick
+  std::vector<uint32_t> trackOf; // per entity, index into tracks or no_track
+  std::vector<WorldTrack> tracks;
+  // present state of what the last rewind overwrote
+  std::vector<uint32_t> savedIndex;
+  std::vector<float> savedX;
+  std::vector<float> savedY;
+  std::vector<float> savedOri;
+  bool rewound = false;
+};
+
+// Entities are only ever appended on the server, so an index keeps meaning the same entity.
+void world_history_record(WorldHistory &history, uint32_t tick, const std::vector<Entity> &entities,
+                          const std::vector<uint32_t> &awake);
+
+// Puts the listed entities where they were at the fractional tick, interpolating between
+// recorded ones. One recorded on only one side of it is put there, one recorded on neither
+// was asleep or did not exist yet and stays where it is. Returns the tick actually rewound
+// to. Must be followed by world_history_restore before the world moves on.
+double world_history_rewind(WorldHistory &history, std::vector<Entity> &entities, double tick,
+                            const std::vector<uint32_t> &indices);
+void world_history_restore(WorldHistory &history, std::vector<Entity> &entities);
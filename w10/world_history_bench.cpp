@@ -0,0 +1,78 @@
+// Cost of recording a tick into the world history and of a rewind + restore pair of a
+// car's neighbours, the way the server does it for every input with --lag-contacts.
+// world_history_bench [entities] [iterations] [awake fraction]
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include "world_history.h"
+#include "timeUtils.h"
+
+int main(int argc, const char **argv)
+{
+  size_t count = argc > 1 ? size_t(atoi(argv[1])) : 10000;
+  int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+  float awakeFraction = argc > 3 ? float(atof(argv[3])) : 1.f;
+
+  std::vector<Entity> entities(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    Entity &e = entities[i];
+    e.eid = uint16_t(i);
+    e.x = float(rand() % 64) - 32.f;
+    e.y = float(rand() % 64) - 32.f;
+    e.ori = float(rand() % 628) * 0.01f - 3.14f;
+    e.thr = 1.f;
+    e.steer = float(rand() % 3) - 1.f;
+  }
+
+  // the server lists its awake ones in no particular order
+  std::vector<uint32_t> awake;
+  for (size_t i = 0; i < count; ++i)
+    if (float(rand() % 1000) < awakeFraction * 1000.f)
+      awake.push_back(uint32_t(i));
+  for (size_t i = awake.size(); i > 1; --i)
+    std::swap(awake[i - 1], awake[rand() % i]);
+
+  WorldHistory history;
+  uint32_t tick = 0;
+  uint64_t bestRecord = ~0ull;
+  for (int i = 0; i < std::max(iterations, int(world_history_size)); ++i)
+  {
+    for (uint32_t index : awake)
+      simulate_entity(entities[index], fixed_dt);
+    uint64_t start = get_time_ns();
+    world_history_record(history, ++tick, entities, awake);
+    bestRecord = std::min(bestRecord, get_time_ns() - start);
+  }
+
+  // spread the targets over the whole ring, like clients with different latencies
+  uint64_t bestRewind = ~0ull;
+  uint64_t bestRestore = ~0ull;
+  uint64_t total = 0;
+  float checksum = 0.f;
+  std::vector<uint32_t> nearby(8); // a car's neighbours in a crowd
+  for (int i = 0; i < iterations; ++i)
+  {
+    for (uint32_t &index : nearby)
+      index = uint32_t(rand() % count);
+    double target = tick - (i % (world_history_size - 1)) - 0.25;
+    uint64_t start = get_time_ns();
+    world_history_rewind(history, entities, target, nearby);
+    uint64_t rewound = get_time_ns();
+    checksum += entities[nearby[0]].x;
+    world_history_restore(history, entities);
+    uint64_t end = get_time_ns();
+    bestRewind = std::min(bestRewind, rewound - start);
+    bestRestore = std::min(bestRestore, end - rewound);
+    total += end - start;
+  }
+
+  size_t bytes = history.trackOf.capacity() * sizeof(uint32_t) + history.tracks.capacity() * sizeof(WorldTrack);
+  printf("%zu entities, %zu awake, %u ticks kept, %.2f MB\n", count, awake.size(), world_history_size, bytes / (1024.0 * 1024.0));
+  printf("record  %8.2f us (best)\n", bestRecord * 1e-3);
+  printf("rewind  %8.2f us (best)\n", bestRewind * 1e-3);
+  printf("restore %8.2f us (best)\n", bestRestore * 1e-3);
+  printf("rewind + restore %.2f us (mean of %d), checksum %f\n", total * 1e-3 / iterations, iterations, checksum);
+  return 0;
+}
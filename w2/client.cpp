@@ -1,7 +1,10 @@
 #include <enet/enet.h>
 #include <iostream>
+#include <stdlib.h>
+#include "stream.h"
+#include "lobby_protocol.h"
 
-void send_fragmented_packet(ENetPeer *peer)
+void send_fragmented_packet(StreamSender &sender, uint32_t cur_time)
 {
   const char *baseMsg = "Stay awhile and listen. ";
   const size_t msgLen = strlen(baseMsg);
@@ -12,19 +15,11 @@ void send_fragmented_packet(ENetPeer *peer)
     hugeMessage[i] = baseMsg[i % msgLen];
   hugeMessage[sendSize-1] = '\0';
 
-  ENetPacket *packet = enet_packet_create(hugeMessage, sendSize, ENET_PACKET_FLAG_RELIABLE);
-  enet_peer_send(peer, 0, packet);
+  stream_send(sender, hugeMessage, sendSize, cur_time);
 
   delete[] hugeMessage;
 }
 
-void send_micro_packet(ENetPeer *peer)
-{
-  const char *msg = "dv/dt";
-  ENetPacket *packet = enet_packet_create(msg, strlen(msg) + 1, ENET_PACKET_FLAG_UNSEQUENCED);
-  enet_peer_send(peer, 1, packet);
-}
-
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
@@ -33,7 +28,11 @@ int main(int argc, const char **argv)
     return 1;
   }
 
-  ENetHost *client = enet_host_create(nullptr, 1, 2, 0, 0);
+  // client [simulated loss probability]
+  if (argc > 1)
+    stream_set_simulated_loss(atof(argv[1]));
+
+  ENetHost *client = enet_host_create(nullptr, 2, 2, 0, 0); // lobby and game server
   if (!client)
   {
     printf("Cannot create ENet client\n");
@@ -50,26 +49,57 @@ int main(int argc, const char **argv)
     printf("Cannot connect to lobby");
     return 1;
   }
+  ENetPeer *gamePeer = nullptr;
 
   uint32_t timeStart = enet_time_get();
   uint32_t lastFragmentedSendTime = timeStart;
   uint32_t lastMicroSendTime = timeStart;
   bool connected = false;
+  StreamSender streamSender;
+  uint32_t lastDelivered = 0;
   while (true)
   {
     ENetEvent event;
-    while (enet_host_service(client, &event, 10) > 0)
+    while (enet_host_service(client, &event, connected ? 1 : 10) > 0)
     {
       switch (event.type)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        if (event.peer != lobbyPeer)
+          break;
+        stream_sender_init(streamSender, lobbyPeer);
+        send_queue(lobbyPeer);
         connected = true;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        printf("Packet received '%s'\n", event.packet->data);
+        if (event.peer == lobbyPeer && event.packet->dataLength > 0 && *event.packet->data == E_LOBBY_TO_CLIENT_HANDOFF)
+        {
+          uint32_t roomId = 0;
+          ENetAddress gameAddress;
+          if (!deserialize_handoff(event.packet, roomId, gameAddress.host, gameAddress.port))
+            printf("Malformed handoff of %zu bytes\n", event.packet->dataLength);
+          else
+          {
+            // ENET_HOST_ANY - the lobby did not know its address, the game server runs next to it
+            if (gameAddress.host == ENET_HOST_ANY)
+              gameAddress.host = lobbyPeer->address.host;
+            printf("Room %u starts on %x:%u\n", roomId, gameAddress.host, gameAddress.port);
+            if (gamePeer)
+              enet_peer_reset(gamePeer);
+            gamePeer = enet_host_connect(client, &gameAddress, 2, 0);
+            if (!gamePeer)
+              printf("Cannot connect to game server\n");
+          }
+        }
+        else if (event.peer == lobbyPeer)
+          stream_sender_on_packet(streamSender, event.packet, enet_time_get());
         enet_packet_destroy(event.packet);
         break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        if (event.peer == gamePeer)
+          gamePeer = nullptr;
+        break;
       default:
         break;
       };
@@ -80,12 +110,20 @@ int main(int argc, const char **argv)
       if (curTime - lastFragmentedSendTime > 1000)
       {
         lastFragmentedSendTime = curTime;
-        send_fragmented_packet(lobbyPeer);
+        send_fragmented_packet(streamSender, curTime);
       }
       if (curTime - lastMicroSendTime > 100)
       {
         lastMicroSendTime = curTime;
-        send_micro_packet(lobbyPeer);
+        send_micro_packet(lobbyPeer, "dv/dt");
+      }
+      stream_sender_update(streamSender, curTime);
+      if (streamSender.stats.messagesDelivered != lastDelivered)
+      {
+        lastDelivered = streamSender.stats.messagesDelivered;
+        const StreamStats &stats = streamSender.stats;
+        printf("Stream delivered in %u ms, chunk %u bytes, %u chunks sent, %u resent, %u dropped\n",
+               stats.lastDeliveryTime, streamSender.chunkSize, stats.chunksSent, stats.chunksRetransmitted, stats.chunksDropped);
       }
     }
   }
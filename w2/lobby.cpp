@@ -1,5 +1,268 @@
 #include <enet/enet.h>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "stream.h"
+#include "lobby_protocol.h"
+
+extern char **environ;
+
+constexpr uint32_t no_room = 0;
+
+struct LobbyClient
+{
+  ENetPeer *peer = nullptr;
+  uint32_t roomId = no_room;
+  uint32_t roomSlot = 0;
+  uint32_t queueTicket = 0; // 0 - not queued
+  StreamReceiver stream;
+};
+
+struct Room
+{
+  uint32_t id = no_room;
+  std::vector<uint32_t> members; // client slots
+};
+
+struct QueueEntry
+{
+  uint32_t slot;
+  uint32_t ticket; // stale if the client left the queue in the meantime
+};
+
+// Client slot is host index * lobby_peers_per_host + incomingPeerID, so lookups never search.
+static std::vector<LobbyClient> clients;
+static std::unordered_map<uint32_t, Room> rooms;
+static std::deque<QueueEntry> matchQueue;
+static size_t queuedCount = 0;
+static uint32_t nextRoomId = 1;
+static uint32_t nextTicket = 1;
+
+static size_t matchSize = 4;
+static const char *serverBinary = nullptr; // nullptr - only hand out ports, do not start servers
+static uint32_t gameServerHost = ENET_HOST_ANY; // what clients connect to after the handoff
+constexpr uint16_t first_game_port = 10200;
+constexpr uint16_t last_game_port = 10999;
+static uint16_t nextGamePort = first_game_port;
+static std::vector<bool> gamePortBusy(last_game_port - first_game_port + 1);
+static std::unordered_map<pid_t, uint16_t> gameServerPorts;
+static uint32_t handoffs = 0;
+static uint32_t runningServers = 0;
+
+static uint16_t next_game_port()
+{
+  for (size_t i = 0; i < gamePortBusy.size(); ++i)
+  {
+    uint16_t port = nextGamePort++;
+    if (nextGamePort > last_game_port)
+      nextGamePort = first_game_port;
+    if (!gamePortBusy[port - first_game_port])
+      return port;
+  }
+  return 0;
+}
+
+static uint16_t start_game_server()
+{
+  uint16_t port = next_game_port();
+  if (port == 0)
+  {
+    printf("No free game server ports, %u servers running\n", runningServers);
+    return 0;
+  }
+  if (!serverBinary)
+    return port;
+  std::string portStr = std::to_string(port);
+  char *argv[] = { (char*)serverBinary, (char*)portStr.c_str(), nullptr };
+  pid_t pid;
+  if (posix_spawn(&pid, serverBinary, nullptr, nullptr, argv, environ) != 0)
+  {
+    printf("Cannot start game server %s\n", serverBinary);
+    return 0;
+  }
+  gamePortBusy[port - first_game_port] = true;
+  gameServerPorts[pid] = port;
+  runningServers++;
+  return port;
+}
+
+static void reap_game_servers()
+{
+  int status = 0;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    auto it = gameServerPorts.find(pid);
+    if (it == gameServerPorts.end())
+      continue;
+    gamePortBusy[it->second - first_game_port] = false;
+    gameServerPorts.erase(it);
+    runningServers--;
+  }
+}
+
+static void broadcast_room_info(const Room &room)
+{
+  for (uint32_t slot : room.members)
+    send_room_info(clients[slot].peer, room.id, uint16_t(room.members.size()));
+}
+
+static void leave_queue(LobbyClient &client)
+{
+  if (client.queueTicket == 0)
+    return;
+  client.queueTicket = 0;
+  queuedCount--;
+  // stale entries are only skipped by match_players, drop them before they outgrow the queue
+  size_t stale = matchQueue.size() - queuedCount;
+  if (stale > queuedCount)
+    matchQueue.erase(std::remove_if(matchQueue.begin(), matchQueue.end(),
+      [](const QueueEntry &entry) { return clients[entry.slot].queueTicket != entry.ticket; }), matchQueue.end());
+}
+
+static void leave_room(LobbyClient &client)
+{
+  if (client.roomId == no_room)
+    return;
+  auto it = rooms.find(client.roomId);
+  client.roomId = no_room;
+  if (it == rooms.end())
+    return;
+  Room &room = it->second;
+  uint32_t moved = room.members.back();
+  room.members[client.roomSlot] = moved;
+  clients[moved].roomSlot = client.roomSlot;
+  room.members.pop_back();
+  if (room.members.empty())
+    rooms.erase(it);
+  else
+    broadcast_room_info(room);
+}
+
+static void start_room(Room &room)
+{
+  uint16_t port = start_game_server();
+  if (port == 0)
+    return;
+  for (uint32_t slot : room.members)
+  {
+    clients[slot].roomId = no_room;
+    send_handoff(clients[slot].peer, room.id, gameServerHost, port);
+  }
+  handoffs += room.members.size();
+  rooms.erase(room.id);
+}
+
+static Room &create_room()
+{
+  Room &room = rooms[nextRoomId];
+  room.id = nextRoomId++;
+  if (nextRoomId == no_room)
+    nextRoomId++;
+  return room;
+}
+
+static void join_room(uint32_t slot, Room &room)
+{
+  LobbyClient &client = clients[slot];
+  client.roomId = room.id;
+  client.roomSlot = uint32_t(room.members.size());
+  room.members.push_back(slot);
+}
+
+static void match_players()
+{
+  while (queuedCount >= matchSize)
+  {
+    Room &room = create_room();
+    while (room.members.size() < matchSize)
+    {
+      QueueEntry entry = matchQueue.front();
+      matchQueue.pop_front();
+      LobbyClient &client = clients[entry.slot];
+      if (client.queueTicket != entry.ticket)
+        continue;
+      leave_queue(client);
+      join_room(entry.slot, room);
+    }
+    start_room(room);
+  }
+}
+
+static void on_receive(uint32_t slot, ENetPacket *packet)
+{
+  LobbyClient &client = clients[slot];
+  switch (*packet->data)
+  {
+  case E_STREAM_MICRO:
+    break;
+  case E_CLIENT_TO_LOBBY_QUEUE:
+    if (client.queueTicket != 0)
+      break;
+    leave_room(client);
+    client.queueTicket = nextTicket++;
+    matchQueue.push_back({slot, client.queueTicket});
+    queuedCount++;
+    match_players();
+    break;
+  case E_CLIENT_TO_LOBBY_CREATE_ROOM:
+  {
+    leave_queue(client);
+    leave_room(client);
+    Room &room = create_room();
+    join_room(slot, room);
+    broadcast_room_info(room);
+    break;
+  }
+  case E_CLIENT_TO_LOBBY_JOIN_ROOM:
+  {
+    uint32_t roomId = no_room;
+    deserialize_join_room(packet, roomId);
+    auto it = rooms.find(roomId);
+    if (it == rooms.end() || roomId == client.roomId)
+      break;
+    leave_queue(client);
+    leave_room(client);
+    join_room(slot, it->second);
+    if (it->second.members.size() >= matchSize)
+      start_room(it->second);
+    else
+      broadcast_room_info(it->second);
+    break;
+  }
+  case E_CLIENT_TO_LOBBY_LEAVE_ROOM:
+    leave_room(client);
+    break;
+  case E_CLIENT_TO_LOBBY_START_ROOM:
+  {
+    auto it = rooms.find(client.roomId);
+    if (it != rooms.end())
+      start_room(it->second);
+    break;
+  }
+  default:
+    stream_receiver_on_packet(client.stream, client.peer, packet, enet_time_get(),
+      [](uint32_t id, const std::vector<uint8_t> &data, uint32_t delivery_ms, bool intact)
+      {
+        printf("Stream #%u: %zu bytes in %u ms, %s\n", id, data.size(), delivery_ms, intact ? "intact" : "CORRUPTED");
+      });
+    break;
+  }
+}
+
+static uint64_t time_usec()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
 int main(int argc, const char **argv)
 {
@@ -8,42 +271,115 @@ int main(int argc, const char **argv)
     printf("Cannot init ENet");
     return 1;
   }
-  ENetAddress address;
-
-  address.host = ENET_HOST_ANY;
-  address.port = 10887;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  // lobby [max clients] [match size] [game server binary] [game server address]
+  size_t maxClients = argc > 1 ? atoi(argv[1]) : 1024;
+  matchSize = argc > 2 ? std::max(1, atoi(argv[2])) : matchSize;
+  serverBinary = argc > 3 && strcmp(argv[3], "-") ? argv[3] : nullptr;
+  {
+    // game servers run next to the lobby, so this is the address clients reach the lobby by
+    ENetAddress gameAddress;
+    if (enet_address_set_host(&gameAddress, argc > 4 ? argv[4] : "localhost") != 0)
+    {
+      printf("Cannot resolve game server address %s\n", argc > 4 ? argv[4] : "localhost");
+      return 1;
+    }
+    gameServerHost = gameAddress.host;
+  }
 
-  if (!server)
+  size_t numHosts = (maxClients + lobby_peers_per_host - 1) / lobby_peers_per_host;
+  std::vector<ENetHost*> hosts;
+  for (size_t i = 0; i < numHosts; ++i)
   {
-    printf("Cannot create ENet server\n");
-    return 1;
+    ENetAddress address;
+    address.host = ENET_HOST_ANY;
+    address.port = lobby_base_port + i;
+
+    size_t peers = std::min(lobby_peers_per_host, maxClients - i * lobby_peers_per_host);
+    ENetHost *server = enet_host_create(&address, peers, 2, 0, 0);
+    if (!server)
+    {
+      printf("Cannot create ENet server\n");
+      return 1;
+    }
+    hosts.push_back(server);
   }
+  clients.resize(numHosts * lobby_peers_per_host);
+  rooms.reserve(maxClients);
+  printf("Lobby for %zu clients on ports %u..%u, matches of %zu\n", maxClients,
+         lobby_base_port, unsigned(lobby_base_port + numHosts - 1), matchSize);
 
+  size_t connected = 0;
+  uint32_t lastStatsTime = enet_time_get();
+  uint64_t ticks = 0, lobbyTime = 0, serviceTime = 0, maxLobbyTime = 0;
   while (true)
   {
-    ENetEvent event;
-    while (enet_host_service(server, &event, 10) > 0)
+    bool anyEvents = false;
+    for (size_t h = 0; h < hosts.size(); ++h)
     {
-      switch (event.type)
+      uint64_t serviceStart = time_usec();
+      uint64_t handlerTime = 0;
+      ENetEvent event;
+      while (enet_host_service(hosts[h], &event, 0) > 0)
       {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        printf("Packet received '%s'\n", event.packet->data);
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
+        anyEvents = true;
+        uint64_t handlerStart = time_usec();
+        uint32_t slot = uint32_t(h * lobby_peers_per_host + event.peer->incomingPeerID);
+        switch (event.type)
+        {
+        case ENET_EVENT_TYPE_CONNECT:
+          clients[slot] = LobbyClient();
+          clients[slot].peer = event.peer;
+          event.peer->data = &clients[slot];
+          connected++;
+          break;
+        case ENET_EVENT_TYPE_DISCONNECT:
+          leave_queue(clients[slot]);
+          leave_room(clients[slot]);
+          clients[slot] = LobbyClient();
+          event.peer->data = nullptr;
+          connected--;
+          break;
+        case ENET_EVENT_TYPE_RECEIVE:
+          if (event.packet->dataLength > 0)
+            on_receive(slot, event.packet);
+          enet_packet_destroy(event.packet);
+          break;
+        default:
+          break;
+        };
+        handlerTime += time_usec() - handlerStart;
+      }
+      lobbyTime += handlerTime;
+      maxLobbyTime = std::max(maxLobbyTime, handlerTime);
+      serviceTime += time_usec() - serviceStart - handlerTime;
     }
+    ticks++;
+
+    uint32_t curTime = enet_time_get();
+    if (curTime - lastStatsTime >= 1000)
+    {
+      lastStatsTime = curTime;
+      reap_game_servers();
+      for (LobbyClient &client : clients)
+        if (!client.stream.streams.empty())
+        {
+          uint32_t stalled = stream_receiver_update(client.stream, curTime);
+          if (stalled > 0)
+            printf("Dropped %u stalled streams\n", stalled);
+        }
+      printf("peers %zu rooms %zu queued %zu handoffs %u servers %u | lobby %.2f us/tick (max %llu) enet %.2f us/tick\n",
+             connected, rooms.size(), queuedCount, handoffs, runningServers,
+             double(lobbyTime) / ticks, (unsigned long long)maxLobbyTime, double(serviceTime) / ticks);
+      ticks = lobbyTime = serviceTime = maxLobbyTime = 0;
+    }
+    if (!anyEvents)
+      usleep(1000);
   }
 
-  enet_host_destroy(server);
+  for (ENetHost *server : hosts)
+    enet_host_destroy(server);
 
   atexit(enet_deinitialize);
   return 0;
 }
-
@@ -0,0 +1,137 @@
+// Drives a running lobby with many simulated clients: every client queues for a match,
+// waits for the handoff and queues again after a random pause.
+// Start the lobby with the same client count first: lobby 5000 4
+#include <enet/enet.h>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <vector>
+#include "lobby_protocol.h"
+
+struct SimClient
+{
+  ENetPeer *peer = nullptr;
+  bool connected = false;
+  uint64_t queuedAt = 0;
+};
+
+static uint64_t time_usec()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, const char **argv)
+{
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+
+  // lobby_bench [clients] [seconds]
+  size_t numClients = argc > 1 ? atoi(argv[1]) : 5000;
+  uint32_t duration = argc > 2 ? atoi(argv[2]) : 30;
+
+  size_t numHosts = (numClients + lobby_peers_per_host - 1) / lobby_peers_per_host;
+  std::vector<ENetHost*> hosts;
+  for (size_t i = 0; i < numHosts; ++i)
+  {
+    ENetHost *client = enet_host_create(nullptr, lobby_peers_per_host, 2, 0, 0);
+    if (!client)
+    {
+      printf("Cannot create ENet client\n");
+      return 1;
+    }
+    hosts.push_back(client);
+  }
+
+  std::vector<SimClient> clients(numClients);
+  typedef std::pair<uint64_t, uint32_t> Requeue; // time, client
+  std::priority_queue<Requeue, std::vector<Requeue>, std::greater<Requeue>> requeues;
+  std::vector<uint32_t> latencies; // us, queue to handoff
+
+  size_t nextToConnect = 0;
+  size_t connected = 0;
+  uint32_t handoffs = 0;
+  uint64_t start = time_usec();
+  uint64_t lastStats = start;
+  while (time_usec() - start < uint64_t(duration) * 1000000)
+  {
+    // ramp up instead of flooding the lobby with connects
+    for (size_t i = 0; i < 200 && nextToConnect < numClients; ++i, ++nextToConnect)
+    {
+      ENetAddress address;
+      enet_address_set_host(&address, "localhost");
+      address.port = lobby_base_port + nextToConnect / lobby_peers_per_host;
+      ENetPeer *peer = enet_host_connect(hosts[nextToConnect / lobby_peers_per_host], &address, 2, 0);
+      clients[nextToConnect].peer = peer;
+      if (peer)
+        peer->data = &clients[nextToConnect];
+    }
+
+    for (ENetHost *host : hosts)
+    {
+      ENetEvent event;
+      while (enet_host_service(host, &event, 0) > 0)
+      {
+        SimClient *client = (SimClient*)event.peer->data;
+        switch (event.type)
+        {
+        case ENET_EVENT_TYPE_CONNECT:
+          client->connected = true;
+          connected++;
+          client->queuedAt = time_usec();
+          send_queue(event.peer);
+          break;
+        case ENET_EVENT_TYPE_DISCONNECT:
+          client->connected = false;
+          connected--;
+          break;
+        case ENET_EVENT_TYPE_RECEIVE:
+          if (*event.packet->data == E_LOBBY_TO_CLIENT_HANDOFF)
+          {
+            uint64_t now = time_usec();
+            latencies.push_back(uint32_t(now - client->queuedAt));
+            handoffs++;
+            requeues.push({now + uint64_t(rand() % 2000) * 1000, uint32_t(client - clients.data())});
+          }
+          enet_packet_destroy(event.packet);
+          break;
+        default:
+          break;
+        };
+      }
+    }
+
+    uint64_t now = time_usec();
+    while (!requeues.empty() && requeues.top().first <= now)
+    {
+      SimClient &client = clients[requeues.top().second];
+      requeues.pop();
+      if (!client.connected)
+        continue;
+      client.queuedAt = now;
+      send_queue(client.peer);
+    }
+
+    if (now - lastStats >= 1000000)
+    {
+      lastStats = now;
+      std::sort(latencies.begin(), latencies.end());
+      auto pct = [&](double p) { return latencies.empty() ? 0.0 : latencies[size_t(p * (latencies.size() - 1))] * 0.001; };
+      printf("connected %zu/%zu handoffs/s %u queue->handoff ms p50 %.2f p99 %.2f\n",
+             connected, numClients, handoffs, pct(0.5), pct(0.99));
+      latencies.clear();
+      handoffs = 0;
+    }
+    usleep(1000);
+  }
+
+  for (ENetHost *host : hosts)
+    enet_host_destroy(host);
+
+  atexit(enet_deinitialize);
+  return 0;
+}
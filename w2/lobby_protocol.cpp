@@ -0,0 +1,94 @@
+#include "lobby_protocol.h"
+#include <cstring> // memcpy
+
+static void send_type_only(ENetPeer *peer, LobbyMessageType type)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
+  *packet->data = type;
+
+  enet_peer_send(peer, 0, packet);
+}
+
+void send_queue(ENetPeer *peer)
+{
+  send_type_only(peer, E_CLIENT_TO_LOBBY_QUEUE);
+}
+
+void send_create_room(ENetPeer *peer)
+{
+  send_type_only(peer, E_CLIENT_TO_LOBBY_CREATE_ROOM);
+}
+
+void send_join_room(ENetPeer *peer, uint32_t room_id)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_CLIENT_TO_LOBBY_JOIN_ROOM; ptr += sizeof(uint8_t);
+  memcpy(ptr, &room_id, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+
+  enet_peer_send(peer, 0, packet);
+}
+
+void send_leave_room(ENetPeer *peer)
+{
+  send_type_only(peer, E_CLIENT_TO_LOBBY_LEAVE_ROOM);
+}
+
+void send_start_room(ENetPeer *peer)
+{
+  send_type_only(peer, E_CLIENT_TO_LOBBY_START_ROOM);
+}
+
+void send_room_info(ENetPeer *peer, uint32_t room_id, uint16_t num_members)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_LOBBY_TO_CLIENT_ROOM_INFO; ptr += sizeof(uint8_t);
+  memcpy(ptr, &room_id, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &num_members, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+
+  enet_peer_send(peer, 0, packet);
+}
+
+void send_handoff(ENetPeer *peer, uint32_t room_id, uint32_t host, uint16_t port)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + 2 * sizeof(uint32_t) + sizeof(uint16_t),
+                                                   ENET_PACKET_FLAG_RELIABLE);
+  uint8_t *ptr = packet->data;
+  *ptr = E_LOBBY_TO_CLIENT_HANDOFF; ptr += sizeof(uint8_t);
+  memcpy(ptr, &room_id, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &host, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &port, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+
+  enet_peer_send(peer, 0, packet);
+}
+
+void deserialize_join_room(ENetPacket *packet, uint32_t &room_id)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint32_t))
+    return;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  room_id = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+}
+
+void deserialize_room_info(ENetPacket *packet, uint32_t &room_id, uint16_t &num_members)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint16_t))
+    return;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  room_id = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  num_members = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+}
+
+bool deserialize_handoff(ENetPacket *packet, uint32_t &room_id, uint32_t &host, uint16_t &port)
+{
+  if (packet->dataLength < sizeof(uint8_t) + 2 * sizeof(uint32_t) + sizeof(uint16_t))
+    return false;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  room_id = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  host = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  port = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <enet/enet.h>
+#include <cstdint>
+
+// Values start above StreamMessageType so the lobby keeps accepting stream traffic.
+enum LobbyMessageType : uint8_t
+{
+  E_CLIENT_TO_LOBBY_QUEUE = 0x20, // matchmaking
+  E_CLIENT_TO_LOBBY_CREATE_ROOM,
+  E_CLIENT_TO_LOBBY_JOIN_ROOM,
+  E_CLIENT_TO_LOBBY_LEAVE_ROOM,
+  E_CLIENT_TO_LOBBY_START_ROOM,
+  E_LOBBY_TO_CLIENT_ROOM_INFO,
+  E_LOBBY_TO_CLIENT_HANDOFF
+};
+
+constexpr uint16_t lobby_base_port = 10887;
+// ENET_PROTOCOL_MAXIMUM_PEER_ID, more clients than that are spread over several hosts
+constexpr size_t lobby_peers_per_host = 4095;
+
+void send_queue(ENetPeer *peer);
+void send_create_room(ENetPeer *peer);
+void send_join_room(ENetPeer *peer, uint32_t room_id);
+void send_leave_room(ENetPeer *peer);
+void send_start_room(ENetPeer *peer);
+void send_room_info(ENetPeer *peer, uint32_t room_id, uint16_t num_members);
+void send_handoff(ENetPeer *peer, uint32_t room_id, uint32_t host, uint16_t port);
+
+// Packets too short to hold the fields leave them as they were.
+void deserialize_join_room(ENetPacket *packet, uint32_t &room_id);
+void deserialize_room_info(ENetPacket *packet, uint32_t &room_id, uint16_t &num_members);
+// Returns false if the packet is too short.
+bool deserialize_handoff(ENetPacket *packet, uint32_t &room_id, uint32_t &host, uint16_t &port);
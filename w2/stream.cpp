@@ -0,0 +1,317 @@
+#include "stream.h"
+#include <cstring> // memcpy
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator> // std::size
+
+// type | id | total size | checksum | chunk size | chunk index
+constexpr size_t chunk_header_size = sizeof(uint8_t) + 3 * sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t);
+// ENet protocol + unsequenced command headers, a bit of slack for checksums
+constexpr uint16_t enet_overhead = 32;
+constexpr uint16_t default_chunk_size = 512 - chunk_header_size;
+constexpr uint16_t probe_sizes[] = { 576, 1024, 1280, 1400 };
+constexpr uint8_t max_probe_attempts = 3;
+constexpr uint32_t probe_interval = 200; // ms
+constexpr uint32_t min_rto = 30; // ms
+
+static float simulatedLoss = 0.f;
+
+void stream_set_simulated_loss(float probability)
+{
+  simulatedLoss = probability;
+}
+
+static bool send_unsequenced(ENetPeer *peer, ENetPacket *packet)
+{
+  if (simulatedLoss > 0.f && float(rand()) / float(RAND_MAX) < simulatedLoss)
+  {
+    enet_packet_destroy(packet);
+    return false;
+  }
+  enet_peer_send(peer, stream_channel, packet);
+  return true;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t size)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+static uint16_t max_probe_size(ENetPeer *peer)
+{
+  return uint16_t(peer->mtu > enet_overhead ? peer->mtu - enet_overhead : 0);
+}
+
+static void send_probes(StreamSender &sender)
+{
+  uint16_t maxSize = max_probe_size(sender.peer);
+  for (uint16_t size : probe_sizes)
+  {
+    if (size > maxSize || size <= sender.chunkSize + chunk_header_size)
+      continue;
+    ENetPacket *packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_UNSEQUENCED);
+    memset(packet->data, 0, size);
+    uint8_t *ptr = packet->data;
+    *ptr = E_STREAM_MTU_PROBE; ptr += sizeof(uint8_t);
+    memcpy(ptr, &size, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+    send_unsequenced(sender.peer, packet);
+  }
+}
+
+static void send_chunk(StreamSender &sender, OutgoingStream &stream, uint32_t idx)
+{
+  uint32_t offset = idx * stream.chunkSize;
+  uint32_t totalSize = uint32_t(stream.data.size());
+  uint16_t size = uint16_t(std::min<uint32_t>(stream.chunkSize, totalSize - offset));
+  ENetPacket *packet = enet_packet_create(nullptr, chunk_header_size + size, ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = packet->data;
+  *ptr = E_STREAM_CHUNK; ptr += sizeof(uint8_t);
+  memcpy(ptr, &stream.id, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &totalSize, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &stream.checksum, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &stream.chunkSize, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  memcpy(ptr, &idx, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, stream.data.data() + offset, size); ptr += size;
+
+  sender.stats.chunksSent++;
+  if (!send_unsequenced(sender.peer, packet))
+    sender.stats.chunksDropped++;
+}
+
+void stream_sender_init(StreamSender &sender, ENetPeer *peer)
+{
+  sender = StreamSender();
+  sender.peer = peer;
+  sender.chunkSize = default_chunk_size;
+}
+
+uint32_t stream_send(StreamSender &sender, const void *data, size_t size, uint32_t cur_time)
+{
+  if (size > max_stream_size)
+    return 0; // the receiver would refuse it
+  OutgoingStream stream;
+  stream.id = sender.nextId++;
+  stream.startTime = cur_time;
+  stream.chunkSize = sender.chunkSize;
+  stream.data.assign((const uint8_t*)data, (const uint8_t*)data + size);
+  stream.checksum = fnv1a(stream.data.data(), size);
+  stream.numChunks = std::max<uint32_t>(1, uint32_t((size + stream.chunkSize - 1) / stream.chunkSize));
+  stream.acked.assign(stream.numChunks, 0);
+  stream.sendTime.assign(stream.numChunks, 0);
+  sender.queue.push_back(std::move(stream));
+  sender.stats.messagesSent++;
+  return sender.queue.back().id;
+}
+
+void stream_sender_update(StreamSender &sender, uint32_t cur_time)
+{
+  if (!sender.probingDone && cur_time - sender.lastProbeTime >= probe_interval)
+  {
+    if (sender.probeAttempts < max_probe_attempts)
+    {
+      send_probes(sender);
+      sender.probeAttempts++;
+      sender.lastProbeTime = cur_time;
+    }
+    else
+      sender.probingDone = true; // whatever did not come back does not fit the path
+  }
+
+  if (sender.queue.empty())
+    return;
+  OutgoingStream &stream = sender.queue.front();
+  uint32_t rto = std::max(min_rto, sender.peer->roundTripTime + 2 * sender.peer->roundTripTimeVariance);
+  for (uint32_t i = stream.firstUnacked; i < stream.nextUnsent; ++i)
+    if (!stream.acked[i] && cur_time - stream.sendTime[i] >= rto)
+    {
+      send_chunk(sender, stream, i);
+      stream.sendTime[i] = cur_time;
+      sender.stats.chunksRetransmitted++;
+    }
+  while (stream.inFlight < stream_window && stream.nextUnsent < stream.numChunks)
+  {
+    send_chunk(sender, stream, stream.nextUnsent);
+    stream.sendTime[stream.nextUnsent] = cur_time;
+    stream.nextUnsent++;
+    stream.inFlight++;
+  }
+}
+
+static void on_chunk_acked(OutgoingStream &stream, uint32_t idx)
+{
+  if (idx >= stream.nextUnsent || stream.acked[idx])
+    return;
+  stream.acked[idx] = 1;
+  stream.numAcked++;
+  stream.inFlight--;
+}
+
+void stream_sender_on_packet(StreamSender &sender, ENetPacket *packet, uint32_t cur_time)
+{
+  uint8_t *ptr = packet->data;
+  uint8_t type = *ptr; ptr += sizeof(uint8_t);
+  if (type == E_STREAM_MTU_PROBE_ACK && packet->dataLength >= sizeof(uint8_t) + sizeof(uint16_t))
+  {
+    uint16_t size = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+    if (size > chunk_header_size && size - chunk_header_size > sender.chunkSize)
+      sender.chunkSize = size - chunk_header_size;
+    if (size >= std::min(probe_sizes[std::size(probe_sizes) - 1], max_probe_size(sender.peer)))
+      sender.probingDone = true;
+    return;
+  }
+  if (type != E_STREAM_CHUNK_ACK || packet->dataLength < sizeof(uint8_t) + 3 * sizeof(uint32_t) || sender.queue.empty())
+    return;
+
+  uint32_t id = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint32_t base = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint32_t bits = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  OutgoingStream &stream = sender.queue.front();
+  if (id != stream.id)
+    return;
+  // everything below base arrived, bits cover base+1..base+32
+  for (uint32_t i = stream.firstUnacked; i < std::min(base, stream.numChunks); ++i)
+    on_chunk_acked(stream, i);
+  for (uint32_t i = 0; i < 32; ++i)
+    if (bits & (1u << i))
+      on_chunk_acked(stream, base + 1 + i);
+  while (stream.firstUnacked < stream.numChunks && stream.acked[stream.firstUnacked])
+    stream.firstUnacked++;
+
+  if (stream.numAcked == stream.numChunks)
+  {
+    sender.stats.messagesDelivered++;
+    sender.stats.lastDeliveryTime = cur_time - stream.startTime;
+    sender.queue.pop_front();
+  }
+}
+
+static void send_chunk_ack(ENetPeer *peer, uint32_t id, uint32_t base, uint32_t bits)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + 3 * sizeof(uint32_t), ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = packet->data;
+  *ptr = E_STREAM_CHUNK_ACK; ptr += sizeof(uint8_t);
+  memcpy(ptr, &id, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &base, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  memcpy(ptr, &bits, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  send_unsequenced(peer, packet);
+}
+
+static void on_probe(ENetPeer *peer, ENetPacket *packet)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint16_t))
+    return;
+  uint16_t size = *(uint16_t*)(packet->data + sizeof(uint8_t));
+  if (size != packet->dataLength)
+    return;
+  ENetPacket *ack = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t), ENET_PACKET_FLAG_UNSEQUENCED);
+  uint8_t *ptr = ack->data;
+  *ptr = E_STREAM_MTU_PROBE_ACK; ptr += sizeof(uint8_t);
+  memcpy(ptr, &size, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  send_unsequenced(peer, ack);
+}
+
+void stream_receiver_on_packet(StreamReceiver &receiver, ENetPeer *peer, ENetPacket *packet,
+                               uint32_t cur_time, const stream_cb_t &cb)
+{
+  uint8_t *ptr = packet->data;
+  uint8_t type = *ptr; ptr += sizeof(uint8_t);
+  if (type == E_STREAM_MTU_PROBE)
+  {
+    on_probe(peer, packet);
+    return;
+  }
+  if (type != E_STREAM_CHUNK || packet->dataLength < chunk_header_size)
+    return;
+
+  uint32_t id = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint32_t totalSize = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint32_t checksum = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint16_t chunkSize = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  uint32_t idx = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  size_t payloadSize = packet->dataLength - chunk_header_size;
+  if (chunkSize == 0 || payloadSize > chunkSize || totalSize > max_stream_size)
+    return;
+  uint32_t numChunks = uint32_t(std::max<uint64_t>(1, (uint64_t(totalSize) + chunkSize - 1) / chunkSize));
+
+  for (uint32_t completedId : receiver.completed)
+    if (completedId == id)
+    {
+      // our last ack got lost
+      send_chunk_ack(peer, id, numChunks, 0);
+      return;
+    }
+
+  auto it = receiver.streams.find(id);
+  if (it == receiver.streams.end())
+  {
+    IncomingStream stream;
+    stream.totalSize = totalSize;
+    stream.checksum = checksum;
+    stream.chunkSize = chunkSize;
+    stream.numChunks = numChunks;
+    stream.firstChunkTime = cur_time;
+    stream.lastChunkTime = cur_time;
+    stream.data.resize(totalSize);
+    stream.received.assign(numChunks, 0);
+    it = receiver.streams.emplace(id, std::move(stream)).first;
+  }
+  IncomingStream &stream = it->second;
+  uint64_t offset = uint64_t(idx) * stream.chunkSize;
+  if (totalSize != stream.totalSize || chunkSize != stream.chunkSize || idx >= stream.numChunks ||
+      offset + payloadSize > stream.totalSize)
+    return;
+  if (!stream.received[idx])
+  {
+    memcpy(stream.data.data() + offset, ptr, payloadSize);
+    stream.received[idx] = 1;
+    stream.numReceived++;
+    stream.lastChunkTime = cur_time;
+    while (stream.firstMissing < stream.numChunks && stream.received[stream.firstMissing])
+      stream.firstMissing++;
+  }
+
+  uint32_t bits = 0;
+  for (uint32_t i = 0; i < 32; ++i)
+  {
+    uint32_t chunk = stream.firstMissing + 1 + i;
+    if (chunk < stream.numChunks && stream.received[chunk])
+      bits |= 1u << i;
+  }
+  send_chunk_ack(peer, id, stream.firstMissing, bits);
+
+  if (stream.numReceived == stream.numChunks)
+  {
+    bool intact = fnv1a(stream.data.data(), stream.data.size()) == stream.checksum;
+    cb(id, stream.data, cur_time - stream.firstChunkTime, intact);
+    receiver.completed[receiver.completedCursor++ % std::size(receiver.completed)] = id;
+    receiver.streams.erase(it);
+  }
+}
+
+uint32_t stream_receiver_update(StreamReceiver &receiver, uint32_t cur_time)
+{
+  uint32_t dropped = 0;
+  for (auto it = receiver.streams.begin(); it != receiver.streams.end();)
+  {
+    if (cur_time - it->second.lastChunkTime >= stream_timeout)
+    {
+      it = receiver.streams.erase(it);
+      dropped++;
+    }
+    else
+      ++it;
+  }
+  return dropped;
+}
+
+void send_micro_packet(ENetPeer *peer, const char *msg)
+{
+  size_t len = strlen(msg) + 1;
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + len, ENET_PACKET_FLAG_UNSEQUENCED);
+  *packet->data = E_STREAM_MICRO;
+  memcpy(packet->data + sizeof(uint8_t), msg, len);
+  enet_peer_send(peer, 1, packet);
+}
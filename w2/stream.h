@@ -0,0 +1,103 @@
+#pragma once
+#include <enet/enet.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// Large messages are cut into chunks that go out unsequenced and are acked one by one,
+// so a lost chunk is resent on its own instead of stalling a reliable ENet channel.
+// Chunk size comes from path MTU probing, at most stream_window chunks are in flight.
+
+enum StreamMessageType : uint8_t
+{
+  E_STREAM_MICRO = 0, // small real-time payload, not part of any stream
+  E_STREAM_MTU_PROBE,
+  E_STREAM_MTU_PROBE_ACK,
+  E_STREAM_CHUNK,
+  E_STREAM_CHUNK_ACK
+};
+
+constexpr uint8_t stream_channel = 0;
+constexpr uint32_t stream_window = 32;
+// The receiver allocates a whole message on its first chunk, bigger ones are refused, and
+// drops one that has not had a new chunk for stream_timeout ms.
+constexpr uint32_t max_stream_size = 4 << 20;
+constexpr uint32_t stream_timeout = 10000; // ms
+
+struct StreamStats
+{
+  uint32_t messagesSent = 0;
+  uint32_t messagesDelivered = 0;
+  uint32_t chunksSent = 0;
+  uint32_t chunksRetransmitted = 0;
+  uint32_t chunksDropped = 0; // by simulated loss
+  uint32_t lastDeliveryTime = 0; // ms, from stream_send to the last ack
+};
+
+struct OutgoingStream
+{
+  uint32_t id = 0;
+  uint32_t checksum = 0;
+  uint32_t startTime = 0;
+  uint16_t chunkSize = 0;
+  uint32_t numChunks = 0;
+  uint32_t numAcked = 0;
+  uint32_t firstUnacked = 0;
+  uint32_t nextUnsent = 0;
+  uint32_t inFlight = 0;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> acked;
+  std::vector<uint32_t> sendTime;
+};
+
+struct StreamSender
+{
+  ENetPeer *peer = nullptr;
+  uint16_t chunkSize = 0;
+  uint32_t nextId = 1;
+  uint8_t probeAttempts = 0;
+  uint32_t lastProbeTime = 0;
+  bool probingDone = false;
+  std::deque<OutgoingStream> queue; // front is in flight
+  StreamStats stats;
+};
+
+struct IncomingStream
+{
+  uint32_t totalSize = 0;
+  uint32_t checksum = 0;
+  uint32_t firstChunkTime = 0;
+  uint32_t lastChunkTime = 0; // of the last new one
+  uint16_t chunkSize = 0;
+  uint32_t numChunks = 0;
+  uint32_t numReceived = 0;
+  uint32_t firstMissing = 0;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> received;
+};
+
+typedef std::function<void(uint32_t id, const std::vector<uint8_t> &data, uint32_t delivery_ms, bool intact)> stream_cb_t;
+
+struct StreamReceiver
+{
+  std::unordered_map<uint32_t, IncomingStream> streams;
+  uint32_t completed[8] = {}; // recently finished ids, late duplicates are still acked
+  uint32_t completedCursor = 0;
+};
+
+void stream_set_simulated_loss(float probability);
+
+void stream_sender_init(StreamSender &sender, ENetPeer *peer);
+// Returns the stream id, 0 if size is over max_stream_size.
+uint32_t stream_send(StreamSender &sender, const void *data, size_t size, uint32_t cur_time);
+void stream_sender_update(StreamSender &sender, uint32_t cur_time);
+void stream_sender_on_packet(StreamSender &sender, ENetPacket *packet, uint32_t cur_time);
+
+void stream_receiver_on_packet(StreamReceiver &receiver, ENetPeer *peer, ENetPacket *packet,
+                               uint32_t cur_time, const stream_cb_t &cb);
+// Forgets incomplete streams that stalled for stream_timeout, returns how many.
+uint32_t stream_receiver_update(StreamReceiver &receiver, uint32_t cur_time);
+
+void send_micro_packet(ENetPeer *peer, const char *msg);
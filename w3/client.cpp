@@ -1,37 +1,21 @@
 #include <enet/enet.h>
 #include <iostream>
-#include <string>
 #include <vector>
-
-void send_array_packet(ENetPeer *peer, const std::vector<uint32_t> &numbers)
-{
-  ENetPacket *packet = enet_packet_create(nullptr, numbers.size() * sizeof(uint32_t) + 2 * sizeof(uint8_t), ENET_PACKET_FLAG_UNSEQUENCED);
-  *((uint8_t*)packet->data) = (uint8_t)numbers.size();
-  memcpy(packet->data+1, numbers.data(), numbers.size() * sizeof(uint32_t));
-
-  enet_peer_send(peer, 1, packet);
-}
-
-void send_int_packet(ENetPeer *peer, int num)
-{
-  std::string str = std::string("packet#") + std::to_string(num);
-  ENetPacket *packet = enet_packet_create(str.c_str(), str.size() + 1, ENET_PACKET_FLAG_UNSEQUENCED);
-
-  enet_peer_send(peer, 1, packet);
-}
+#include "protocol.h"
+#include "log.h"
 
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
   {
-    printf("Cannot init ENet");
+    LOG_ERROR("Cannot init ENet");
     return 1;
   }
 
   ENetHost *client = enet_host_create(nullptr, 1, 2, 0, 0);
   if (!client)
   {
-    printf("Cannot create ENet client\n");
+    LOG_ERROR("Cannot create ENet client\n");
     return 1;
   }
 
@@ -42,12 +26,13 @@ int main(int argc, const char **argv)
   ENetPeer *serverPeer = enet_host_connect(client, &address, 2, 0);
   if (!serverPeer)
   {
-    printf("Cannot connect to server");
+    LOG_ERROR("Cannot connect to server");
     return 1;
   }
 
   uint32_t timeStart = enet_time_get();
   uint32_t lastMicroSendTime = timeStart;
+  uint32_t lastArraySendTime = timeStart;
   bool connected = false;
   while (true)
   {
@@ -57,11 +42,11 @@ int main(int argc, const char **argv)
       switch (event.type)
       {
       case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        LOG_INFO("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
         connected = true;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        printf("Packet received '%s'\n", event.packet->data);
+        LOG_INFO("Packet received '%s'\n", (const char*)event.packet->data);
         enet_packet_destroy(event.packet);
         break;
       default:
@@ -77,6 +62,18 @@ int main(int argc, const char **argv)
         static int counter = 0;
         send_int_packet(serverPeer, counter++);
       }
+      if (curTime - lastArraySendTime > 1000)
+      {
+        lastArraySendTime = curTime;
+        static uint32_t arrayId = 0;
+        // sorted ids compress well with delta, so alternate to exercise both modes
+        std::vector<uint32_t> numbers(1000);
+        uint32_t value = curTime;
+        for (uint32_t &n : numbers)
+          n = (value += rand() % 100);
+        send_array_packet(serverPeer, arrayId, numbers, arrayId % 2 == 0);
+        arrayId++;
+      }
     }
   }
   return 0;
@@ -0,0 +1,175 @@
+#include "log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rings are never freed: a thread may exit while its last records are still unflushed.
+static std::mutex ringsMutex;
+static std::vector<std::unique_ptr<LogRing>> rings;
+static std::atomic<size_t> ringCount{0};
+
+struct LogFlusher
+{
+  std::thread thread;
+  std::atomic<bool> started{false};
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> flushedTo{0}; // generation of the last full pass, for log_flush
+
+  ~LogFlusher()
+  {
+    if (!thread.joinable())
+      return;
+    stop.store(true);
+    thread.join();
+  }
+};
+static LogFlusher flusher;
+
+static bool is_int_conversion(char c)
+{
+  return c == 'd' || c == 'i' || c == 'u' || c == 'o' || c == 'x' || c == 'X';
+}
+
+// Formats one record with its own snprintf per conversion, so stored 64-bit args
+// are passed with matching types whatever length modifiers the format uses.
+static size_t format_record(const LogRecord &rec, char *out, size_t size)
+{
+  size_t len = 0;
+  size_t argIdx = 0;
+  auto append = [&](int n) { if (n > 0) len = std::min(size - 1, len + size_t(n)); };
+  for (const char *p = rec.fmt; *p && len + 1 < size; )
+  {
+    if (*p != '%')
+    {
+      out[len++] = *p++;
+      continue;
+    }
+    if (p[1] == '%')
+    {
+      out[len++] = '%';
+      p += 2;
+      continue;
+    }
+    // %[flags][width][.precision][length]conversion
+    char spec[32];
+    size_t specLen = 0;
+    const char *start = p;
+    spec[specLen++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && specLen < sizeof(spec) - 4)
+      spec[specLen++] = *p++;
+    while (*p && strchr("hlLqjzt", *p))
+      p++;
+    char conv = *p;
+    if (!conv || argIdx >= rec.argCount)
+    {
+      // malformed or missing argument, print the spec as is
+      for (; start != p + (conv ? 1 : 0) && len + 1 < size; ++start)
+        out[len++] = *start;
+      p += conv ? 1 : 0;
+      continue;
+    }
+    p++;
+    if (is_int_conversion(conv))
+    {
+      spec[specLen++] = 'l';
+      spec[specLen++] = 'l';
+    }
+    spec[specLen++] = conv;
+    spec[specLen] = '\0';
+
+    uint64_t arg = rec.args[argIdx];
+    LogArgType type = rec.argTypes[argIdx];
+    argIdx++;
+    double d = 0.0;
+    memcpy(&d, &arg, sizeof(double));
+    double asDouble = type == E_LOG_ARG_DOUBLE ? d : type == E_LOG_ARG_INT ? double(int64_t(arg)) : double(arg);
+    long long asInt = type == E_LOG_ARG_DOUBLE ? (long long)d : (long long)arg;
+    char *dst = out + len;
+    size_t room = size - len;
+    if (type == E_LOG_ARG_STRING || conv == 's')
+      append(snprintf(dst, room, spec, type == E_LOG_ARG_STRING ? rec.strings + arg : "(?)"));
+    else if (conv == 'p')
+      append(snprintf(dst, room, spec, (void*)uintptr_t(arg)));
+    else if (conv == 'c')
+      append(snprintf(dst, room, spec, int(asInt)));
+    else if (is_int_conversion(conv))
+      append(snprintf(dst, room, spec, asInt));
+    else
+      append(snprintf(dst, room, spec, asDouble));
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static void flush_thread()
+{
+  std::vector<LogRing*> local;
+  std::vector<uint32_t> reportedDrops;
+  char line[1024];
+  uint64_t generation = 0;
+  while (true)
+  {
+    bool stopping = flusher.stop.load();
+    if (local.size() != ringCount.load(std::memory_order_acquire))
+    {
+      std::lock_guard<std::mutex> lock(ringsMutex);
+      for (size_t i = local.size(); i < rings.size(); ++i)
+        local.push_back(rings[i].get());
+      reportedDrops.resize(local.size(), 0);
+    }
+
+    bool wrote = false;
+    for (size_t r = 0; r < local.size(); ++r)
+    {
+      LogRing &ring = *local[r];
+      uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+      uint32_t head = ring.head.load(std::memory_order_acquire);
+      for (; tail != head; ++tail)
+      {
+        size_t len = format_record(ring.records[tail & (log_ring_size - 1)], line, sizeof(line));
+        fwrite(line, 1, len, stdout);
+        wrote = true;
+      }
+      ring.tail.store(tail, std::memory_order_release);
+
+      uint32_t dropped = ring.dropped.load(std::memory_order_relaxed);
+      if (dropped != reportedDrops[r])
+      {
+        fprintf(stdout, "log: %u records dropped, ring full\n", dropped - reportedDrops[r]);
+        reportedDrops[r] = dropped;
+        wrote = true;
+      }
+    }
+    if (wrote)
+      fflush(stdout);
+    flusher.flushedTo.store(++generation, std::memory_order_release);
+    if (stopping)
+      break;
+    if (!wrote)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+LogRing *log_register_thread()
+{
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  rings.push_back(std::make_unique<LogRing>());
+  ringCount.store(rings.size(), std::memory_order_release);
+  if (!flusher.started.exchange(true))
+    flusher.thread = std::thread(flush_thread);
+  return rings.back().get();
+}
+
+void log_flush()
+{
+  if (!flusher.started.load())
+    return;
+  // two full passes started after this call guarantee everything before it was written
+  uint64_t target = flusher.flushedTo.load(std::memory_order_acquire) + 2;
+  while (flusher.flushedTo.load(std::memory_order_acquire) < target)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
@@ -0,0 +1,98 @@
+#include "protocol.h"
+#include "varint.h"
+#include <cstring>
+
+void send_int_packet(ENetPeer *peer, int num)
+{
+  uint8_t buf[sizeof(uint8_t) + max_varint_size];
+  uint8_t *ptr = buf;
+  *ptr = E_CLIENT_TO_SERVER_INT; ptr += sizeof(uint8_t);
+  ptr = write_varint(ptr, zigzag_encode(num));
+  ENetPacket *packet = enet_packet_create(buf, ptr - buf, ENET_PACKET_FLAG_UNSEQUENCED);
+
+  enet_peer_send(peer, 1, packet);
+}
+
+void send_array_packet(ENetPeer *peer, uint32_t array_id, const std::vector<uint32_t> &numbers, bool delta)
+{
+  // type | array id | total count | first index | chunk count | flags | prev
+  constexpr size_t chunk_header_size = 2 * sizeof(uint8_t) + 5 * max_varint_size;
+  uint8_t buf[max_array_chunk_size];
+  uint8_t payload[max_array_chunk_size];
+  uint32_t totalCount = uint32_t(numbers.size());
+  uint32_t first = 0;
+  do
+  {
+    // pack values while the next one is guaranteed to fit, header size is known only afterwards
+    uint32_t prev = first > 0 ? numbers[first - 1] : 0;
+    uint32_t last = prev;
+    uint8_t *payloadEnd = payload;
+    uint32_t count = 0;
+    while (first + count < totalCount && payloadEnd + max_varint_size <= payload + sizeof(payload) - chunk_header_size)
+    {
+      uint32_t v = numbers[first + count++];
+      payloadEnd = write_varint(payloadEnd, delta ? zigzag_encode(int32_t(v - last)) : v);
+      last = v;
+    }
+
+    uint8_t *ptr = buf;
+    *ptr = E_CLIENT_TO_SERVER_ARRAY_CHUNK; ptr += sizeof(uint8_t);
+    ptr = write_varint(ptr, array_id);
+    ptr = write_varint(ptr, totalCount);
+    ptr = write_varint(ptr, first);
+    ptr = write_varint(ptr, count);
+    *ptr = delta ? E_ARRAY_DELTA : 0; ptr += sizeof(uint8_t);
+    if (delta)
+      ptr = write_varint(ptr, prev);
+    memcpy(ptr, payload, payloadEnd - payload); ptr += payloadEnd - payload;
+
+    ENetPacket *packet = enet_packet_create(buf, ptr - buf, ENET_PACKET_FLAG_UNSEQUENCED);
+    enet_peer_send(peer, 1, packet);
+    first += count;
+  } while (first < totalCount);
+}
+
+MessageType get_packet_type(ENetPacket *packet)
+{
+  return (MessageType)*packet->data;
+}
+
+bool deserialize_int_packet(ENetPacket *packet, int &num)
+{
+  const uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  uint32_t v = 0;
+  if (!read_varint(ptr, packet->data + packet->dataLength, v))
+    return false;
+  num = zigzag_decode(v);
+  return true;
+}
+
+bool deserialize_array_chunk(ENetPacket *packet, ArrayChunk &chunk)
+{
+  const uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  const uint8_t *end = packet->data + packet->dataLength;
+  if (!(ptr = read_varint(ptr, end, chunk.arrayId)) ||
+      !(ptr = read_varint(ptr, end, chunk.totalCount)) ||
+      !(ptr = read_varint(ptr, end, chunk.firstIndex)) ||
+      !(ptr = read_varint(ptr, end, chunk.count)) ||
+      ptr >= end)
+    return false;
+  chunk.flags = *ptr; ptr += sizeof(uint8_t);
+  chunk.prev = 0;
+  if ((chunk.flags & E_ARRAY_DELTA) && !(ptr = read_varint(ptr, end, chunk.prev)))
+    return false;
+  if (chunk.totalCount > max_array_count || uint64_t(chunk.firstIndex) + chunk.count > chunk.totalCount)
+    return false;
+  chunk.payload = ptr;
+  chunk.end = end;
+  return true;
+}
+
+bool decode_array_chunk(const ArrayChunk &chunk, uint32_t *out)
+{
+  if (!decode_varint_array_fast(chunk.payload, chunk.end, chunk.count, out))
+    return false;
+  if (chunk.flags & E_ARRAY_DELTA)
+    undelta_array(out, chunk.count, chunk.prev);
+  return true;
+}
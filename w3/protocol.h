@@ -0,0 +1,44 @@
+#pragma once
+#include <enet/enet.h>
+#include <cstdint>
+#include <vector>
+
+enum MessageType : uint8_t
+{
+  E_CLIENT_TO_SERVER_INT = 0,
+  E_CLIENT_TO_SERVER_ARRAY_CHUNK
+};
+
+enum ArrayFlags : uint8_t
+{
+  E_ARRAY_DELTA = 1 << 0
+};
+
+// Arrays of any length are split into chunks that fit in one datagram. Every chunk carries
+// its first index and, in delta mode, the value right before it, so chunks decode on their own.
+constexpr size_t max_array_chunk_size = 1200;
+// The receiver allocates the whole array on its first chunk, longer ones are refused.
+constexpr uint32_t max_array_count = 1 << 20;
+
+struct ArrayChunk
+{
+  uint32_t arrayId = 0;
+  uint32_t totalCount = 0;
+  uint32_t firstIndex = 0;
+  uint32_t count = 0;
+  uint8_t flags = 0;
+  uint32_t prev = 0;
+  const uint8_t *payload = nullptr;
+  const uint8_t *end = nullptr;
+};
+
+void send_int_packet(ENetPeer *peer, int num);
+// numbers holds at most max_array_count values.
+void send_array_packet(ENetPeer *peer, uint32_t array_id, const std::vector<uint32_t> &numbers, bool delta);
+
+MessageType get_packet_type(ENetPacket *packet);
+
+bool deserialize_int_packet(ENetPacket *packet, int &num);
+bool deserialize_array_chunk(ENetPacket *packet, ArrayChunk &chunk);
+// Decodes chunk.count values into out, returns false on malformed data.
+bool decode_array_chunk(const ArrayChunk &chunk, uint32_t *out);
@@ -1,11 +1,91 @@
 #include <enet/enet.h>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+#include "protocol.h"
+#include "log.h"
+
+struct PendingArray
+{
+  std::vector<uint32_t> values;
+  std::vector<bool> have; // per value, duplicated and overlapping chunks count once
+  uint32_t received = 0;
+  uint32_t firstSeen = 0;
+};
+
+// Chunks are unsequenced and may be lost, incomplete arrays are dropped once too many pile up.
+constexpr size_t max_pending_arrays = 16;
+static std::unordered_map<uint64_t, PendingArray> pendingArrays; // peer id << 32 | array id
+
+static void on_array_chunk(ENetPeer *peer, const ArrayChunk &chunk)
+{
+  uint64_t key = uint64_t(peer->incomingPeerID) << 32 | chunk.arrayId;
+  PendingArray &pending = pendingArrays[key];
+  if (pending.values.size() != chunk.totalCount)
+  {
+    pending.values.assign(chunk.totalCount, 0);
+    pending.have.assign(chunk.totalCount, false);
+    pending.received = 0;
+    pending.firstSeen = enet_time_get();
+  }
+  if (!decode_array_chunk(chunk, pending.values.data() + chunk.firstIndex))
+  {
+    LOG_WARNING("Malformed array #%u chunk\n", chunk.arrayId);
+    return;
+  }
+  for (uint32_t i = chunk.firstIndex; i < chunk.firstIndex + chunk.count; ++i)
+    if (!pending.have[i])
+    {
+      pending.have[i] = true;
+      pending.received++;
+    }
+  if (pending.received == chunk.totalCount)
+  {
+    const std::vector<uint32_t> &v = pending.values;
+    LOG_INFO("Array #%u received: %u elements, first %u last %u\n", chunk.arrayId, chunk.totalCount,
+           v.empty() ? 0 : v.front(), v.empty() ? 0 : v.back());
+    pendingArrays.erase(key);
+    return;
+  }
+  if (pendingArrays.size() > max_pending_arrays)
+  {
+    auto oldest = pendingArrays.begin();
+    for (auto it = pendingArrays.begin(); it != pendingArrays.end(); ++it)
+      if (it->second.firstSeen < oldest->second.firstSeen)
+        oldest = it;
+    LOG_INFO("Array #%u dropped: %u/%zu elements arrived\n", uint32_t(oldest->first), oldest->second.received, oldest->second.values.size());
+    pendingArrays.erase(oldest);
+  }
+}
+
+static void on_receive(ENetPeer *peer, ENetPacket *packet)
+{
+  switch (get_packet_type(packet))
+  {
+  case E_CLIENT_TO_SERVER_INT:
+  {
+    int num = 0;
+    if (deserialize_int_packet(packet, num))
+      LOG_INFO("Packet received 'packet#%d'\n", num);
+    break;
+  }
+  case E_CLIENT_TO_SERVER_ARRAY_CHUNK:
+  {
+    ArrayChunk chunk;
+    if (deserialize_array_chunk(packet, chunk))
+      on_array_chunk(peer, chunk);
+    break;
+  }
+  default:
+    break;
+  };
+}
 
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
   {
-    printf("Cannot init ENet");
+    LOG_ERROR("Cannot init ENet");
     return 1;
   }
   ENetAddress address;
@@ -17,7 +97,7 @@ int main(int argc, const char **argv)
 
   if (!server)
   {
-    printf("Cannot create ENet server\n");
+    LOG_ERROR("Cannot create ENet server\n");
     return 1;
   }
 
@@ -29,10 +109,11 @@ int main(int argc, const char **argv)
       switch (event.type)
       {
       case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        LOG_INFO("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        printf("Packet received '%s'\n", event.packet->data);
+        if (event.packet->dataLength > 0)
+          on_receive(event.peer, event.packet);
         enet_packet_destroy(event.packet);
         break;
       default:
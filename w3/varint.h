@@ -0,0 +1,127 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VARINT_SSE2 1
+#endif
+
+// LEB128: 7 bits per byte, high bit set means another byte follows. uint32_t takes 1..5 bytes.
+constexpr size_t max_varint_size = 5;
+
+inline uint32_t zigzag_encode(int32_t v)
+{
+  return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+}
+
+inline int32_t zigzag_decode(uint32_t v)
+{
+  return int32_t(v >> 1) ^ -int32_t(v & 1);
+}
+
+inline uint8_t *write_varint(uint8_t *ptr, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    *ptr++ = uint8_t(v) | 0x80;
+    v >>= 7;
+  }
+  *ptr++ = uint8_t(v);
+  return ptr;
+}
+
+// Returns nullptr on truncated or overlong input.
+inline const uint8_t *read_varint(const uint8_t *ptr, const uint8_t *end, uint32_t &v)
+{
+  v = 0;
+  for (int shift = 0; shift < 35 && ptr < end; shift += 7)
+  {
+    uint8_t b = *ptr++;
+    v |= uint32_t(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return ptr;
+  }
+  return nullptr;
+}
+
+// Delta mode stores zigzag(v[i] - v[i-1]), prev is the value before values[0].
+inline uint8_t *encode_varint_array(const uint32_t *values, size_t count, bool delta, uint32_t prev, uint8_t *out)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint32_t v = values[i];
+    out = write_varint(out, delta ? zigzag_encode(int32_t(v - prev)) : v);
+    prev = v;
+  }
+  return out;
+}
+
+inline const uint8_t *decode_varint_array_scalar(const uint8_t *ptr, const uint8_t *end, size_t count, uint32_t *out)
+{
+  for (size_t i = 0; i < count && ptr; ++i)
+    ptr = read_varint(ptr, end, out[i]);
+  return ptr;
+}
+
+// Runs of single-byte varints are the common case for deltas and small numbers,
+// those are widened 16 (SSE2) or 8 (SWAR) at a time, anything else is decoded one varint per step.
+inline const uint8_t *decode_varint_array_fast(const uint8_t *ptr, const uint8_t *end, size_t count, uint32_t *out)
+{
+  size_t i = 0;
+#if VARINT_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  while (count - i >= 16 && end - ptr >= 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)ptr);
+    if (_mm_movemask_epi8(bytes) != 0)
+      break;
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_si128((__m128i*)(out + i + 0), _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i*)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+    ptr += 16;
+    i += 16;
+  }
+#endif
+  while (i < count)
+  {
+    if (count - i >= 8 && end - ptr >= 8)
+    {
+      uint64_t word;
+      memcpy(&word, ptr, sizeof(uint64_t));
+      uint64_t continuation = word & 0x8080808080808080ull;
+      if (continuation == 0)
+      {
+        for (int b = 0; b < 8; ++b)
+          out[i + b] = uint32_t(word >> (b * 8)) & 0xff;
+        ptr += 8;
+        i += 8;
+        continue;
+      }
+      // mixed lengths: splitting the word up is branchier than the scalar loop,
+      // so decode the next few varints one by one and probe again after them
+      for (size_t stop = std::min(count, i + 8); i < stop; ++i)
+        if (!(ptr = read_varint(ptr, end, out[i])))
+          return nullptr;
+      continue;
+    }
+    ptr = read_varint(ptr, end, out[i]);
+    if (!ptr)
+      return nullptr;
+    ++i;
+  }
+  return ptr;
+}
+
+inline void undelta_array(uint32_t *values, size_t count, uint32_t prev)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    prev += uint32_t(zigzag_decode(values[i]));
+    values[i] = prev;
+  }
+}
@@ -0,0 +1,98 @@
+// Compares the old array layout (u8 count + raw u32 values) with varint and delta-varint
+// encoding: bytes per element on the wire and ns per element to decode.
+// varint_bench [elements] [iterations]
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "varint.h"
+
+static uint64_t time_nsec()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint8_t *encode_raw(const uint32_t *values, size_t count, uint8_t *out)
+{
+  *out = (uint8_t)count; out += sizeof(uint8_t);
+  memcpy(out, values, count * sizeof(uint32_t));
+  return out + count * sizeof(uint32_t);
+}
+
+static const uint8_t *decode_raw(const uint8_t *ptr, const uint8_t *, size_t count, uint32_t *out)
+{
+  ptr += sizeof(uint8_t);
+  memcpy(out, ptr, count * sizeof(uint32_t));
+  return ptr + count * sizeof(uint32_t);
+}
+
+typedef const uint8_t *(*DecodeFn)(const uint8_t*, const uint8_t*, size_t, uint32_t*);
+
+static void run(const char *dataset, const char *name, const std::vector<uint32_t> &values,
+                const std::vector<uint8_t> &encoded, DecodeFn decode, bool delta, size_t iterations)
+{
+  std::vector<uint32_t> out(values.size());
+  const uint8_t *end = encoded.data() + encoded.size();
+  uint64_t checksum = 0;
+  uint64_t best = UINT64_MAX;
+  // best of several rounds, the machine is rarely quiet
+  for (int round = 0; round < 5; ++round)
+  {
+    uint64_t start = time_nsec();
+    for (size_t it = 0; it < iterations; ++it)
+    {
+      if (!decode(encoded.data(), end, values.size(), out.data()))
+      {
+        printf("%s/%s: decode failed\n", dataset, name);
+        return;
+      }
+      if (delta)
+        undelta_array(out.data(), out.size(), 0);
+      checksum += out[it % out.size()];
+    }
+    best = std::min(best, time_nsec() - start);
+  }
+  double ns = double(best) / (double(iterations) * values.size());
+  bool ok = memcmp(out.data(), values.data(), values.size() * sizeof(uint32_t)) == 0;
+  printf("%-7s %-20s %6.2f bytes/elem %6.2f ns/elem %s (%llu)\n", dataset, name,
+         double(encoded.size()) / values.size(), ns, ok ? "ok" : "MISMATCH", (unsigned long long)checksum);
+}
+
+int main(int argc, const char **argv)
+{
+  size_t count = argc > 1 ? atoi(argv[1]) : 1000;
+  size_t iterations = argc > 2 ? atoi(argv[2]) : 5000;
+  srand(42);
+
+  std::vector<uint32_t> smallValues(count), randomValues(count), sortedValues(count);
+  uint32_t sorted = 1000000;
+  for (size_t i = 0; i < count; ++i)
+  {
+    smallValues[i] = rand() % 100;
+    randomValues[i] = uint32_t(rand()) * 2654435761u;
+    sortedValues[i] = (sorted += rand() % 50);
+  }
+
+  struct Dataset { const char *name; const std::vector<uint32_t> &values; };
+  for (const Dataset &d : {Dataset{"small", smallValues}, Dataset{"random", randomValues}, Dataset{"sorted", sortedValues}})
+  {
+    std::vector<uint8_t> raw(sizeof(uint8_t) + count * sizeof(uint32_t));
+    raw.resize(encode_raw(d.values.data(), count, raw.data()) - raw.data());
+
+    std::vector<uint8_t> plain(count * max_varint_size);
+    plain.resize(encode_varint_array(d.values.data(), count, false, 0, plain.data()) - plain.data());
+
+    std::vector<uint8_t> delta(count * max_varint_size);
+    delta.resize(encode_varint_array(d.values.data(), count, true, 0, delta.data()) - delta.data());
+
+    run(d.name, "raw u32", d.values, raw, decode_raw, false, iterations);
+    run(d.name, "varint scalar", d.values, plain, decode_varint_array_scalar, false, iterations);
+    run(d.name, "varint fast", d.values, plain, decode_varint_array_fast, false, iterations);
+    run(d.name, "delta scalar", d.values, delta, decode_varint_array_scalar, true, iterations);
+    run(d.name, "delta fast", d.values, delta, decode_varint_array_fast, true, iterations);
+  }
+  return 0;
+}